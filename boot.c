@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "boot.h"
+
+/*
+ * A milestone's pattern is matched a byte at a time with Knuth-Morris-Pratt,
+ * so a match split across bursts is found without buffering the stream.
+ */
+struct boot_milestone {
+	char name[UUART_BOOT_NAME_MAX];
+	const uint8_t *pattern;
+	size_t len;
+	/* The length of the longest proper prefix that is also a suffix */
+	uint8_t fail[UUART_BOOT_PATTERN_MAX];
+	/* Bytes of the pattern matched so far */
+	size_t state;
+
+	bool seen;
+	struct uuart_boot_phase_stats stats;
+};
+
+struct uuart_boot {
+	struct boot_milestone m[UUART_BOOT_MAX];
+	size_t n;
+	uuart_boot_fn fn;
+	void *priv;
+
+	uint64_t offset;
+	unsigned int boot;
+	size_t nr_seen;
+	/* The milestone seen last in this boot, and CLOCK_MONOTONIC times */
+	int last;
+	uint64_t last_ns;
+	uint64_t start_ns;
+};
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool valid_name(const char *name, size_t len)
+{
+	if (!len || len >= UUART_BOOT_NAME_MAX)
+		return false;
+
+	/* Names go into JSON unescaped */
+	for (size_t i = 0; i < len; i++) {
+		if (!(name[i] >= 'a' && name[i] <= 'z') &&
+		    !(name[i] >= 'A' && name[i] <= 'Z') &&
+		    !(name[i] >= '0' && name[i] <= '9') &&
+		    !strchr("-_.", name[i]))
+			return false;
+	}
+
+	return true;
+}
+
+int uuart_boot_parse_milestone(struct uuart_boot_config *cfg, const char *arg)
+{
+	const char *eq = strchr(arg, '=');
+	struct uuart_boot_milestone *m;
+	size_t len;
+
+	if (!eq || !valid_name(arg, eq - arg))
+		return -EINVAL;
+
+	len = strlen(eq + 1);
+	if (!len || len > UUART_BOOT_PATTERN_MAX)
+		return -EINVAL;
+
+	if (cfg->n == UUART_BOOT_MAX)
+		return -ENOSPC;
+
+	m = &cfg->milestones[cfg->n++];
+	memcpy(m->name, arg, eq - arg);
+	m->name[eq - arg] = '\0';
+	m->pattern = eq + 1;
+
+	return 0;
+}
+
+int uuart_boot_new(struct uuart_boot **bp, const struct uuart_boot_config *cfg,
+		   uuart_boot_fn fn, void *priv)
+{
+	struct boot_milestone *m;
+	struct uuart_boot *b;
+
+	if (!cfg->n || cfg->n > UUART_BOOT_MAX)
+		return -EINVAL;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return -errno;
+
+	b->n = cfg->n;
+	b->fn = fn;
+	b->priv = priv;
+	b->last = -1;
+
+	for (size_t i = 0; i < b->n; i++) {
+		m = &b->m[i];
+		memcpy(m->name, cfg->milestones[i].name, sizeof(m->name));
+		m->pattern = (const uint8_t *)cfg->milestones[i].pattern;
+		m->len = strlen(cfg->milestones[i].pattern);
+		if (!m->len || m->len > UUART_BOOT_PATTERN_MAX) {
+			free(b);
+			return -EINVAL;
+		}
+
+		m->stats.min_ns = UINT64_MAX;
+		for (size_t j = 1, k = 0; j < m->len; j++) {
+			while (k && m->pattern[j] != m->pattern[k])
+				k = m->fail[k - 1];
+			if (m->pattern[j] == m->pattern[k])
+				k++;
+			m->fail[j] = k;
+		}
+	}
+
+	*bp = b;
+
+	return 0;
+}
+
+void uuart_boot_free(struct uuart_boot *b)
+{
+	free(b);
+}
+
+/* Start over on the first milestone, keeping the stats */
+static void new_boot(struct uuart_boot *b)
+{
+	for (size_t i = 0; i < b->n; i++) {
+		b->m[i].seen = false;
+		b->m[i].state = 0;
+		b->m[i].stats.last_ns = 0;
+	}
+
+	b->boot++;
+	b->nr_seen = 0;
+	b->last = -1;
+}
+
+static void reached(struct uuart_boot *b, size_t i, uint64_t offset,
+		    uint64_t *now, uint64_t *realtime)
+{
+	struct boot_milestone *m = &b->m[i];
+	struct uuart_boot_event ev = {0};
+
+	/* One clock read a burst, however many milestones it holds */
+	if (!*now) {
+		*now = clock_ns(CLOCK_MONOTONIC);
+		*realtime = clock_ns(CLOCK_REALTIME);
+	}
+
+	if (!b->boot || (i == 0 && b->nr_seen))
+		new_boot(b);
+	if (!b->nr_seen)
+		b->start_ns = *now;
+
+	ev.boot = b->boot;
+	ev.milestone = i;
+	ev.from = b->last;
+	ev.realtime_ns = *realtime;
+	ev.phase_ns = b->last >= 0 ? *now - b->last_ns : 0;
+	ev.boot_ns = *now - b->start_ns;
+	ev.offset = offset;
+
+	if (b->last >= 0) {
+		m->stats.count++;
+		m->stats.total_ns += ev.phase_ns;
+		if (ev.phase_ns < m->stats.min_ns)
+			m->stats.min_ns = ev.phase_ns;
+		if (ev.phase_ns > m->stats.max_ns)
+			m->stats.max_ns = ev.phase_ns;
+		m->stats.last_ns = ev.phase_ns;
+	}
+
+	m->seen = true;
+	b->nr_seen++;
+	b->last = i;
+	b->last_ns = *now;
+
+	if (b->fn)
+		b->fn(b->priv, b, &ev);
+}
+
+void uuart_boot_rx(struct uuart_boot *b, const uint8_t *buf, size_t len)
+{
+	uint64_t now = 0, realtime = 0;
+	struct boot_milestone *m;
+
+	for (size_t j = 0; j < len; j++) {
+		for (size_t i = 0; i < b->n; i++) {
+			m = &b->m[i];
+			/* The first milestone is watched for throughout */
+			if (m->seen && i)
+				continue;
+
+			while (m->state && buf[j] != m->pattern[m->state])
+				m->state = m->fail[m->state - 1];
+			if (buf[j] == m->pattern[m->state])
+				m->state++;
+			if (m->state < m->len)
+				continue;
+
+			m->state = 0;
+			reached(b, i, b->offset + j, &now, &realtime);
+		}
+	}
+
+	b->offset += len;
+}
+
+const char *uuart_boot_name(const struct uuart_boot *b, size_t milestone)
+{
+	return milestone < b->n ? b->m[milestone].name : NULL;
+}
+
+unsigned int uuart_boot_count(const struct uuart_boot *b)
+{
+	return b->boot;
+}
+
+uint64_t uuart_boot_last_ns(const struct uuart_boot *b)
+{
+	return b->nr_seen ? b->last_ns - b->start_ns : 0;
+}
+
+void uuart_boot_phase_stats(const struct uuart_boot *b, size_t milestone,
+			    struct uuart_boot_phase_stats *stats)
+{
+	*stats = b->m[milestone].stats;
+	if (!stats->count)
+		stats->min_ns = 0;
+}
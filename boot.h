@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_BOOT_H
+#define UUART_BOOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A boot timeline of the host, read off its console. Each milestone is a
+ * piece of text the host prints at a known point of its boot, such as a
+ * firmware banner or the login prompt, listed in the order they are
+ * expected. The Rx stream is matched against every milestone not yet seen
+ * in the current boot, and each match is reported with the BMC's time and
+ * the length of the phase it ends: the time since the last milestone seen
+ * before it. Seeing the first milestone again starts a new boot.
+ */
+
+#define UUART_BOOT_MAX		16
+#define UUART_BOOT_NAME_MAX	32
+#define UUART_BOOT_PATTERN_MAX	128
+
+struct uuart_boot;
+
+struct uuart_boot_milestone {
+	char name[UUART_BOOT_NAME_MAX];
+	const char *pattern;
+};
+
+struct uuart_boot_config {
+	struct uuart_boot_milestone milestones[UUART_BOOT_MAX];
+	size_t n;
+};
+
+struct uuart_boot_event {
+	/* The boot it belongs to, counting from one */
+	unsigned int boot;
+	size_t milestone;
+	/* The milestone that started the phase, or -1 if this one starts it */
+	int from;
+	/* CLOCK_REALTIME of the burst that completed the match */
+	uint64_t realtime_ns;
+	/* Time since the phase and the boot started */
+	uint64_t phase_ns;
+	uint64_t boot_ns;
+	/* Offset in the Rx stream of the byte that completed the match */
+	uint64_t offset;
+};
+
+/* Called from uuart_boot_rx() for each milestone seen */
+typedef void (*uuart_boot_fn)(void *priv, const struct uuart_boot *b,
+			      const struct uuart_boot_event *ev);
+
+/* Durations of the phase ending at a milestone, over every boot seen */
+struct uuart_boot_phase_stats {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	/* In the latest boot, or zero if it hasn't been reached */
+	uint64_t last_ns;
+};
+
+/*
+ * Append the milestone "NAME=TEXT" in @arg to @cfg. @arg must outlive @cfg.
+ * Returns -EINVAL for a malformed milestone and -ENOSPC if @cfg is full.
+ */
+int uuart_boot_parse_milestone(struct uuart_boot_config *cfg, const char *arg);
+
+/* The patterns in @cfg must outlive the timeline */
+int uuart_boot_new(struct uuart_boot **bp, const struct uuart_boot_config *cfg,
+		   uuart_boot_fn fn, void *priv);
+void uuart_boot_free(struct uuart_boot *b);
+
+/* Match @buf, the next of the Rx stream */
+void uuart_boot_rx(struct uuart_boot *b, const uint8_t *buf, size_t len);
+
+const char *uuart_boot_name(const struct uuart_boot *b, size_t milestone);
+
+/* Boots seen, and how long the latest took from first to last milestone */
+unsigned int uuart_boot_count(const struct uuart_boot *b);
+uint64_t uuart_boot_last_ns(const struct uuart_boot *b);
+
+void uuart_boot_phase_stats(const struct uuart_boot *b, size_t milestone,
+			    struct uuart_boot_phase_stats *stats);
+
+#endif
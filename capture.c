@@ -0,0 +1,899 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "hist.h"
+
+#define CACHE_LINE		64
+#define CAPTURE_RING_SIZE	65536
+/* Bursts in flight per device, a power of two */
+#define CAPTURE_MARKS		256
+/* Bounds for a writer's backoff while every ring is empty */
+#define WRITER_IDLE_MIN_NS	10000UL
+#define WRITER_IDLE_MAX_NS	1000000UL
+/* How long a writer waits on a full non-blocking fd before letting go */
+#define WRITER_WAIT_MS		1
+
+#define MERGE_DELAY_NS		10000000UL
+#define MERGE_BUF_SIZE		65536
+#define MERGE_PENDING		4096
+#define MERGE_MAGIC		"UUMERGE2"
+/* A record's delta, saying its time since the start follows as a u64 */
+#define MERGE_ABS_US		UINT32_MAX
+
+/* A burst: where its last byte ends in the ring, and when it was drained */
+struct capture_mark {
+	uint64_t end;
+	uint64_t ns;
+};
+
+/*
+ * The poller's and the writers' fields sit on cache lines of their own, so
+ * neither side's stores invalidate the line the other is writing.
+ */
+struct capture_dev {
+	/* Set up before the threads start, then read-only */
+	struct uuart *dev;
+	unsigned int index;
+	int fd;
+	char *name;
+	uint8_t *buf;
+	size_t size;
+
+	/* Written by the poller */
+	_Alignas(CACHE_LINE) _Atomic uint64_t head;
+	_Atomic uint64_t mark_head;
+	_Atomic uint64_t ring_full;
+
+	/* Written by whichever writer holds busy */
+	_Alignas(CACHE_LINE) _Atomic bool busy;
+	_Atomic uint64_t tail;
+	_Atomic uint64_t mark_tail;
+	_Atomic uint64_t bytes;
+	_Atomic uint64_t bursts;
+	_Atomic uint64_t latency_total_ns;
+	_Atomic uint64_t latency_max_ns;
+	_Atomic uint64_t write_errors;
+	/* Passed from writer to writer with busy, read once they stop */
+	struct uuart_hist latency;
+
+	/* Filled by the poller up to mark_head, retired by the writer */
+	_Alignas(CACHE_LINE) struct capture_mark marks[CAPTURE_MARKS];
+};
+
+/* The merge thread's state, and its stats for other threads to read */
+struct capture_merge {
+	int fd;
+	struct uuart_merge_config cfg;
+	pthread_t thread;
+	bool running;
+
+	uint64_t start_ns;
+	/* The newest burst written, and the time its record gave it */
+	uint64_t newest_ns;
+	uint64_t last_ns;
+	/* TEXT: whether the output is at the start of a line, and if not whose */
+	bool bol;
+	const struct capture_dev *partial;
+
+	uint8_t buf[MERGE_BUF_SIZE];
+	size_t len;
+
+	_Atomic uint64_t bursts;
+	_Atomic uint64_t bytes;
+	_Atomic uint64_t hold_total_ns;
+	_Atomic uint64_t hold_max_ns;
+	_Atomic uint64_t late;
+	_Atomic uint64_t late_total_ns;
+	_Atomic uint64_t late_max_ns;
+	_Atomic uint64_t write_errors;
+
+	/* When the bursts in buf were drained, timed once they are written */
+	uint64_t pending[MERGE_PENDING];
+	size_t nr_pending;
+	struct uuart_hist latency;
+};
+
+struct uuart_capture {
+	struct uuart_capture_config cfg;
+	struct capture_dev *devs[UUART_CAPTURE_MAX];
+	size_t n;
+
+	pthread_t poller;
+	bool polling;
+	pthread_t *writers;
+	unsigned int nr_writers;
+	struct capture_merge *merge;
+
+	_Atomic bool stop;
+	_Atomic bool draining;
+	_Atomic uint64_t rounds;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define load(p)		atomic_load_explicit(p, memory_order_relaxed)
+#define store(p, v)	atomic_store_explicit(p, v, memory_order_relaxed)
+
+/* The poller's uuart_ops.rx: copy a burst into the ring and mark it */
+static size_t capture_rx(void *priv, const uint8_t *buf, size_t len)
+{
+	struct capture_dev *d = priv;
+	uint64_t head = load(&d->head);
+	uint64_t mark = load(&d->mark_head);
+	size_t off = head & (d->size - 1);
+	size_t space, first;
+
+	space = d->size -
+		(head - atomic_load_explicit(&d->tail, memory_order_acquire));
+
+	/* Every burst needs a mark, so running out of them fills the ring too */
+	if (mark - atomic_load_explicit(&d->mark_tail, memory_order_acquire) ==
+	    CAPTURE_MARKS)
+		space = 0;
+
+	if (len > space) {
+		store(&d->ring_full, load(&d->ring_full) + 1);
+		len = space;
+	}
+
+	if (!len)
+		return 0;
+
+	first = d->size - off;
+	if (first > len)
+		first = len;
+
+	memcpy(&d->buf[off], buf, first);
+	memcpy(d->buf, buf + first, len - first);
+
+	d->marks[mark % CAPTURE_MARKS] = (struct capture_mark) {
+		.end = head + len,
+		.ns = uuart_rx_ns(d->dev),
+	};
+	atomic_store_explicit(&d->mark_head, mark + 1, memory_order_release);
+	atomic_store_explicit(&d->head, head + len, memory_order_release);
+
+	return len;
+}
+
+static const struct uuart_ops capture_ops = {
+	.rx = capture_rx,
+};
+
+static bool timespec_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+	       (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void *poller_thread(void *arg)
+{
+	struct uuart_capture *c = arg;
+	struct timespec next, wake;
+	struct uuart_step step;
+	bool busy;
+	int rc;
+
+	while (!load(&c->stop)) {
+		busy = false;
+
+		for (size_t i = 0; i < c->n; i++) {
+			rc = uuart_step(c->devs[i]->dev, &step, &next);
+			if (rc > 0)
+				busy = true;
+			if (!i || timespec_before(&next, &wake))
+				wake = next;
+		}
+
+		store(&c->rounds, load(&c->rounds) + 1);
+
+		/* Only idle when every device is, until the first needs us */
+		if (!busy)
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake,
+					NULL);
+	}
+
+	return NULL;
+}
+
+static void add_latency(struct capture_dev *d, uint64_t lat)
+{
+	store(&d->bursts, load(&d->bursts) + 1);
+	store(&d->latency_total_ns, load(&d->latency_total_ns) + lat);
+	if (lat > load(&d->latency_max_ns))
+		store(&d->latency_max_ns, lat);
+	uuart_hist_record(&d->latency, lat);
+}
+
+/* Account for the bursts whose last byte is now written */
+static void retire_marks(struct capture_dev *d, uint64_t tail)
+{
+	uint64_t mark = load(&d->mark_tail);
+	uint64_t last = atomic_load_explicit(&d->mark_head,
+					     memory_order_acquire);
+	uint64_t now = now_ns();
+	uint64_t lat;
+
+	for (; mark != last; mark++) {
+		const struct capture_mark *m = &d->marks[mark % CAPTURE_MARKS];
+
+		if (m->end > tail)
+			break;
+
+		lat = now - m->ns;
+		add_latency(d, lat);
+	}
+
+	atomic_store_explicit(&d->mark_tail, mark, memory_order_release);
+}
+
+static void drain(struct capture_dev *d)
+{
+	uint64_t head = atomic_load_explicit(&d->head, memory_order_acquire);
+	struct pollfd pfd = { .fd = d->fd, .events = POLLOUT };
+	uint64_t tail = load(&d->tail);
+	struct iovec iov[2];
+	size_t off, len;
+	ssize_t n;
+
+	while (tail != head) {
+		len = head - tail;
+		off = tail & (d->size - 1);
+		iov[0].iov_base = &d->buf[off];
+		iov[0].iov_len = d->size - off < len ? d->size - off : len;
+		iov[1].iov_base = d->buf;
+		iov[1].iov_len = len - iov[0].iov_len;
+
+		n = writev(d->fd, iov, iov[1].iov_len ? 2 : 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		/*
+		 * Wait for room rather than hand the device straight back to
+		 * be claimed again, but not so long other devices go unserved
+		 */
+		if (n < 0 && errno == EAGAIN) {
+			if (poll(&pfd, 1, WRITER_WAIT_MS) > 0)
+				continue;
+			break;
+		}
+		if (n < 0) {
+			/* Drop the data rather than wedge the device's ring */
+			store(&d->write_errors, load(&d->write_errors) + 1);
+			n = len;
+		} else {
+			store(&d->bytes, load(&d->bytes) + n);
+		}
+
+		tail += n;
+		atomic_store_explicit(&d->tail, tail, memory_order_release);
+		retire_marks(d, tail);
+	}
+}
+
+static size_t pending(const struct capture_dev *d)
+{
+	return atomic_load_explicit(&d->head, memory_order_acquire) -
+	       atomic_load_explicit(&d->tail, memory_order_acquire);
+}
+
+/* Claim the unclaimed device with the most pending bytes */
+static struct capture_dev *claim_busiest(struct uuart_capture *c)
+{
+	struct capture_dev *best;
+	bool idle;
+	size_t most, n;
+
+	do {
+		best = NULL;
+		most = 0;
+
+		for (size_t i = 0; i < c->n; i++) {
+			if (load(&c->devs[i]->busy))
+				continue;
+
+			n = pending(c->devs[i]);
+			if (n > most) {
+				best = c->devs[i];
+				most = n;
+			}
+		}
+
+		if (!best)
+			return NULL;
+
+		idle = false;
+	} while (!atomic_compare_exchange_strong_explicit(&best->busy, &idle,
+							   true,
+							   memory_order_acquire,
+							   memory_order_relaxed));
+
+	return best;
+}
+
+static bool all_empty(const struct uuart_capture *c)
+{
+	for (size_t i = 0; i < c->n; i++) {
+		if (pending(c->devs[i]))
+			return false;
+	}
+
+	return true;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct uuart_capture *c = arg;
+	unsigned long idle_ns = WRITER_IDLE_MIN_NS;
+	struct capture_dev *d;
+	struct timespec ts;
+
+	while (1) {
+		d = claim_busiest(c);
+		if (d) {
+			drain(d);
+			atomic_store_explicit(&d->busy, false,
+					      memory_order_release);
+			idle_ns = WRITER_IDLE_MIN_NS;
+			continue;
+		}
+
+		if (atomic_load_explicit(&c->draining, memory_order_acquire) &&
+		    all_empty(c))
+			return NULL;
+
+		ts.tv_sec = 0;
+		ts.tv_nsec = idle_ns;
+		nanosleep(&ts, NULL);
+		if (idle_ns < WRITER_IDLE_MAX_NS)
+			idle_ns *= 2;
+	}
+}
+
+static void merge_flush(struct capture_merge *m)
+{
+	size_t off = 0;
+	uint64_t now;
+	ssize_t n;
+
+	while (off < m->len) {
+		n = write(m->fd, m->buf + off, m->len - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			store(&m->write_errors, load(&m->write_errors) + 1);
+			break;
+		}
+		off += n;
+	}
+
+	m->len = 0;
+
+	/* Every burst merged so far has had its last byte written */
+	now = now_ns();
+	for (size_t i = 0; i < m->nr_pending; i++)
+		uuart_hist_record(&m->latency, now - m->pending[i]);
+	m->nr_pending = 0;
+}
+
+static void merge_put(struct capture_merge *m, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	size_t n;
+
+	while (len) {
+		if (m->len == MERGE_BUF_SIZE)
+			merge_flush(m);
+
+		n = MERGE_BUF_SIZE - m->len;
+		if (n > len)
+			n = len;
+
+		memcpy(m->buf + m->len, p, n);
+		m->len += n;
+		p += n;
+		len -= n;
+	}
+}
+
+static void put_le(struct capture_merge *m, uint64_t val, size_t bytes)
+{
+	uint8_t le[8];
+
+	for (size_t i = 0; i < bytes; i++)
+		le[i] = val >> (8 * i);
+
+	merge_put(m, le, bytes);
+}
+
+static void merge_header(struct uuart_capture *c, struct capture_merge *m)
+{
+	struct timespec ts;
+	size_t len;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	merge_put(m, MERGE_MAGIC, strlen(MERGE_MAGIC));
+	put_le(m, (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec, 8);
+	put_le(m, c->n, 1);
+
+	for (size_t i = 0; i < c->n; i++) {
+		len = strlen(c->devs[i]->name);
+		if (len > UINT8_MAX)
+			len = UINT8_MAX;
+		put_le(m, len, 1);
+		merge_put(m, c->devs[i]->name, len);
+	}
+}
+
+/* Copy out part of a line, starting it with the device's name if need be */
+static void merge_text(struct capture_merge *m, const struct capture_dev *d,
+		       const uint8_t *p, size_t len)
+{
+	const uint8_t *nl;
+	size_t n;
+
+	while (len) {
+		if (m->bol) {
+			merge_put(m, d->name, strlen(d->name));
+			merge_put(m, ": ", 2);
+			m->bol = false;
+		}
+
+		nl = memchr(p, '\n', len);
+		n = nl ? (size_t)(nl - p) + 1 : len;
+		merge_put(m, p, n);
+		m->bol = nl;
+		p += n;
+		len -= n;
+	}
+}
+
+/*
+ * Write the ring's bytes from @pos, in records of at most UINT16_MAX, the
+ * first @delta_us after the one before or, if that's MERGE_ABS_US, @at_us
+ * after the start
+ */
+static void merge_data(struct capture_merge *m, const struct capture_dev *d,
+		       uint64_t pos, size_t len, uint64_t delta_us,
+		       uint64_t at_us)
+{
+	size_t off, seg, rec = 0;
+
+	while (len) {
+		if (m->cfg.format == UUART_MERGE_BINARY && !rec) {
+			rec = len < UINT16_MAX ? len : UINT16_MAX;
+			put_le(m, d->index, 1);
+			put_le(m, rec, 2);
+			put_le(m, delta_us, 4);
+			if (delta_us == MERGE_ABS_US)
+				put_le(m, at_us, 8);
+			delta_us = 0;
+		}
+
+		off = pos & (d->size - 1);
+		seg = d->size - off < len ? d->size - off : len;
+		if (rec && seg > rec)
+			seg = rec;
+
+		if (m->cfg.format == UUART_MERGE_BINARY) {
+			merge_put(m, &d->buf[off], seg);
+			rec -= seg;
+		} else {
+			merge_text(m, d, &d->buf[off], seg);
+		}
+
+		pos += seg;
+		len -= seg;
+	}
+}
+
+static void merge_burst(struct capture_merge *m, struct capture_dev *d)
+{
+	uint64_t mark = load(&d->mark_tail);
+	const struct capture_mark *b = &d->marks[mark % CAPTURE_MARKS];
+	uint64_t tail = load(&d->tail);
+	uint64_t now = now_ns();
+	uint64_t hold = now - b->ns;
+	uint64_t delta_us = 0;
+	uint64_t at_us = 0;
+	uint64_t late;
+
+	store(&m->bursts, load(&m->bursts) + 1);
+	store(&m->bytes, load(&m->bytes) + (b->end - tail));
+	store(&m->hold_total_ns, load(&m->hold_total_ns) + hold);
+	if (hold > load(&m->hold_max_ns))
+		store(&m->hold_max_ns, hold);
+
+	/*
+	 * Late bursts go out with the time of the record before them. Others
+	 * move the time on by whole microseconds, keeping the remainder for
+	 * the next, and by the time since the start if that doesn't fit.
+	 */
+	if (b->ns < m->newest_ns) {
+		late = m->newest_ns - b->ns;
+		store(&m->late, load(&m->late) + 1);
+		store(&m->late_total_ns, load(&m->late_total_ns) + late);
+		if (late > load(&m->late_max_ns))
+			store(&m->late_max_ns, late);
+	} else {
+		m->newest_ns = b->ns;
+		delta_us = (b->ns - m->last_ns) / 1000;
+		if (delta_us >= MERGE_ABS_US) {
+			at_us = (b->ns - m->start_ns) / 1000;
+			m->last_ns = m->start_ns + at_us * 1000;
+			delta_us = MERGE_ABS_US;
+		} else {
+			m->last_ns += delta_us * 1000;
+		}
+	}
+
+	if (m->cfg.format == UUART_MERGE_TEXT && m->partial &&
+	    m->partial != d) {
+		merge_put(m, "\n", 1);
+		m->bol = true;
+	}
+
+	merge_data(m, d, tail, b->end - tail, delta_us, at_us);
+	m->partial = m->bol ? NULL : d;
+
+	m->pending[m->nr_pending++] = b->ns;
+	if (m->nr_pending == MERGE_PENDING)
+		merge_flush(m);
+
+	store(&d->bytes, load(&d->bytes) + (b->end - tail));
+	add_latency(d, hold);
+
+	atomic_store_explicit(&d->tail, b->end, memory_order_release);
+	atomic_store_explicit(&d->mark_tail, mark + 1, memory_order_release);
+}
+
+/*
+ * The device whose next burst is the oldest, if any has one, with @all set if
+ * every device has one. Each device's bursts are in order, so the oldest
+ * burst is safe to write once every device has a later one pending.
+ */
+static struct capture_dev *oldest_burst(struct uuart_capture *c,
+					uint64_t *ns, bool *all)
+{
+	struct capture_dev *best = NULL;
+	const struct capture_mark *b;
+	uint64_t mark;
+
+	*all = true;
+
+	for (size_t i = 0; i < c->n; i++) {
+		struct capture_dev *d = c->devs[i];
+
+		mark = load(&d->mark_tail);
+		if (mark == atomic_load_explicit(&d->mark_head,
+						 memory_order_acquire)) {
+			*all = false;
+			continue;
+		}
+
+		b = &d->marks[mark % CAPTURE_MARKS];
+		if (!best || b->ns < *ns) {
+			best = d;
+			*ns = b->ns;
+		}
+	}
+
+	return best;
+}
+
+static void *merge_thread(void *arg)
+{
+	struct uuart_capture *c = arg;
+	struct capture_merge *m = c->merge;
+	unsigned long idle_ns = WRITER_IDLE_MIN_NS;
+	struct capture_dev *d;
+	struct timespec ts;
+	bool draining, all;
+	uint64_t ns, now;
+
+	if (m->cfg.format == UUART_MERGE_BINARY)
+		merge_header(c, m);
+
+	while (1) {
+		draining = atomic_load_explicit(&c->draining,
+						memory_order_acquire);
+		d = oldest_burst(c, &ns, &all);
+		now = now_ns();
+
+		if (d && (all || draining || now - ns >= m->cfg.delay_ns)) {
+			merge_burst(m, d);
+			idle_ns = WRITER_IDLE_MIN_NS;
+			continue;
+		}
+
+		/* Nothing is due, so write out what is */
+		merge_flush(m);
+
+		if (!d && draining)
+			return NULL;
+
+		/* Wait no longer than the oldest burst has left to wait */
+		if (d && ns + m->cfg.delay_ns - now < idle_ns)
+			idle_ns = ns + m->cfg.delay_ns - now;
+
+		ts.tv_sec = 0;
+		ts.tv_nsec = idle_ns;
+		nanosleep(&ts, NULL);
+		if (idle_ns < WRITER_IDLE_MAX_NS)
+			idle_ns *= 2;
+	}
+}
+
+int uuart_capture_new(struct uuart_capture **cp,
+		      const struct uuart_capture_config *cfg)
+{
+	struct uuart_capture *c;
+
+	if (cfg->ring_size & (cfg->ring_size - 1))
+		return -EINVAL;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -errno;
+
+	c->cfg = *cfg;
+	if (!c->cfg.writers)
+		c->cfg.writers = 1;
+	if (!c->cfg.ring_size)
+		c->cfg.ring_size = CAPTURE_RING_SIZE;
+
+	atomic_init(&c->stop, false);
+	atomic_init(&c->draining, false);
+	atomic_init(&c->rounds, 0);
+
+	*cp = c;
+
+	return 0;
+}
+
+int uuart_capture_add(struct uuart_capture *c, struct uuart *dev, int fd,
+		      const char *name)
+{
+	struct capture_dev *d;
+
+	if (c->polling)
+		return -EBUSY;
+
+	if (c->n == UUART_CAPTURE_MAX)
+		return -ENOSPC;
+
+	d = aligned_alloc(CACHE_LINE, sizeof(*d));
+	if (!d)
+		return -ENOMEM;
+
+	memset(d, 0, sizeof(*d));
+	d->buf = malloc(c->cfg.ring_size);
+	d->name = strdup(name);
+	if (!d->buf || !d->name) {
+		free(d->name);
+		free(d->buf);
+		free(d);
+		return -ENOMEM;
+	}
+
+	d->dev = dev;
+	d->index = c->n;
+	d->fd = fd;
+	d->size = c->cfg.ring_size;
+	uuart_hist_init(&d->latency);
+	uuart_set_ops(dev, &capture_ops, d);
+
+	c->devs[c->n++] = d;
+
+	return 0;
+}
+
+int uuart_capture_merge(struct uuart_capture *c, int fd,
+			const struct uuart_merge_config *cfg)
+{
+	struct capture_merge *m;
+
+	if (c->polling || c->merge)
+		return -EBUSY;
+
+	if (cfg->format != UUART_MERGE_TEXT &&
+	    cfg->format != UUART_MERGE_BINARY)
+		return -EINVAL;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return -errno;
+
+	m->fd = fd;
+	m->cfg = *cfg;
+	if (!m->cfg.delay_ns)
+		m->cfg.delay_ns = MERGE_DELAY_NS;
+	m->bol = true;
+	uuart_hist_init(&m->latency);
+
+	c->merge = m;
+
+	return 0;
+}
+
+int uuart_capture_start(struct uuart_capture *c)
+{
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int rc;
+
+	if (!c->n || c->polling)
+		return -EINVAL;
+
+	rc = pthread_attr_init(&attr);
+	if (rc)
+		return -rc;
+
+	c->writers = calloc(c->cfg.writers, sizeof(*c->writers));
+	if (!c->writers) {
+		rc = ENOMEM;
+		goto out;
+	}
+
+	if (c->cfg.pin) {
+		CPU_ZERO(&cpus);
+		CPU_SET(c->cfg.cpu, &cpus);
+		rc = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		if (rc)
+			goto out;
+	}
+
+	if (c->merge) {
+		c->merge->start_ns = now_ns();
+		c->merge->newest_ns = c->merge->start_ns;
+		c->merge->last_ns = c->merge->start_ns;
+		rc = pthread_create(&c->merge->thread, NULL, merge_thread, c);
+		if (rc)
+			goto out;
+		c->merge->running = true;
+	}
+
+	rc = pthread_create(&c->poller, &attr, poller_thread, c);
+	if (rc) {
+		uuart_capture_stop(c);
+		goto out;
+	}
+	c->polling = true;
+
+	/* The merge thread is the rings' only consumer */
+	if (c->merge)
+		goto out;
+
+	for (; c->nr_writers < c->cfg.writers; c->nr_writers++) {
+		rc = pthread_create(&c->writers[c->nr_writers], NULL,
+				    writer_thread, c);
+		if (rc) {
+			uuart_capture_stop(c);
+			break;
+		}
+	}
+
+out:
+	pthread_attr_destroy(&attr);
+	if (rc) {
+		free(c->writers);
+		c->writers = NULL;
+	}
+
+	return -rc;
+}
+
+void uuart_capture_stop(struct uuart_capture *c)
+{
+	if (c->polling) {
+		atomic_store_explicit(&c->stop, true, memory_order_relaxed);
+		pthread_join(c->poller, NULL);
+		c->polling = false;
+	}
+
+	atomic_store_explicit(&c->draining, true, memory_order_release);
+	for (; c->nr_writers; c->nr_writers--)
+		pthread_join(c->writers[c->nr_writers - 1], NULL);
+
+	if (c->merge && c->merge->running) {
+		pthread_join(c->merge->thread, NULL);
+		c->merge->running = false;
+	}
+}
+
+void uuart_capture_free(struct uuart_capture *c)
+{
+	uuart_capture_stop(c);
+
+	for (size_t i = 0; i < c->n; i++) {
+		uuart_set_ops(c->devs[i]->dev, NULL, NULL);
+		free(c->devs[i]->name);
+		free(c->devs[i]->buf);
+		free(c->devs[i]);
+	}
+
+	free(c->merge);
+	free(c->writers);
+	free(c);
+}
+
+uint64_t uuart_capture_rounds(const struct uuart_capture *c)
+{
+	return load(&c->rounds);
+}
+
+size_t uuart_capture_count(const struct uuart_capture *c)
+{
+	return c->n;
+}
+
+const char *uuart_capture_name(const struct uuart_capture *c, size_t i)
+{
+	return c->devs[i]->name;
+}
+
+void uuart_capture_stats(const struct uuart_capture *c, size_t i,
+			 struct uuart_capture_stats *stats)
+{
+	const struct capture_dev *d = c->devs[i];
+
+	stats->bytes = load(&d->bytes);
+	stats->bursts = load(&d->bursts);
+	stats->ring_full = load(&d->ring_full);
+	stats->latency_total_ns = load(&d->latency_total_ns);
+	stats->latency_max_ns = load(&d->latency_max_ns);
+	stats->write_errors = load(&d->write_errors);
+}
+
+void uuart_capture_latency(const struct uuart_capture *c, ssize_t i,
+			   struct uuart_hist *hist)
+{
+	if (i >= 0)
+		*hist = c->devs[i]->latency;
+	else if (c->merge)
+		*hist = c->merge->latency;
+	else
+		uuart_hist_init(hist);
+}
+
+void uuart_capture_merge_stats(const struct uuart_capture *c,
+			       struct uuart_merge_stats *stats)
+{
+	const struct capture_merge *m = c->merge;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!m)
+		return;
+
+	stats->bursts = load(&m->bursts);
+	stats->bytes = load(&m->bytes);
+	stats->hold_total_ns = load(&m->hold_total_ns);
+	stats->hold_max_ns = load(&m->hold_max_ns);
+	stats->late = load(&m->late);
+	stats->late_total_ns = load(&m->late_total_ns);
+	stats->late_max_ns = load(&m->late_max_ns);
+	stats->write_errors = load(&m->write_errors);
+}
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_CAPTURE_H
+#define UUART_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "hist.h"
+#include "uuart.h"
+
+/*
+ * Capture the Rx data of several devices in one process. A single poller
+ * thread, optionally pinned to a CPU, steps every device and copies what it
+ * drains into the device's ring, which a pool of writer threads empties into
+ * the device's fd. Each ring has one producer, the poller, and one consumer
+ * at a time, whichever writer claimed the device, so neither side locks. A
+ * full ring leaves the data in the FIFO rather than stall the poller.
+ *
+ * The caller opens, claims and initialises the devices, which should have Tx
+ * disabled, and restores and closes them after uuart_capture_free().
+ *
+ * Alternatively uuart_capture_merge() sends every device's bursts to one fd
+ * in timestamp order, from a merge thread that replaces the writers.
+ */
+
+#define UUART_CAPTURE_MAX	16
+
+struct uuart_capture;
+
+struct uuart_capture_config {
+	/* Writer threads, zero selecting one */
+	unsigned int writers;
+	/* Pin the poller to CPU @cpu */
+	bool pin;
+	unsigned int cpu;
+	/* Per-device ring size in bytes, a power of two, zero for the default */
+	size_t ring_size;
+};
+
+struct uuart_capture_stats {
+	uint64_t bytes;
+	uint64_t bursts;
+	/* Steps that found the ring full and left data in the device */
+	uint64_t ring_full;
+	/* Time from the poller draining a burst to its last byte's write() */
+	uint64_t latency_total_ns;
+	uint64_t latency_max_ns;
+	uint64_t write_errors;
+};
+
+/*
+ * Merged output formats. TEXT starts each line with the name of the device it
+ * came from and ": ", breaking a partial line where another device's output
+ * interrupts it. BINARY starts with a header:
+ *
+ *	"UUMERGE2", the CLOCK_REALTIME ns at start as a little-endian u64,
+ *	a u8 device count, then per device a u8 length and its name
+ *
+ * followed by a record per burst: a u8 device index, a little-endian u16
+ * length, a little-endian u32 of microseconds since the previous record
+ * (since the start for the first), then the data. Where the gap doesn't fit,
+ * the u32 is 0xffffffff and a little-endian u64 of microseconds since the
+ * start follows it. The part of a microsecond a delta leaves out is carried
+ * into the next, so the times add up to within a microsecond of each burst's.
+ */
+enum uuart_merge_format {
+	UUART_MERGE_TEXT,
+	UUART_MERGE_BINARY,
+};
+
+struct uuart_merge_config {
+	enum uuart_merge_format format;
+	/*
+	 * How long a burst is held for earlier bursts from devices with
+	 * nothing pending, zero selecting the default. Bursts arriving later
+	 * than that go out late, and are counted.
+	 */
+	unsigned long delay_ns;
+};
+
+struct uuart_merge_stats {
+	uint64_t bursts;
+	uint64_t bytes;
+	/* Time from draining a burst to its merge into the output */
+	uint64_t hold_total_ns;
+	uint64_t hold_max_ns;
+	/* Bursts older than one already written, and by how much */
+	uint64_t late;
+	uint64_t late_total_ns;
+	uint64_t late_max_ns;
+	uint64_t write_errors;
+};
+
+int uuart_capture_new(struct uuart_capture **cp,
+		      const struct uuart_capture_config *cfg);
+
+/*
+ * Capture @dev into @fd, under @name in reports and merged output. Only
+ * before uuart_capture_start(), and up to UUART_CAPTURE_MAX devices. @fd is
+ * unused when merging.
+ */
+int uuart_capture_add(struct uuart_capture *c, struct uuart *dev, int fd,
+		      const char *name);
+
+/* Merge all devices into @fd instead, set up before uuart_capture_start() */
+int uuart_capture_merge(struct uuart_capture *c, int fd,
+			const struct uuart_merge_config *cfg);
+
+int uuart_capture_start(struct uuart_capture *c);
+
+/*
+ * Stop polling, then wait for the writers to empty the rings. Safe to call
+ * more than once.
+ */
+void uuart_capture_stop(struct uuart_capture *c);
+
+/* Stops the capture if need be, leaving the devices and fds to the caller */
+void uuart_capture_free(struct uuart_capture *c);
+
+/* Full passes the poller has made over the devices */
+uint64_t uuart_capture_rounds(const struct uuart_capture *c);
+
+size_t uuart_capture_count(const struct uuart_capture *c);
+const char *uuart_capture_name(const struct uuart_capture *c, size_t i);
+void uuart_capture_stats(const struct uuart_capture *c, size_t i,
+			 struct uuart_capture_stats *stats);
+void uuart_capture_merge_stats(const struct uuart_capture *c,
+			       struct uuart_merge_stats *stats);
+
+/*
+ * The distribution of latency_*_ns for device @i, or with @i negative of the
+ * time from draining a burst to the write() of its last byte to the merged
+ * output. Only once the capture has stopped.
+ */
+void uuart_capture_latency(const struct uuart_capture *c, ssize_t i,
+			   struct uuart_hist *hist);
+
+#endif
@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32.h"
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+
+/* ARMv8 CRC32{B,W} implement the IEEE polynomial directly */
+uint32_t uuart_crc32(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint32_t word;
+
+	crc = ~crc;
+
+	while (len && ((uintptr_t)p & 3)) {
+		crc = __crc32b(crc, *p++);
+		len--;
+	}
+
+	while (len >= 4) {
+		memcpy(&word, p, sizeof(word));
+		crc = __crc32w(crc, word);
+		p += 4;
+		len -= 4;
+	}
+
+	while (len--)
+		crc = __crc32b(crc, *p++);
+
+	return ~crc;
+}
+#else
+#include <pthread.h>
+
+static uint32_t crc32_table[4][256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void)
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (int j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+
+		crc32_table[0][i] = crc;
+	}
+
+	for (uint32_t i = 0; i < 256; i++) {
+		for (int t = 1; t < 4; t++) {
+			uint32_t prev = crc32_table[t - 1][i];
+
+			crc32_table[t][i] = (prev >> 8) ^ crc32_table[0][prev & 0xff];
+		}
+	}
+}
+
+/* Slicing-by-4, consuming a little-endian word per iteration */
+uint32_t uuart_crc32(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	pthread_once(&crc32_once, crc32_init);
+
+	crc = ~crc;
+
+	while (len >= 4) {
+		crc ^= p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+		crc = crc32_table[3][crc & 0xff] ^
+		      crc32_table[2][(crc >> 8) & 0xff] ^
+		      crc32_table[1][(crc >> 16) & 0xff] ^
+		      crc32_table[0][crc >> 24];
+		p += 4;
+		len -= 4;
+	}
+
+	while (len--)
+		crc = (crc >> 8) ^ crc32_table[0][(crc ^ *p++) & 0xff];
+
+	return ~crc;
+}
+#endif
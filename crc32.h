@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_CRC32_H
+#define UUART_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32 (IEEE 802.3, reflected). Start with zero and feed the previous
+ * result back in to checksum discontiguous buffers.
+ */
+uint32_t uuart_crc32(uint32_t crc, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,538 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ctlsock.h"
+
+#define CTL_LINE		256
+#define CTL_REPLY		4096
+/* How long a client waits for the poll loop to pick up a request */
+#define CTL_TIMEOUT_NS		1000000000ULL
+#define CTL_WAIT_NS		100000L
+
+/* The settings that can change under a running poll loop */
+static const char *const live_keys[] = {
+	"no-rx",
+	"no-tx",
+	"batch-barriers",
+	"poll-min-ns",
+	"poll-max-ns",
+	"cork",
+	"cork-ns",
+	"flow-control",
+	"tx-rate",
+	"tx-burst",
+	"fifo-auto",
+	"rx-trigger",
+	"host-trigger",
+	"rx-timeout",
+	"flush-min",
+	"quiet",
+};
+
+#define NR_LIVE_KEYS (sizeof(live_keys) / sizeof(live_keys[0]))
+
+struct ctlsock {
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int listen_fd;
+	int client_fd;
+	pthread_t thread;
+	ctlsock_fn fn;
+	void *priv;
+	struct uuart_scrollback *sb;
+
+	/* The control thread's settings, as last accepted by the loop */
+	struct profile want;
+	/* A set timed out, and pub holds what the loop will apply */
+	bool pending;
+
+	/*
+	 * The settings offered to the loop, under a seqlock: the control thread
+	 * makes seq odd while it writes them, and the loop copies them out
+	 * again if seq was odd or moved while it read.
+	 */
+	_Atomic unsigned int seq;
+	struct profile pub;
+
+	/*
+	 * The mailbox. The control thread fills in op and bumps req, and the
+	 * loop answers by filling in rc and the reply and setting done to
+	 * match, so each side owns the rest in turn without a lock.
+	 */
+	_Atomic unsigned int req;
+	_Atomic unsigned int done;
+	enum ctl_op op;
+	int rc;
+	char reply[CTL_REPLY];
+	size_t reply_len;
+};
+
+static int listen_unix(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+	int rc;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd, 1)) {
+		rc = -errno;
+		close(fd);
+		return rc;
+	}
+
+	return fd;
+}
+
+static void publish(struct ctlsock *cs, const struct profile *p)
+{
+	unsigned int seq = atomic_load_explicit(&cs->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&cs->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	cs->pub = *p;
+	atomic_store_explicit(&cs->seq, seq + 2, memory_order_release);
+}
+
+static void read_published(struct ctlsock *cs, struct profile *p)
+{
+	unsigned int seq;
+
+	do {
+		seq = atomic_load_explicit(&cs->seq, memory_order_acquire);
+		*p = cs->pub;
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) ||
+		 seq != atomic_load_explicit(&cs->seq, memory_order_relaxed));
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Wait for the loop to answer the last request, returning false on timeout */
+static bool wait_done(struct ctlsock *cs)
+{
+	static const struct timespec backoff = { .tv_nsec = CTL_WAIT_NS };
+	unsigned int req = atomic_load_explicit(&cs->req, memory_order_relaxed);
+	uint64_t start = now_ns();
+
+	while (atomic_load_explicit(&cs->done, memory_order_acquire) != req) {
+		if (now_ns() - start >= CTL_TIMEOUT_NS)
+			return false;
+		nanosleep(&backoff, NULL);
+	}
+
+	return true;
+}
+
+/*
+ * Once the loop has answered a set that timed out, take what it applied as
+ * the settings in force. Returns false while the mailbox is still busy.
+ */
+static bool settle(struct ctlsock *cs)
+{
+	unsigned int req = atomic_load_explicit(&cs->req, memory_order_relaxed);
+
+	if (atomic_load_explicit(&cs->done, memory_order_acquire) != req)
+		return false;
+
+	if (cs->pending && !cs->rc)
+		cs->want = cs->pub;
+	cs->pending = false;
+
+	return true;
+}
+
+static int request(struct ctlsock *cs, enum ctl_op op)
+{
+	unsigned int req;
+
+	/* A request the loop hasn't answered yet still owns the mailbox */
+	if (!wait_done(cs))
+		return -EBUSY;
+	settle(cs);
+
+	cs->op = op;
+	req = atomic_load_explicit(&cs->req, memory_order_relaxed);
+	atomic_store_explicit(&cs->req, req + 1, memory_order_release);
+
+	if (!wait_done(cs))
+		return -ETIMEDOUT;
+
+	return cs->rc;
+}
+
+void ctlsock_service(struct ctlsock *cs)
+{
+	unsigned int req = atomic_load_explicit(&cs->req, memory_order_acquire);
+	struct profile p;
+	FILE *reply;
+	long len;
+
+	if (req == atomic_load_explicit(&cs->done, memory_order_relaxed))
+		return;
+
+	if (cs->op == CTL_SET)
+		read_published(cs, &p);
+
+	cs->reply_len = 0;
+	reply = fmemopen(cs->reply, sizeof(cs->reply), "w");
+	if (!reply) {
+		cs->rc = -errno;
+	} else {
+		cs->rc = cs->fn(cs->priv, cs->op,
+				cs->op == CTL_SET ? &p : NULL, reply);
+		len = ftell(reply);
+		fclose(reply);
+		if (len > 0)
+			cs->reply_len = len < CTL_REPLY ? len : CTL_REPLY - 1;
+	}
+
+	atomic_store_explicit(&cs->done, req, memory_order_release);
+}
+
+static void send_all(struct ctlsock *cs, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = send(cs->client_fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
+	}
+}
+
+static void __attribute__((format(printf, 2, 3)))
+say(struct ctlsock *cs, const char *fmt, ...)
+{
+	char buf[CTL_LINE];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+	if ((size_t)len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+
+	send_all(cs, buf, len);
+}
+
+static void say_result(struct ctlsock *cs, int rc)
+{
+	if (rc < 0)
+		say(cs, "error: %s\n", strerror(-rc));
+	else
+		say(cs, "ok\n");
+}
+
+static bool live_key(const char *key)
+{
+	for (size_t i = 0; i < NR_LIVE_KEYS; i++) {
+		if (!strcmp(live_keys[i], key))
+			return true;
+	}
+
+	return false;
+}
+
+static void cmd_set(struct ctlsock *cs, char *args)
+{
+	char why[CTL_LINE];
+	char *key, *val;
+	struct profile p;
+	int rc;
+
+	/* publish() would overwrite a set the loop hasn't picked up yet */
+	if (!wait_done(cs)) {
+		say_result(cs, -EBUSY);
+		return;
+	}
+	settle(cs);
+	p = cs->want;
+
+	key = strtok_r(args, " \t", &val);
+	if (!key || !val || !*val) {
+		say(cs, "error: usage: set KEY VALUE\n");
+		return;
+	}
+
+	while (*val == ' ' || *val == '\t')
+		val++;
+
+	if (!live_key(key)) {
+		say(cs, "error: %s can't change while running\n", key);
+		return;
+	}
+
+	rc = profile_set(&p, key, val);
+	if (rc < 0) {
+		say(cs, "error: bad value for %s: %s\n", key, val);
+		return;
+	}
+
+	if (profile_check(&p, why, sizeof(why)) < 0) {
+		say(cs, "error: %s\n", why);
+		return;
+	}
+
+	publish(cs, &p);
+	rc = request(cs, CTL_SET);
+	if (!rc)
+		cs->want = p;
+
+	/* The loop still applies it when it gets to the mailbox */
+	if (rc == -ETIMEDOUT) {
+		cs->pending = true;
+		say(cs, "error: pending, the loop hasn't applied it yet\n");
+		return;
+	}
+
+	say_result(cs, rc);
+}
+
+static void cmd_show(struct ctlsock *cs)
+{
+	char val[CTL_LINE];
+
+	settle(cs);
+
+	for (size_t i = 0; i < NR_LIVE_KEYS; i++) {
+		profile_get(&cs->want, live_keys[i], val, sizeof(val));
+		say(cs, "%s = %s\n", live_keys[i], val);
+	}
+
+	say_result(cs, 0);
+}
+
+static void cmd_query(struct ctlsock *cs, enum ctl_op op)
+{
+	int rc = request(cs, op);
+
+	if (!rc)
+		send_all(cs, cs->reply, cs->reply_len);
+
+	say_result(cs, rc);
+}
+
+static void cmd_scrollback(struct ctlsock *cs,
+			   enum uuart_scrollback_query query, const char *args)
+{
+	uint64_t arg;
+	uint8_t *buf;
+	double secs;
+	size_t len;
+	char *end;
+
+	if (!cs->sb) {
+		say(cs, "error: no scrollback\n");
+		return;
+	}
+
+	while (*args == ' ' || *args == '\t')
+		args++;
+
+	if (query == UUART_SCROLLBACK_SINCE) {
+		secs = strtod(args, &end);
+		arg = secs * 1e9;
+	} else {
+		arg = strtoull(args, &end, 0);
+	}
+
+	if (end == args || *end || (query == UUART_SCROLLBACK_SINCE &&
+				    secs < 0)) {
+		say(cs, "error: bad argument: %s\n", args);
+		return;
+	}
+
+	buf = malloc(uuart_scrollback_size(cs->sb));
+	if (!buf) {
+		say_result(cs, -ENOMEM);
+		return;
+	}
+
+	len = uuart_scrollback_read(cs->sb, query, arg, buf,
+				    uuart_scrollback_size(cs->sb));
+	send_all(cs, (char *)buf, len);
+	if (len && buf[len - 1] != '\n')
+		send_all(cs, "\n", 1);
+	free(buf);
+
+	say_result(cs, 0);
+}
+
+static void command(struct ctlsock *cs, char *line)
+{
+	char *cmd, *args;
+
+	cmd = strtok_r(line, " \t", &args);
+	if (!cmd)
+		return;
+
+	if (!strcmp(cmd, "set"))
+		cmd_set(cs, args);
+	else if (!strcmp(cmd, "show"))
+		cmd_show(cs);
+	else if (!strcmp(cmd, "stats"))
+		cmd_query(cs, CTL_STATS);
+	else if (!strcmp(cmd, "regs"))
+		cmd_query(cs, CTL_REGS);
+	else if (!strcmp(cmd, "tail"))
+		cmd_scrollback(cs, UUART_SCROLLBACK_BYTES, args);
+	else if (!strcmp(cmd, "lines"))
+		cmd_scrollback(cs, UUART_SCROLLBACK_LINES, args);
+	else if (!strcmp(cmd, "since"))
+		cmd_scrollback(cs, UUART_SCROLLBACK_SINCE, args);
+	else
+		say(cs, "error: unknown command %s\n", cmd);
+}
+
+/* Run the commands from one client until it hangs up */
+static void serve_client(struct ctlsock *cs)
+{
+	char line[CTL_LINE];
+	size_t len = 0;
+	bool overlong = false;
+	ssize_t n;
+	char *nl;
+
+	while ((n = read(cs->client_fd, line + len, sizeof(line) - 1 - len)) > 0) {
+		len += n;
+		line[len] = '\0';
+
+		while ((nl = strchr(line, '\n'))) {
+			*nl = '\0';
+			if (nl > line && nl[-1] == '\r')
+				nl[-1] = '\0';
+
+			if (overlong)
+				say(cs, "error: line too long\n");
+			else
+				command(cs, line);
+			overlong = false;
+
+			len -= nl + 1 - line;
+			memmove(line, nl + 1, len + 1);
+		}
+
+		/* Discard the rest of a line that doesn't fit */
+		if (len == sizeof(line) - 1) {
+			overlong = true;
+			len = 0;
+		}
+	}
+}
+
+static void *ctl_thread(void *arg)
+{
+	struct ctlsock *cs = arg;
+	int fd;
+
+	while (1) {
+		fd = accept4(cs->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return NULL;
+		}
+
+		cs->client_fd = fd;
+		serve_client(cs);
+		cs->client_fd = -1;
+		close(fd);
+	}
+}
+
+int ctlsock_open(struct ctlsock **csp, const char *path,
+		 const struct profile *p, struct uuart_scrollback *sb,
+		 ctlsock_fn fn, void *priv)
+{
+	struct ctlsock *cs;
+	int rc;
+
+	if (strlen(path) >= sizeof(cs->path))
+		return -ENAMETOOLONG;
+
+	cs = calloc(1, sizeof(*cs));
+	if (!cs)
+		return -errno;
+
+	strcpy(cs->path, path);
+	cs->client_fd = -1;
+	cs->fn = fn;
+	cs->priv = priv;
+	cs->sb = sb;
+	cs->want = *p;
+	atomic_init(&cs->seq, 0);
+	atomic_init(&cs->req, 0);
+	atomic_init(&cs->done, 0);
+
+	cs->listen_fd = listen_unix(path);
+	if (cs->listen_fd < 0) {
+		rc = cs->listen_fd;
+		free(cs);
+		return rc;
+	}
+
+	rc = pthread_create(&cs->thread, NULL, ctl_thread, cs);
+	if (rc) {
+		close(cs->listen_fd);
+		unlink(cs->path);
+		free(cs);
+		return -rc;
+	}
+
+	*csp = cs;
+
+	return 0;
+}
+
+void ctlsock_close(struct ctlsock *cs)
+{
+	/* The thread only blocks in cancellation points */
+	pthread_cancel(cs->thread);
+	pthread_join(cs->thread, NULL);
+
+	if (cs->client_fd >= 0)
+		close(cs->client_fd);
+	close(cs->listen_fd);
+	unlink(cs->path);
+	free(cs);
+}
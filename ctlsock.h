@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef CTLSOCK_H
+#define CTLSOCK_H
+
+#include <stdio.h>
+
+#include "profile.h"
+#include "scrollback.h"
+
+struct ctlsock;
+
+/*
+ * A control socket for changing settings without a restart. Clients connect
+ * to an AF_UNIX stream socket and send one command per line:
+ *
+ *	set KEY VALUE	change a setting, KEY being a profile key
+ *	show		list the settings that can change and their values
+ *	stats		report the counters
+ *	regs		report a register snapshot
+ *	tail BYTES	print the last BYTES bytes of the scrollback
+ *	lines N		print the last N lines of the scrollback
+ *	since TIME	print the scrollback's lines begun since TIME, in
+ *			seconds since the epoch
+ *
+ * and each reply ends with a line reading "ok" or "error: REASON", the
+ * scrollback commands ending their output with a newline first if it lacks
+ * one. A set the loop doesn't take up in time ends "error: pending", still
+ * takes effect when the loop catches up, and shows up in show once it has.
+ *
+ * Commands are read and checked on a thread of the socket's own, and only
+ * those that need the device wait for the poll loop, which picks them up
+ * between steps in ctlsock_service(). The scrollback is read from the socket's
+ * thread directly.
+ */
+
+enum ctl_op {
+	CTL_SET,
+	CTL_STATS,
+	CTL_REGS,
+};
+
+/*
+ * Called from ctlsock_service(). For CTL_SET @p holds the settings to apply,
+ * and is NULL otherwise. Returns zero or a negative errno for the client.
+ */
+typedef int (*ctlsock_fn)(void *priv, enum ctl_op op, const struct profile *p,
+			  FILE *reply);
+
+/*
+ * Listen at @path, with @p the settings the poll loop starts with, serving
+ * queries of the console's scrollback @sb if not NULL
+ */
+int ctlsock_open(struct ctlsock **csp, const char *path,
+		 const struct profile *p, struct uuart_scrollback *sb,
+		 ctlsock_fn fn, void *priv);
+void ctlsock_close(struct ctlsock *cs);
+
+/* Run the pending request, if there is one, without blocking */
+void ctlsock_service(struct ctlsock *cs);
+
+#endif
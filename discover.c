@@ -0,0 +1,439 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "discover.h"
+
+/* Deep enough for /ahb/apb/serial and then some */
+#define DT_MAX_DEPTH		6
+
+static const char *const vuart_compatible[] = {
+	"aspeed,ast2400-vuart",
+	"aspeed,ast2500-vuart",
+	"aspeed,ast2600-vuart",
+};
+
+#define NR_VUART_COMPATIBLE \
+	(sizeof(vuart_compatible) / sizeof(vuart_compatible[0]))
+
+/* VUARTN lives at vuart_bases[N - 1] */
+static const unsigned long vuart_bases[] = {
+	UUART_D_VUART1,
+	UUART_D_VUART2,
+};
+
+#define NR_VUART_BASES (sizeof(vuart_bases) / sizeof(vuart_bases[0]))
+
+struct scan {
+	const char *root;
+	struct uuart_found found[UUART_DISCOVER_MAX];
+	size_t n;
+};
+
+/* Read up to @len bytes of the file @path, returning the count or an errno */
+static ssize_t read_file(const char *path, void *buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	n = read(fd, buf, len);
+	close(fd);
+
+	return n < 0 ? -errno : n;
+}
+
+/* A text attribute, without its trailing newline */
+static int read_text(const char *path, char *buf, size_t len)
+{
+	ssize_t n = read_file(path, buf, len - 1);
+
+	if (n < 0)
+		return n;
+
+	while (n && buf[n - 1] == '\n')
+		n--;
+	buf[n] = '\0';
+
+	return 0;
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* A single-cell property of @node, or @def if it is absent */
+static uint32_t read_u32(const char *node, const char *prop, uint32_t def)
+{
+	char path[PATH_MAX];
+	uint8_t cell[4];
+
+	snprintf(path, sizeof(path), "%s/%s", node, prop);
+	if (read_file(path, cell, sizeof(cell)) != sizeof(cell))
+		return def;
+
+	return be32(cell);
+}
+
+/* @ncells big-endian cells from @p, as a number */
+static unsigned long read_cells(const uint8_t *p, uint32_t ncells)
+{
+	uint64_t val = 0;
+
+	for (uint32_t i = 0; i < ncells; i++)
+		val = val << 32 | be32(p + 4 * i);
+
+	return val;
+}
+
+static bool is_vuart(const char *compatible, size_t len, const char **match)
+{
+	for (const char *p = compatible; p < compatible + len;
+	     p += strlen(p) + 1) {
+		for (size_t i = 0; i < NR_VUART_COMPATIBLE; i++) {
+			if (!strcmp(p, vuart_compatible[i])) {
+				*match = vuart_compatible[i];
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+static void add_found(struct scan *s, const struct uuart_found *f)
+{
+	for (size_t i = 0; i < s->n; i++) {
+		if (s->found[i].mmio.base == f->mmio.base)
+			return;
+	}
+
+	if (s->n < UUART_DISCOVER_MAX)
+		s->found[s->n++] = *f;
+}
+
+/*
+ * Record the devicetree node at @node if it is a VUART, enabled or not. Its
+ * address is taken as is, as the ASPEED buses map their children one to one.
+ */
+static void parse_node(struct scan *s, const char *node)
+{
+	struct uuart_found f = {0};
+	char path[PATH_MAX];
+	const char *match;
+	uint32_t ac, sc;
+	uint8_t reg[16];
+	char buf[256];
+	ssize_t len;
+
+	snprintf(path, sizeof(path), "%s/compatible", node);
+	len = read_file(path, buf, sizeof(buf) - 1);
+	if (len <= 0)
+		return;
+	buf[len] = '\0';
+
+	if (!is_vuart(buf, len, &match))
+		return;
+
+	snprintf(path, sizeof(path), "%s/status", node);
+	len = read_file(path, buf, sizeof(buf) - 1);
+	if (len > 0) {
+		buf[len] = '\0';
+		f.disabled = strcmp(buf, "okay") && strcmp(buf, "ok");
+	}
+
+	snprintf(path, sizeof(path), "%s/..", node);
+	ac = read_u32(path, "#address-cells", 2);
+	sc = read_u32(path, "#size-cells", 1);
+	if (!ac || ac > 2 || sc > 2)
+		return;
+
+	snprintf(path, sizeof(path), "%s/reg", node);
+	len = read_file(path, reg, sizeof(reg));
+	if (len < (ssize_t)(4 * (ac + sc)))
+		return;
+
+	f.mmio.base = read_cells(reg, ac);
+	f.size = sc ? read_cells(reg + 4 * ac, sc) : 0;
+	f.mmio.reg_shift = read_u32(node, "reg-shift", 2);
+	f.mmio.io_width = read_u32(node, "reg-io-width", 1) * 8;
+	f.mmio.vuart = true;
+	snprintf(f.compatible, sizeof(f.compatible), "%s", match);
+
+	add_found(s, &f);
+}
+
+static bool is_dir(const char *path, const struct dirent *de)
+{
+	struct stat st;
+
+	if (de->d_type != DT_UNKNOWN)
+		return de->d_type == DT_DIR;
+
+	return !stat(path, &st) && S_ISDIR(st.st_mode);
+}
+
+static void walk_dt(struct scan *s, const char *dir, int depth)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d)
+		return;
+
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (!is_dir(path, de))
+			continue;
+
+		parse_node(s, path);
+		if (depth < DT_MAX_DEPTH)
+			walk_dt(s, path, depth + 1);
+	}
+
+	closedir(d);
+}
+
+/* Without /proc/device-tree, platform devices still link to their nodes */
+static void walk_platform(struct scan *s)
+{
+	char dir[PATH_MAX];
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *d;
+
+	snprintf(dir, sizeof(dir), "%s/sys/bus/platform/devices", s->root);
+	d = opendir(dir);
+	if (!d)
+		return;
+
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		if (snprintf(path, sizeof(path), "%s/%s/of_node", dir,
+			     de->d_name) >= (int)sizeof(path))
+			continue;
+
+		parse_node(s, path);
+	}
+
+	closedir(d);
+}
+
+/* Whether map 0 of the UIO device @uio covers the registers of @f */
+static bool uio_maps(const struct scan *s, const char *uio,
+		     const struct uuart_found *f)
+{
+	unsigned long addr, size;
+	char path[PATH_MAX];
+	char buf[32];
+
+	snprintf(path, sizeof(path), "%s/sys/class/uio/%s/maps/map0/addr",
+		 s->root, uio);
+	if (read_text(path, buf, sizeof(buf)))
+		return false;
+	addr = strtoul(buf, NULL, 0);
+
+	snprintf(path, sizeof(path), "%s/sys/class/uio/%s/maps/map0/size",
+		 s->root, uio);
+	if (read_text(path, buf, sizeof(buf)))
+		return false;
+	size = strtoul(buf, NULL, 0);
+
+	return f->mmio.base >= addr && f->mmio.base - addr < size;
+}
+
+static void find_uio(struct scan *s)
+{
+	char dir[PATH_MAX];
+	struct dirent *de;
+	DIR *d;
+
+	snprintf(dir, sizeof(dir), "%s/sys/class/uio", s->root);
+	d = opendir(dir);
+	if (!d)
+		return;
+
+	while ((de = readdir(d))) {
+		if (strncmp(de->d_name, "uio", 3) ||
+		    strlen(de->d_name) >= sizeof(s->found[0].uio))
+			continue;
+
+		for (size_t i = 0; i < s->n; i++) {
+			if (!s->found[i].uio[0] &&
+			    uio_maps(s, de->d_name, &s->found[i]))
+				strcpy(s->found[i].uio, de->d_name);
+		}
+	}
+
+	closedir(d);
+}
+
+static int cmp_base(const void *a, const void *b)
+{
+	const struct uuart_found *fa = a, *fb = b;
+
+	if (fa->mmio.base != fb->mmio.base)
+		return fa->mmio.base < fb->mmio.base ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * The cache holds the boot ID, then a line per VUART:
+ *
+ *	BASE SIZE SHIFT WIDTH UIO COMPATIBLE STATUS
+ *
+ * with "-" for no UIO device and STATUS "okay" or "disabled". It is only
+ * trusted for the boot that wrote it, and only while the UIO devices it names
+ * still map their VUARTs, as those can be rebound without a reboot.
+ */
+static int load_cache(struct scan *s, const char *boot)
+{
+	struct uuart_found f;
+	char path[PATH_MAX];
+	char status[16];
+	char line[160];
+	char id[64];
+	FILE *cache;
+	int rc = 0;
+
+	snprintf(path, sizeof(path), "%s" UUART_DISCOVER_CACHE, s->root);
+	cache = fopen(path, "re");
+	if (!cache)
+		return -errno;
+
+	if (!fgets(line, sizeof(line), cache) ||
+	    sscanf(line, "boot %63s", id) != 1 || strcmp(id, boot)) {
+		rc = -ESTALE;
+		goto out;
+	}
+
+	while (fgets(line, sizeof(line), cache)) {
+		memset(&f, 0, sizeof(f));
+		if (sscanf(line, "%lx %lx %u %u %15s %47s %15s", &f.mmio.base,
+			   &f.size, &f.mmio.reg_shift, &f.mmio.io_width, f.uio,
+			   f.compatible, status) != 7) {
+			rc = -EINVAL;
+			goto out;
+		}
+
+		f.mmio.vuart = true;
+		f.disabled = strcmp(status, "okay");
+		if (!strcmp(f.uio, "-"))
+			f.uio[0] = '\0';
+		else if (!uio_maps(s, f.uio, &f)) {
+			rc = -ESTALE;
+			goto out;
+		}
+
+		add_found(s, &f);
+	}
+
+out:
+	fclose(cache);
+	if (rc < 0)
+		s->n = 0;
+
+	return rc;
+}
+
+/* Best effort: a read-only /run only costs the next run a scan */
+static void save_cache(const struct scan *s, const char *boot)
+{
+	char path[PATH_MAX];
+	char tmp[PATH_MAX];
+	FILE *cache;
+
+	snprintf(path, sizeof(path), "%s" UUART_DISCOVER_CACHE, s->root);
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >=
+	    (int)sizeof(tmp))
+		return;
+
+	cache = fopen(tmp, "we");
+	if (!cache)
+		return;
+
+	fprintf(cache, "boot %s\n", boot);
+	for (size_t i = 0; i < s->n; i++) {
+		const struct uuart_found *f = &s->found[i];
+
+		fprintf(cache, "0x%lx 0x%lx %u %u %s %s %s\n", f->mmio.base,
+			f->size, f->mmio.reg_shift, f->mmio.io_width,
+			f->uio[0] ? f->uio : "-", f->compatible,
+			f->disabled ? "disabled" : "okay");
+	}
+
+	if (fclose(cache) || rename(tmp, path))
+		unlink(tmp);
+}
+
+/* Number the VUARTs, which are in address order, for the SoC's VUARTN names */
+static void number_found(struct scan *s)
+{
+	unsigned int next = NR_VUART_BASES + 1;
+	struct uuart_found *f;
+
+	for (size_t i = 0; i < s->n; i++) {
+		f = &s->found[i];
+		f->index = 0;
+		for (size_t j = 0; j < NR_VUART_BASES; j++) {
+			if (f->mmio.base == vuart_bases[j])
+				f->index = j + 1;
+		}
+		if (!f->index)
+			f->index = next++;
+	}
+}
+
+int uuart_discover(struct uuart_found *found, size_t n, const char *root,
+		   bool rescan)
+{
+	struct scan s = { .root = root ? root : "" };
+	char path[PATH_MAX];
+	bool cacheable;
+	char boot[64];
+
+	snprintf(path, sizeof(path), "%s/proc/sys/kernel/random/boot_id",
+		 s.root);
+	cacheable = !read_text(path, boot, sizeof(boot)) && boot[0];
+
+	if (!cacheable || rescan || load_cache(&s, boot) < 0) {
+		snprintf(path, sizeof(path), "%s/proc/device-tree", s.root);
+		walk_dt(&s, path, 0);
+		if (!s.n)
+			walk_platform(&s);
+
+		find_uio(&s);
+		qsort(s.found, s.n, sizeof(s.found[0]), cmp_base);
+
+		if (cacheable)
+			save_cache(&s, boot);
+	}
+
+	number_found(&s);
+	memcpy(found, s.found, (n < s.n ? n : s.n) * sizeof(*found));
+
+	return s.n;
+}
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_DISCOVER_H
+#define UUART_DISCOVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "uuart.h"
+
+/*
+ * Find the VUARTs the devicetree describes, rather than assuming the AST2400
+ * and AST2500 addresses. Nodes are read from /proc/device-tree, or through
+ * the of_node links of /sys/bus/platform/devices where that is all there is,
+ * and a UIO device whose map 0 covers a VUART's registers is recorded so it
+ * can be opened without /dev/mem.
+ *
+ * The results are cached in /run/uuart.cache along with the boot ID, which
+ * the devicetree can't change without, so later runs skip the scan.
+ */
+
+#define UUART_DISCOVER_CACHE	"/run/uuart.cache"
+#define UUART_DISCOVER_MAX	8
+
+struct uuart_found {
+	struct uuart_mmio mmio;
+	/* Size of the register window the devicetree gives */
+	unsigned long size;
+	/* The uioN device mapping it, or empty */
+	char uio[16];
+	char compatible[48];
+	/*
+	 * Not "okay" in the devicetree, as a VUART left to userspace usually
+	 * isn't, so no kernel driver has it
+	 */
+	bool disabled;
+	/*
+	 * N in VUARTN: 1 and 2 for the VUARTs at UUART_D_VUART1 and
+	 * UUART_D_VUART2, where every ASPEED SoC puts them, and 3 on for any
+	 * others, in address order
+	 */
+	unsigned int index;
+};
+
+/*
+ * Fill @found with up to @n VUARTs in address order, disabled ones included,
+ * and return how many there are, or a negative errno. Paths are taken relative
+ * to @root, NULL meaning "/", so a fake tree can stand in for the real one.
+ * @rescan ignores the cache, which is rewritten whenever a scan runs.
+ */
+int uuart_discover(struct uuart_found *found, size_t n, const char *root,
+		   bool rescan);
+
+#endif
@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+/*
+ * Time uuart_step() in each of its specialised variants: Rx and Tx, Rx only,
+ * Tx only, each with a barrier per register access and a barrier per step.
+ * Each is followed by the generic step under the same configuration, which
+ * tests it on every call, to show what the specialisation saves per step.
+ * Reports CPU cycles per step where perf events allow, and nanoseconds per
+ * step regardless.
+ *
+ *	bench [-S PATH] [-n STEPS]
+ *
+ * runs against VUART2, or against side 0 of the simulated pair at PATH. The
+ * simulator's registers are function calls that yield the CPU while Rx is
+ * empty, which swamps the differences between variants, so only numbers from
+ * hardware say much about them.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uuart.h"
+
+static size_t bench_rx(void *priv, const uint8_t *buf, size_t len)
+{
+	(void)priv;
+	(void)buf;
+
+	return len;
+}
+
+static size_t bench_tx(void *priv, uint8_t *buf, size_t len)
+{
+	(void)priv;
+
+	memset(buf, 'y', len);
+
+	return len;
+}
+
+static const struct uuart_ops bench_ops = {
+	.rx = bench_rx,
+	.tx = bench_tx,
+};
+
+static const struct {
+	const char *name;
+	bool no_rx;
+	bool no_tx;
+	bool batch_barriers;
+	bool generic_step;
+} variants[] = {
+	{ "rx+tx",                 false, false, false, false },
+	{ "rx+tx generic",         false, false, false, true  },
+	{ "rx+tx batched",         false, false, true,  false },
+	{ "rx+tx batched generic", false, false, true,  true  },
+	{ "rx",                    false, true,  false, false },
+	{ "rx generic",            false, true,  false, true  },
+	{ "rx batched",            false, true,  true,  false },
+	{ "rx batched generic",    false, true,  true,  true  },
+	{ "tx",                    true,  false, false, false },
+	{ "tx generic",            true,  false, false, true  },
+	{ "tx batched",            true,  false, true,  false },
+	{ "tx batched generic",    true,  false, true,  true  },
+};
+
+/* A cycle counter for this thread, or -1 if perf events aren't available */
+static int cycles_open(void)
+{
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_HARDWARE,
+		.size = sizeof(attr),
+		.config = PERF_COUNT_HW_CPU_CYCLES,
+		.exclude_kernel = 1,
+		.exclude_hv = 1,
+	};
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t cycles_read(int fd)
+{
+	uint64_t count;
+
+	if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+		return 0;
+
+	return count;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char * const argv[])
+{
+	const char *sim_path = NULL;
+	unsigned long steps = 1000000;
+	struct uuart_step step;
+	struct uuart *ctx;
+	int cycles;
+	int rc;
+	int o;
+
+	while ((o = getopt(argc, argv, "n:S:")) != -1) {
+		if (o == 'n')
+			steps = strtoul(optarg, NULL, 0);
+		else if (o == 'S')
+			sim_path = optarg;
+		else
+			errx(EXIT_FAILURE, "Usage: %s [-S PATH] [-n STEPS]",
+			     argv[0]);
+	}
+
+	if (sim_path)
+		rc = uuart_open_sim(&ctx, sim_path, 0);
+	else
+		rc = uuart_open(&ctx, UUART_D_VUART2);
+	if (rc < 0) {
+		errno = -rc;
+		err(EXIT_FAILURE, "uuart_open");
+	}
+
+	uuart_set_ops(ctx, &bench_ops, NULL);
+
+	cycles = cycles_open();
+	if (cycles < 0)
+		warn("perf_event_open, reporting time only");
+
+	printf("%-22s %12s %12s %12s\n", "variant", "ns/step", "cycles/step",
+	       "bytes/step");
+
+	for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+		struct uuart_config cfg = {
+			.no_rx = variants[v].no_rx,
+			.no_tx = variants[v].no_tx,
+			.batch_barriers = variants[v].batch_barriers,
+			.generic_step = variants[v].generic_step,
+		};
+		uint64_t ns, cyc, bytes = 0;
+
+		rc = uuart_init(ctx, &cfg);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "uuart_init");
+		}
+
+		cyc = cycles_read(cycles);
+		ns = now_ns();
+
+		for (unsigned long i = 0; i < steps; i++) {
+			rc = uuart_step(ctx, &step, NULL);
+			if (rc < 0) {
+				errno = -rc;
+				err(EXIT_FAILURE, "uuart_step");
+			}
+			bytes += rc;
+		}
+
+		ns = now_ns() - ns;
+		cyc = cycles_read(cycles) - cyc;
+
+		uuart_restore(ctx);
+
+		printf("%-22s %12.1f %12.1f %12.2f\n", variants[v].name,
+		       (double)ns / steps,
+		       cycles < 0 ? 0 : (double)cyc / steps,
+		       (double)bytes / steps);
+	}
+
+	if (cycles >= 0)
+		close(cycles);
+
+	uuart_close(ctx);
+
+	return 0;
+}
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+/*
+ * Echo everything the host sends on VUART2 back to it, sleeping between polls
+ * for as long as libuuart suggests.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "uuart.h"
+
+int main(void)
+{
+	struct uuart_config cfg = { .assume_dtr = false };
+	uint8_t buf[UUART_FIFO_SIZE];
+	struct timespec deadline;
+	struct uuart *ctx;
+	size_t len = 0;
+	int events;
+	ssize_t n;
+	int rc;
+
+	rc = uuart_open(&ctx, UUART_D_VUART2);
+	if (rc < 0) {
+		errno = -rc;
+		err(EXIT_FAILURE, "uuart_open");
+	}
+
+	rc = uuart_init(ctx, &cfg);
+	if (rc < 0) {
+		errno = -rc;
+		err(EXIT_FAILURE, "uuart_init");
+	}
+
+	while (1) {
+		events = uuart_poll(ctx, &deadline);
+		if (events < 0) {
+			errno = -events;
+			err(EXIT_FAILURE, "uuart_poll");
+		}
+
+		if (!len && (events & UUART_POLL_RX))
+			len = uuart_read(ctx, buf, sizeof(buf));
+
+		if (len && (events & UUART_POLL_TX)) {
+			n = uuart_write(ctx, buf, len);
+			len -= n;
+			for (size_t i = 0; i < len; i++)
+				buf[i] = buf[i + n];
+		}
+
+		if (!events)
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+					NULL);
+	}
+
+	uuart_close(ctx);
+
+	return 0;
+}
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hist.h"
+
+#define SUB_BUCKETS	(1U << UUART_HIST_SUB_BITS)
+
+static unsigned int bucket(uint64_t val)
+{
+	unsigned int e;
+
+	if (val < SUB_BUCKETS)
+		return val;
+
+	/* The top bit picks the power of two, the next few the sub-bucket */
+	e = 63 - __builtin_clzll(val);
+
+	return (e - UUART_HIST_SUB_BITS + 1) * SUB_BUCKETS +
+	       ((val >> (e - UUART_HIST_SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/* The largest value in bucket @i */
+static uint64_t bucket_max(unsigned int i)
+{
+	unsigned int e, sub;
+
+	if (i < SUB_BUCKETS)
+		return i;
+
+	e = i / SUB_BUCKETS + UUART_HIST_SUB_BITS - 1;
+	sub = i % SUB_BUCKETS;
+
+	if (e == 63 && sub == SUB_BUCKETS - 1)
+		return UINT64_MAX;
+
+	return ((uint64_t)(SUB_BUCKETS + sub + 1) <<
+		(e - UUART_HIST_SUB_BITS)) - 1;
+}
+
+void uuart_hist_init(struct uuart_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+void uuart_hist_record(struct uuart_hist *h, uint64_t val)
+{
+	h->count++;
+	h->total += val;
+	if (val < h->min)
+		h->min = val;
+	if (val > h->max)
+		h->max = val;
+	h->buckets[bucket(val)]++;
+}
+
+void uuart_hist_merge(struct uuart_hist *dst, const struct uuart_hist *src)
+{
+	dst->count += src->count;
+	dst->total += src->total;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+
+	for (unsigned int i = 0; i < UUART_HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+uint64_t uuart_hist_quantile(const struct uuart_hist *h, double q)
+{
+	uint64_t rank, seen = 0;
+	uint64_t val;
+
+	if (!h->count)
+		return 0;
+
+	rank = q * h->count;
+	if (rank < q * h->count || !rank)
+		rank++;
+
+	for (unsigned int i = 0; i < UUART_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			val = bucket_max(i);
+			return val < h->max ? val : h->max;
+		}
+	}
+
+	return h->max;
+}
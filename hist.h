@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_HIST_H
+#define UUART_HIST_H
+
+#include <stdint.h>
+
+/*
+ * A latency histogram with log-linear buckets: eight to each power of two,
+ * so any value is placed within 12.5%, from nanoseconds to centuries, in a
+ * fixed 4 KiB and a record that is a few shifts. Not thread-safe: one thread
+ * records at a time, and others read once it has stopped.
+ */
+
+#define UUART_HIST_SUB_BITS	3
+#define UUART_HIST_BUCKETS	((64 - UUART_HIST_SUB_BITS + 1) << \
+				 UUART_HIST_SUB_BITS)
+
+struct uuart_hist {
+	uint64_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[UUART_HIST_BUCKETS];
+};
+
+void uuart_hist_init(struct uuart_hist *h);
+void uuart_hist_record(struct uuart_hist *h, uint64_t val);
+
+/* Add @src's samples to @dst */
+void uuart_hist_merge(struct uuart_hist *dst, const struct uuart_hist *src);
+
+/*
+ * The value @q of the way through the samples, @q from 0 to 1, as the upper
+ * bound of its bucket capped at the maximum, or zero without samples
+ */
+uint64_t uuart_hist_quantile(const struct uuart_hist *h, double q);
+
+#endif
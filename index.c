@@ -0,0 +1,241 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "zlog.h"
+
+struct uuart_index {
+	int fd;
+	uint64_t raw_end;
+	uint64_t pos;
+};
+
+static void put_le(uint8_t *p, uint64_t val, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; i++)
+		p[i] = val >> (8 * i);
+}
+
+static uint64_t get_le(const uint8_t *p, size_t bytes)
+{
+	uint64_t val = 0;
+
+	for (size_t i = bytes; i; i--)
+		val = val << 8 | p[i - 1];
+
+	return val;
+}
+
+static int write_header(int fd, uint32_t flags)
+{
+	uint8_t hdr[UUART_INDEX_HDR_LEN];
+
+	memcpy(hdr, UUART_INDEX_MAGIC, 8);
+	put_le(&hdr[8], flags, 4);
+	put_le(&hdr[12], UUART_INDEX_REC_LEN, 4);
+
+	if (ftruncate(fd, 0) ||
+	    write(fd, hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr))
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * Index the blocks of the compressed file @fd from @pos on, where @skip says
+ * the block at @pos is indexed already, and note where the stream ends.
+ */
+static int scan_blocks(struct uuart_index *x, int fd, uint64_t pos, bool skip)
+{
+	uint8_t hdr[UUART_ZLOG_HDR_LEN];
+	struct uuart_zlog_block blk;
+	int rc;
+
+	while (pread(fd, hdr, sizeof(hdr), pos) == (ssize_t)sizeof(hdr) &&
+	       !uuart_zlog_parse(hdr, &blk)) {
+		if (!skip) {
+			rc = uuart_index_add(x, blk.first_ns, blk.raw_off, pos);
+			if (rc < 0)
+				return rc;
+		}
+
+		skip = false;
+		x->raw_end = blk.raw_off + blk.raw_len;
+		pos += sizeof(hdr) + blk.len;
+	}
+
+	return 0;
+}
+
+int uuart_index_open(struct uuart_index **xp, const char *path, int fd,
+		     bool compressed)
+{
+	uint32_t flags = compressed ? UUART_INDEX_COMPRESSED : 0;
+	struct uuart_index_entry last;
+	char ipath[PATH_MAX];
+	struct uuart_index *x;
+	uint32_t old_flags;
+	struct stat st;
+	ssize_t n;
+	int rc;
+
+	if (snprintf(ipath, sizeof(ipath), "%s" UUART_INDEX_SUFFIX, path) >=
+	    (int)sizeof(ipath))
+		return -ENAMETOOLONG;
+
+	if (fstat(fd, &st))
+		return -errno;
+
+	x = calloc(1, sizeof(*x));
+	if (!x)
+		return -errno;
+
+	x->fd = open(ipath, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (x->fd < 0) {
+		rc = -errno;
+		goto cleanup;
+	}
+
+	/* An index of something else is no use, so start over */
+	n = uuart_index_load(x->fd, &old_flags);
+	if (!st.st_size || n < 0 || old_flags != flags) {
+		rc = write_header(x->fd, flags);
+		if (rc < 0)
+			goto cleanup;
+		n = 0;
+	}
+
+	x->pos = st.st_size;
+	x->raw_end = st.st_size;
+
+	if (compressed) {
+		x->raw_end = 0;
+		if (n > 0) {
+			rc = uuart_index_get(x->fd, n - 1, &last);
+			if (rc < 0)
+				goto cleanup;
+		}
+
+		rc = scan_blocks(x, fd, n > 0 ? last.pos : 0, n > 0);
+		if (rc < 0)
+			goto cleanup;
+	}
+
+	*xp = x;
+
+	return 0;
+
+cleanup:
+	if (x->fd >= 0)
+		close(x->fd);
+	free(x);
+
+	return rc;
+}
+
+void uuart_index_close(struct uuart_index *x)
+{
+	close(x->fd);
+	free(x);
+}
+
+uint64_t uuart_index_raw_end(const struct uuart_index *x)
+{
+	return x->raw_end;
+}
+
+uint64_t uuart_index_pos(const struct uuart_index *x)
+{
+	return x->pos;
+}
+
+int uuart_index_add(struct uuart_index *x, uint64_t ns, uint64_t raw_off,
+		    uint64_t pos)
+{
+	uint8_t rec[UUART_INDEX_REC_LEN];
+
+	put_le(&rec[0], ns, 8);
+	put_le(&rec[8], raw_off, 8);
+	put_le(&rec[16], pos, 8);
+
+	if (write(x->fd, rec, sizeof(rec)) != (ssize_t)sizeof(rec))
+		return errno ? -errno : -EIO;
+
+	return 0;
+}
+
+ssize_t uuart_index_load(int fd, uint32_t *flags)
+{
+	uint8_t hdr[UUART_INDEX_HDR_LEN];
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return -errno;
+
+	if (pread(fd, hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+	    memcmp(hdr, UUART_INDEX_MAGIC, 8) ||
+	    get_le(&hdr[12], 4) != UUART_INDEX_REC_LEN)
+		return -EINVAL;
+
+	*flags = get_le(&hdr[8], 4);
+
+	return (st.st_size - UUART_INDEX_HDR_LEN) / UUART_INDEX_REC_LEN;
+}
+
+int uuart_index_get(int fd, size_t i, struct uuart_index_entry *e)
+{
+	uint8_t rec[UUART_INDEX_REC_LEN];
+
+	if (pread(fd, rec, sizeof(rec),
+		  UUART_INDEX_HDR_LEN + (off_t)i * UUART_INDEX_REC_LEN) !=
+	    (ssize_t)sizeof(rec))
+		return -EIO;
+
+	e->ns = get_le(&rec[0], 8);
+	e->raw_off = get_le(&rec[8], 8);
+	e->pos = get_le(&rec[16], 8);
+
+	return 0;
+}
+
+/* The last record whose @field is at most @val */
+static size_t find(int fd, size_t n, size_t field, uint64_t val)
+{
+	struct uuart_index_entry e;
+	size_t lo = 0, hi = n, mid;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (uuart_index_get(fd, mid, &e))
+			break;
+
+		if (*(uint64_t *)((char *)&e + field) <= val)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+size_t uuart_index_find_time(int fd, size_t n, uint64_t ns)
+{
+	return find(fd, n, offsetof(struct uuart_index_entry, ns), ns);
+}
+
+size_t uuart_index_find_raw(int fd, size_t n, uint64_t raw_off)
+{
+	return find(fd, n, offsetof(struct uuart_index_entry, raw_off),
+		    raw_off);
+}
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_INDEX_H
+#define UUART_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A sparse index of a capture file, kept next to it in FILE.idx, so a reader
+ * can find a time or an offset in the uncompressed stream with a binary
+ * search instead of a scan. It starts with a UUART_INDEX_HDR_LEN header:
+ *
+ *	"UUIDX1\0\0", then a little-endian u32 of UUART_INDEX_* flags and a
+ *	little-endian u32 record size
+ *
+ * followed by fixed-size records of three little-endian u64s: a
+ * CLOCK_REALTIME ns, an offset in the uncompressed stream, and the file
+ * position where that offset starts, or for a compressed file where the
+ * block holding it starts. Records are in stream order, and so in time order
+ * unless the clock was stepped back.
+ */
+
+#define UUART_INDEX_SUFFIX	".idx"
+#define UUART_INDEX_MAGIC	"UUIDX1\0\0"
+#define UUART_INDEX_HDR_LEN	16
+#define UUART_INDEX_REC_LEN	24
+
+/* The file is made of zlog.h blocks */
+#define UUART_INDEX_COMPRESSED	(1U << 0)
+
+struct uuart_index;
+
+struct uuart_index_entry {
+	uint64_t ns;
+	uint64_t raw_off;
+	uint64_t pos;
+};
+
+/*
+ * Open or create the index of the capture file @path, open as @fd. An index
+ * that is missing or behind a compressed file is brought up to date from the
+ * block headers, and one for an empty file is started over.
+ */
+int uuart_index_open(struct uuart_index **xp, const char *path, int fd,
+		     bool compressed);
+
+void uuart_index_close(struct uuart_index *x);
+
+/* Where the uncompressed stream carries on, and the file position of that */
+uint64_t uuart_index_raw_end(const struct uuart_index *x);
+uint64_t uuart_index_pos(const struct uuart_index *x);
+
+/* Record that @raw_off starts at @pos at the time @ns */
+int uuart_index_add(struct uuart_index *x, uint64_t ns, uint64_t raw_off,
+		    uint64_t pos);
+
+/*
+ * Readers. uuart_index_load() checks the header of the index open as @fd and
+ * returns its record count and flags, or a negative errno.
+ */
+ssize_t uuart_index_load(int fd, uint32_t *flags);
+int uuart_index_get(int fd, size_t i, struct uuart_index_entry *e);
+
+/*
+ * The last of the @n records at or before @ns, or at or before @raw_off, or
+ * zero if there is none. Either takes O(log n) reads.
+ */
+size_t uuart_index_find_time(int fd, size_t n, uint64_t ns);
+size_t uuart_index_find_raw(int fd, size_t n, uint64_t raw_off);
+
+#endif
@@ -0,0 +1,1406 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "regs.h"
+#include "sim.h"
+#include "uuart.h"
+
+#define POLL_MIN_NS		1000UL
+#define POLL_MAX_NS		1000000UL
+#define CORK_MAX_NS		1000000UL
+#define LOCK_DIR		"/run/lock"
+/* Bursts observed between fifo_auto retunes */
+#define FIFO_AUTO_BURSTS	256
+/*
+ * Tx pacing keeps its bucket in bytes scaled by this, so a refill for dt ns
+ * at tx_rate bytes a second is exactly dt * tx_rate, with no division and no
+ * rounding to drift the long-run rate.
+ */
+#define PACE_SCALE		1000000000ULL
+
+#ifdef __ARM_ARCH
+#define mb() asm volatile("dmb 3\n" : : : "memory")
+#else
+#error Unsupported host architecture!
+#endif
+
+/*
+ * The startup values of the registers we modify. FCR is write-only, so the
+ * FIFO enable state is recovered from IIR[7:6] instead.
+ */
+struct uuart_saved {
+	bool valid;
+	uint8_t gcra;
+	uint8_t ier;
+	uint8_t mcr;
+	bool fifos;
+};
+
+/* Burst sizes seen since fifo_auto last picked a trigger level */
+struct fifo_window {
+	uint32_t hist[UUART_FIFO_SIZE + 1];
+	uint32_t n;
+};
+
+struct uuart;
+
+typedef int (*uuart_step_fn)(struct uuart *ctx, struct uuart_step *step,
+			     struct timespec *next);
+
+/*
+ * A register access variant: the accessors for one way of reaching the
+ * registers, and the data path step.h compiles around them. step[rx][tx][batch]
+ * holds a uuart_step() specialised for each combination of Rx and Tx enabled
+ * and the barrier policy, and uuart_init() picks one. step_generic tests them
+ * at run time instead.
+ */
+struct uuart_io {
+	uint8_t (*readb)(const struct uuart *ctx, unsigned long reg);
+	void (*writeb)(struct uuart *ctx, unsigned long reg, uint8_t val);
+	ssize_t (*read)(struct uuart *ctx, void *buf, size_t n);
+	ssize_t (*write)(struct uuart *ctx, const void *buf, size_t n);
+	uuart_step_fn step[2][2][2];
+	uuart_step_fn step_generic;
+};
+
+struct uuart {
+	const struct uuart_io *io;
+	uuart_step_fn step;
+	volatile void *regs;
+	struct uuart_sim *sim;
+	unsigned long base;
+	void *map;
+	size_t len;
+	unsigned int reg_shift;
+	/* GCRA and the other ASPEED VUART registers exist */
+	bool vuart;
+	/* The lock file uuart_claim() takes, keyed by the device */
+	char lock_path[PATH_MAX];
+	int lock_fd;
+	bool claimed;
+	bool monitor;
+	struct uuart_config cfg;
+	struct uuart_saved saved;
+	/* Bytes the Tx FIFO accepts once LSR[THRE] is set */
+	size_t tx_room;
+	unsigned long poll_ns;
+
+	/* uuart_step() state */
+	const struct uuart_ops *ops;
+	void *priv;
+	bool stalled;
+	uint8_t rx_buf[UUART_FIFO_SIZE];
+	size_t rx_off;
+	size_t rx_len;
+	/* When rx_buf was drained from the FIFO, CLOCK_MONOTONIC */
+	uint64_t rx_ns;
+	uint8_t tx_buf[UUART_FIFO_SIZE];
+	size_t tx_off;
+	size_t tx_len;
+
+	/* Modem control flow control */
+	bool throttled;
+	uint64_t throttled_since;
+	bool tx_held;
+	uint64_t tx_held_since;
+	struct uuart_flow_stats flow;
+
+	/* Tx corking: whether tx_buf is holding a burst back, and since when */
+	bool corked;
+	uint64_t corked_since;
+	struct uuart_cork_stats cork;
+
+	/*
+	 * Tx pacing: the bucket, when it was last refilled and first ran empty,
+	 * and while Tx waits on it, when it will next hold a byte
+	 */
+	uint64_t pace_credit;
+	uint64_t pace_refilled;
+	uint64_t pace_since;
+	uint64_t pace_due;
+	struct uuart_pace_stats pace;
+
+	/* FIFO trigger tuning */
+	struct fifo_window rx_window;
+	struct fifo_window tx_window;
+	struct uuart_fifo_stats fifo;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * R_* are VUART offsets, with registers four bytes apart. Other 8250-style
+ * devices space them 1 << reg_shift bytes apart, and may need 32-bit accesses.
+ * Each MMIO accessor pair fixes both at compile time, so an access through it
+ * is the same single load or store that a constant offset would give.
+ *
+ * The _relaxed accessors leave out the barrier. Accesses to the device stay
+ * in order among themselves, so the batch_barriers data path issues a single
+ * io_barrier() per step to order them against memory.
+ */
+#define DEFINE_MMIO_IO(name, shift, type)				\
+static inline uint8_t name##_readb_relaxed(const struct uuart *ctx,	\
+					   unsigned long reg)		\
+{									\
+	const volatile type *p = ctx->regs;				\
+									\
+	return p[((reg >> 2) << (shift)) / sizeof(type)];		\
+}									\
+									\
+static inline void name##_writeb_relaxed(struct uuart *ctx,		\
+					 unsigned long reg, uint8_t val)	\
+{									\
+	volatile type *p = ctx->regs;					\
+									\
+	p[((reg >> 2) << (shift)) / sizeof(type)] = val;		\
+}									\
+									\
+static inline uint8_t name##_readb(const struct uuart *ctx,		\
+				   unsigned long reg)			\
+{									\
+	uint8_t val = name##_readb_relaxed(ctx, reg);			\
+									\
+	mb();								\
+	return val;							\
+}									\
+									\
+static inline void name##_writeb(struct uuart *ctx, unsigned long reg,	\
+				 uint8_t val)				\
+{									\
+	name##_writeb_relaxed(ctx, reg, val);				\
+	mb();								\
+}
+
+static inline void mmio_barrier(void)
+{
+	mb();
+}
+
+DEFINE_MMIO_IO(mmio8_s0, 0, uint8_t)
+DEFINE_MMIO_IO(mmio8_s2, 2, uint8_t)
+DEFINE_MMIO_IO(mmio32_s2, 2, uint32_t)
+
+static inline uint8_t sim_io_readb(const struct uuart *ctx, unsigned long reg)
+{
+	return sim_readb(ctx->sim, reg);
+}
+
+static inline void sim_io_writeb(struct uuart *ctx, unsigned long reg,
+				 uint8_t val)
+{
+	sim_writeb(ctx->sim, reg, val);
+}
+
+/* The simulator's shared state is all atomics */
+static inline void sim_barrier(void)
+{
+}
+
+/* Instantiated from step.h at the end of the file */
+static const struct uuart_io io_mmio8_s0, io_mmio8_s2, io_mmio32_s2, io_sim;
+
+/* Register access off the data path */
+static uint8_t readb(const struct uuart *ctx, unsigned long reg)
+{
+	return ctx->io->readb(ctx, reg);
+}
+
+static void writeb(struct uuart *ctx, unsigned long reg, uint8_t val)
+{
+	ctx->io->writeb(ctx, reg, val);
+}
+
+int uuart_open(struct uuart **ctxp, unsigned long base)
+{
+	const struct uuart_mmio mmio = {
+		.base = base,
+		.reg_shift = 2,
+		.io_width = 8,
+		.vuart = true,
+	};
+
+	return uuart_open_mmio(ctxp, &mmio);
+}
+
+/*
+ * Map the registers of @mmio, found @off bytes into the device file @fd, and
+ * set up a context for them. Consumes @fd.
+ */
+static int map_regs(struct uuart **ctxp, const struct uuart_mmio *mmio, int fd,
+		    unsigned long off)
+{
+	const struct uuart_io *io;
+	unsigned long page_off;
+	struct uuart *ctx;
+	int rc;
+
+	if (mmio->reg_shift == 0 && mmio->io_width == 8)
+		io = &io_mmio8_s0;
+	else if (mmio->reg_shift == 2 && mmio->io_width == 8)
+		io = &io_mmio8_s2;
+	else if (mmio->reg_shift == 2 && mmio->io_width == 32)
+		io = &io_mmio32_s2;
+	else {
+		rc = -EINVAL;
+		goto cleanup_fd;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx) {
+		rc = -errno;
+		goto cleanup_fd;
+	}
+
+	/* Generic UARTs needn't sit at the start of a page */
+	page_off = off & (getpagesize() - 1);
+	ctx->len = page_off + (NR_REGS << mmio->reg_shift);
+	ctx->len = (ctx->len + getpagesize() - 1) & ~(getpagesize() - 1UL);
+	ctx->map = mmap(NULL, ctx->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			off - page_off);
+	if (ctx->map == MAP_FAILED) {
+		rc = -errno;
+		goto cleanup_ctx;
+	}
+
+	close(fd);
+
+	ctx->io = io;
+	ctx->step = io->step[1][1][0];
+	ctx->regs = (uint8_t *)ctx->map + page_off;
+	ctx->base = mmio->base;
+	ctx->lock_fd = -1;
+	snprintf(ctx->lock_path, sizeof(ctx->lock_path),
+		 LOCK_DIR "/uuart-%08lx.lock", mmio->base);
+	ctx->reg_shift = mmio->reg_shift;
+	ctx->vuart = mmio->vuart;
+	ctx->tx_room = 1;
+	ctx->poll_ns = POLL_MIN_NS;
+
+	*ctxp = ctx;
+
+	return 0;
+
+cleanup_ctx:
+	free(ctx);
+
+cleanup_fd:
+	close(fd);
+
+	return rc;
+}
+
+int uuart_open_mmio(struct uuart **ctxp, const struct uuart_mmio *mmio)
+{
+	int fd;
+
+	fd = open("/dev/mem", O_SYNC | O_RDWR);
+	if (fd == -1)
+		return -errno;
+
+	return map_regs(ctxp, mmio, fd, mmio->base);
+}
+
+static int read_sysfs(const char *path, char *buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -errno;
+
+	while (n && buf[n - 1] == '\n')
+		n--;
+	buf[n] = '\0';
+
+	return 0;
+}
+
+int uuart_open_uio(struct uuart **ctxp, const char *name,
+		   const struct uuart_mmio *mmio)
+{
+	struct uuart_mmio uio = *mmio;
+	char path[PATH_MAX];
+	unsigned long off;
+	struct dirent *de;
+	char buf[64];
+	DIR *dir;
+	int fd;
+
+	dir = opendir("/sys/class/uio");
+	if (!dir)
+		return -errno;
+
+	while ((de = readdir(dir))) {
+		if (strncmp(de->d_name, "uio", 3))
+			continue;
+
+		if (!strcmp(de->d_name, name))
+			break;
+
+		snprintf(path, sizeof(path), "/sys/class/uio/%s/name",
+			 de->d_name);
+		if (!read_sysfs(path, buf, sizeof(buf)) && !strcmp(buf, name))
+			break;
+	}
+
+	if (!de) {
+		closedir(dir);
+		return -ENODEV;
+	}
+
+	/* Map 0 holds the registers, starting this far into its first page */
+	snprintf(path, sizeof(path), "/sys/class/uio/%s/maps/map0/offset",
+		 de->d_name);
+	off = read_sysfs(path, buf, sizeof(buf)) ? 0 : strtoul(buf, NULL, 0);
+
+	snprintf(path, sizeof(path), "/sys/class/uio/%s/maps/map0/addr",
+		 de->d_name);
+	if (!read_sysfs(path, buf, sizeof(buf)))
+		uio.base = strtoul(buf, NULL, 0) + off;
+
+	snprintf(path, sizeof(path), "/dev/%s", de->d_name);
+	closedir(dir);
+
+	fd = open(path, O_SYNC | O_RDWR | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	return map_regs(ctxp, &uio, fd, off);
+}
+
+int uuart_open_sim(struct uuart **ctxp, const char *path, int side)
+{
+	struct uuart *ctx;
+	int rc;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -errno;
+
+	rc = sim_open(&ctx->sim, path, side);
+	if (rc < 0) {
+		free(ctx);
+		return rc;
+	}
+
+	ctx->io = &io_sim;
+	ctx->step = io_sim.step[1][1][0];
+	ctx->lock_fd = -1;
+	snprintf(ctx->lock_path, sizeof(ctx->lock_path), "%s.%d.lock", path,
+		 side);
+	ctx->reg_shift = 2;
+	ctx->vuart = true;
+	ctx->tx_room = 1;
+	ctx->poll_ns = POLL_MIN_NS;
+
+	*ctxp = ctx;
+
+	return 0;
+}
+
+void uuart_close(struct uuart *ctx)
+{
+	uuart_restore(ctx);
+	if (ctx->lock_fd >= 0)
+		close(ctx->lock_fd);
+	if (ctx->sim)
+		sim_close(ctx->sim);
+	else
+		munmap(ctx->map, ctx->len);
+	free(ctx);
+}
+
+unsigned long uuart_base(const struct uuart *ctx)
+{
+	return ctx->base;
+}
+
+/*
+ * Reading IIR acknowledges a THRE interrupt, LSR clears the line error bits
+ * and MSR the delta bits, so monitors leave those to the owner.
+ */
+static const struct {
+	const char *name;
+	unsigned long reg;
+	bool vuart;
+	bool destructive;
+} dump_regs[] = {
+	{ "IER",  R_IER,  false, false },
+	{ "IIR",  R_IIR,  false, true  },
+	{ "LCR",  R_LCR,  false, false },
+	{ "MCR",  R_MCR,  false, false },
+	{ "LSR",  R_LSR,  false, true  },
+	{ "MSR",  R_MSR,  false, true  },
+	{ "GCRA", R_GCRA, true,  false },
+	{ "GCRB", R_GCRB, true,  false },
+	{ "VARL", R_VARL, true,  false },
+	{ "VARH", R_VARH, true,  false },
+	{ "GCRE", R_GCRE, true,  false },
+	{ "GCRF", R_GCRF, true,  false },
+	{ "GCRG", R_GCRG, true,  false },
+	{ "GCRH", R_GCRH, true,  false },
+};
+
+#define NR_DUMP_REGS (sizeof(dump_regs) / sizeof(dump_regs[0]))
+
+size_t uuart_read_regs(const struct uuart *ctx, struct uuart_reg *regs,
+		       size_t n)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < NR_DUMP_REGS && count < n; i++) {
+		unsigned long reg = dump_regs[i].reg;
+
+		if (dump_regs[i].vuart && !ctx->vuart)
+			continue;
+
+		if (dump_regs[i].destructive && ctx->monitor)
+			continue;
+
+		regs[count].name = dump_regs[i].name;
+		regs[count].addr = ctx->base + ((reg >> 2) << ctx->reg_shift);
+		regs[count].val = readb(ctx, reg);
+		count++;
+	}
+
+	return count;
+}
+
+void uuart_dump_regs(const struct uuart *ctx, FILE *stream)
+{
+	struct uuart_reg regs[UUART_MAX_REGS];
+	size_t n;
+
+	n = uuart_read_regs(ctx, regs, UUART_MAX_REGS);
+	for (size_t i = 0; i < n; i++)
+		fprintf(stream, "\t0x%08lx\t%s:\t0x%02x\n", regs[i].addr,
+			regs[i].name, regs[i].val);
+}
+
+static int step_denied(struct uuart *ctx, struct uuart_step *step,
+		       struct timespec *next)
+{
+	(void)ctx;
+	(void)step;
+	(void)next;
+
+	return -EPERM;
+}
+
+/*
+ * Owners take a write lock on byte 0 of the lock file and monitors a read
+ * lock on byte 1, so owners exclude each other while monitors come and go
+ * alongside them. These are process locks, which F_GETLK can name the holder
+ * of, and closing the one descriptor drops them.
+ */
+int uuart_claim(struct uuart *ctx, bool monitor, pid_t *holder)
+{
+	struct flock fl = {
+		.l_type = monitor ? F_RDLCK : F_WRLCK,
+		.l_whence = SEEK_SET,
+		.l_start = monitor ? 1 : 0,
+		.l_len = 1,
+	};
+	int fd;
+	int rc;
+
+	if (ctx->claimed && ctx->monitor == monitor)
+		return 0;
+
+	/* An initialised owner has registers to restore first */
+	if (ctx->saved.valid)
+		return -EINVAL;
+
+	fd = open(ctx->lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	if (fcntl(fd, F_SETLK, &fl)) {
+		rc = errno == EACCES || errno == EAGAIN ? -EBUSY : -errno;
+		if (rc == -EBUSY && holder) {
+			*holder = 0;
+			if (!fcntl(fd, F_GETLK, &fl) && fl.l_type != F_UNLCK)
+				*holder = fl.l_pid;
+		}
+		close(fd);
+		return rc;
+	}
+
+	if (ctx->lock_fd >= 0)
+		close(ctx->lock_fd);
+
+	ctx->lock_fd = fd;
+	ctx->claimed = true;
+	ctx->monitor = monitor;
+	ctx->step = monitor ? step_denied : ctx->io->step[1][1][0];
+
+	return 0;
+}
+
+const char *uuart_lock_path(const struct uuart *ctx)
+{
+	return ctx->lock_path;
+}
+
+static bool fifos_enabled(const struct uuart *ctx)
+{
+	return (readb(ctx, R_IIR) & IIR_FIFOS) == IIR_FIFOS;
+}
+
+static void save_regs(struct uuart *ctx)
+{
+
+	if (ctx->vuart)
+		ctx->saved.gcra = readb(ctx, R_GCRA);
+	ctx->saved.ier = readb(ctx, R_IER);
+	ctx->saved.mcr = readb(ctx, R_MCR);
+	ctx->saved.fifos = fifos_enabled(ctx);
+	ctx->saved.valid = true;
+}
+
+/*
+ * Put back the startup register state without discarding FIFO contents: the
+ * FIFO reset bits are never set, and FCR is only rewritten if FCR[FIFOE] has
+ * to change, as toggling it clears the FIFOs regardless. GCRA goes last so
+ * the VUART stays enabled while the other registers are restored.
+ */
+void uuart_restore(struct uuart *ctx)
+{
+
+	if (!ctx->saved.valid)
+		return;
+
+	ctx->saved.valid = false;
+
+	if (readb(ctx, R_MCR) != ctx->saved.mcr)
+		writeb(ctx, R_MCR, ctx->saved.mcr);
+
+	if (readb(ctx, R_IER) != ctx->saved.ier)
+		writeb(ctx, R_IER, ctx->saved.ier);
+
+	if (fifos_enabled(ctx) != ctx->saved.fifos)
+		writeb(ctx, R_FCR, ctx->saved.fifos ? FCR_FIFOE : 0);
+
+	if (ctx->vuart && readb(ctx, R_GCRA) != ctx->saved.gcra)
+		writeb(ctx, R_GCRA, ctx->saved.gcra);
+}
+
+static const unsigned int trigger_levels[] = { 1, 4, 8, 14 };
+
+#define NR_TRIGGER_LEVELS (sizeof(trigger_levels) / sizeof(trigger_levels[0]))
+
+/* The FCR[RFT] and GCRA[H_RFT] encoding of a trigger level */
+static int trigger_bits(unsigned int level)
+{
+	for (size_t i = 0; i < NR_TRIGGER_LEVELS; i++) {
+		if (trigger_levels[i] == level)
+			return i;
+	}
+
+	return -EINVAL;
+}
+
+/* Fill in the defaults for the zero fields of @cfg and check the rest */
+static int check_config(const struct uuart *ctx, struct uuart_config *cfg)
+{
+	if (!cfg->poll_min_ns)
+		cfg->poll_min_ns = POLL_MIN_NS;
+	if (!cfg->poll_max_ns)
+		cfg->poll_max_ns = POLL_MAX_NS;
+	if (cfg->poll_min_ns > cfg->poll_max_ns)
+		return -EINVAL;
+	if (!cfg->cork_max_ns)
+		cfg->cork_max_ns = CORK_MAX_NS;
+	if (cfg->tx_burst > UINT64_MAX / PACE_SCALE)
+		return -EINVAL;
+
+	/* The host trigger and the timeout live in GCRA */
+	if (!ctx->vuart && (cfg->host_rx_trigger > 1 ||
+			    cfg->rx_timeout))
+		return -EOPNOTSUPP;
+
+	if (!cfg->rx_trigger)
+		cfg->rx_trigger = 1;
+	if (!cfg->host_rx_trigger)
+		cfg->host_rx_trigger = 1;
+	if (trigger_bits(cfg->rx_trigger) < 0 ||
+	    trigger_bits(cfg->host_rx_trigger) < 0 ||
+	    cfg->rx_timeout > GCRA_S_TIMEOUT >> GCRA_S_TIMEOUT_SHIFT)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* The step for ctx->cfg */
+static uuart_step_fn pick_step(const struct uuart *ctx)
+{
+	const struct uuart_config *cfg = &ctx->cfg;
+
+	if (cfg->generic_step)
+		return ctx->io->step_generic;
+
+	return ctx->io->step[!cfg->no_rx][!cfg->no_tx][cfg->batch_barriers];
+}
+
+int uuart_init(struct uuart *ctx, const struct uuart_config *cfg)
+{
+	struct uuart_config new = *cfg;
+	int rft, h_rft;
+	uint8_t gcra;
+	uint8_t ier;
+	int rc;
+
+	if (ctx->monitor)
+		return -EPERM;
+
+	rc = uuart_claim(ctx, false, NULL);
+	if (rc < 0)
+		return rc;
+
+	rc = check_config(ctx, &new);
+	if (rc < 0)
+		return rc;
+
+	ctx->cfg = new;
+	ctx->poll_ns = ctx->cfg.poll_min_ns;
+	rft = trigger_bits(ctx->cfg.rx_trigger);
+	h_rft = trigger_bits(ctx->cfg.host_rx_trigger);
+	ctx->fifo.rx_trigger = ctx->cfg.rx_trigger;
+	ctx->fifo.host_rx_trigger = ctx->cfg.host_rx_trigger;
+
+	save_regs(ctx);
+
+	/* Enable the VUART */
+	gcra = GCRA_VUART_EN | GCRA_DIS_H_TX_DISCARD;
+	gcra |= h_rft << GCRA_H_RFT_SHIFT;
+	gcra |= ctx->cfg.rx_timeout << GCRA_S_TIMEOUT_SHIFT;
+	if (ctx->vuart && !cfg->assume_enabled)
+		writeb(ctx, R_GCRA, gcra);
+
+	/* Configure IER */
+	ier = readb(ctx, R_IER);
+	if (!cfg->no_tx)
+		ier &= ~IER_ETBEI;
+	if (!cfg->no_rx)
+		ier &= ~IER_ERBFI;
+	if (!(ier & (IER_ETBEI | IER_ERBFI)))
+		ier = 0;
+	writeb(ctx, R_IER, ier);
+
+	/* Reset and enable the FIFOs */
+	if (!cfg->assume_fifos)
+		writeb(ctx, R_FCR, FCR_XFIFOR | FCR_RFIFOR | FCR_FIFOE |
+				   rft << FCR_RFT_SHIFT);
+
+	/* Indicate we're ready */
+	if (!cfg->assume_dtr)
+		writeb(ctx, R_MCR, 0x0b);
+
+	/* LSR[THRE] signals an empty FIFO, not just an empty THR */
+	ctx->tx_room = fifos_enabled(ctx) ? UUART_FIFO_SIZE : 1;
+
+	/* A corked burst can't outgrow the FIFO */
+	if (ctx->cfg.cork_burst > ctx->tx_room)
+		ctx->cfg.cork_burst = ctx->tx_room;
+	if (!ctx->cfg.tx_burst)
+		ctx->cfg.tx_burst = ctx->tx_room;
+	uuart_hist_init(&ctx->pace.jitter);
+
+	ctx->step = pick_step(ctx);
+
+	return 0;
+}
+
+ssize_t uuart_read(struct uuart *ctx, void *buf, size_t n)
+{
+	if (ctx->monitor)
+		return -EPERM;
+
+	return ctx->io->read(ctx, buf, n);
+}
+
+ssize_t uuart_write(struct uuart *ctx, const void *buf, size_t n)
+{
+	if (ctx->monitor)
+		return -EPERM;
+
+	return ctx->io->write(ctx, buf, n);
+}
+
+static void timespec_add_ns(struct timespec *ts, unsigned long ns)
+{
+	ts->tv_sec += ns / 1000000000UL;
+	ts->tv_nsec += ns % 1000000000UL;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/*
+ * Work out when the caller should come back: immediately while the device is
+ * busy, otherwise after an interval that doubles up to poll_max_ns for each
+ * consecutive idle call.
+ */
+static int next_wake(struct uuart *ctx, bool busy, struct timespec *deadline)
+{
+	if (busy)
+		ctx->poll_ns = ctx->cfg.poll_min_ns;
+
+	if (!deadline)
+		return 0;
+
+	if (clock_gettime(CLOCK_MONOTONIC, deadline))
+		return -errno;
+
+	if (busy)
+		return 0;
+
+	timespec_add_ns(deadline, ctx->poll_ns);
+	if (ctx->poll_ns < ctx->cfg.poll_max_ns / 2)
+		ctx->poll_ns *= 2;
+	else
+		ctx->poll_ns = ctx->cfg.poll_max_ns;
+
+	return 0;
+}
+
+/* Keep the Rx interrupt masked so the kernel driver can't drain RBR */
+static void mask_rx_irq(struct uuart *ctx)
+{
+
+	if (!ctx->cfg.no_rx)
+		writeb(ctx, R_IER, (~IER_ERBFI & readb(ctx, R_IER)));
+}
+
+int uuart_poll(struct uuart *ctx, struct timespec *deadline)
+{
+	int events = 0;
+	uint8_t lsr;
+	int rc;
+
+	if (ctx->monitor)
+		return -EPERM;
+
+	mask_rx_irq(ctx);
+
+	lsr = readb(ctx, R_LSR);
+
+	if (!ctx->cfg.no_rx && (lsr & LSR_DR))
+		events |= UUART_POLL_RX;
+
+	if (!ctx->cfg.no_tx && (lsr & LSR_THRE))
+		events |= UUART_POLL_TX;
+
+	rc = next_wake(ctx, events, deadline);
+
+	return rc < 0 ? rc : events;
+}
+
+void uuart_set_ops(struct uuart *ctx, const struct uuart_ops *ops, void *priv)
+{
+	ctx->ops = ops;
+	ctx->priv = priv;
+}
+
+/*
+ * The highest trigger level that nine in ten bursts reach. Those bursts
+ * interrupt as few times as the level allows, and only the rest wait out the
+ * timeout.
+ */
+static unsigned int pick_trigger(const struct fifo_window *w)
+{
+	for (size_t i = NR_TRIGGER_LEVELS - 1; i > 0; i--) {
+		uint32_t reached = 0;
+
+		for (size_t b = trigger_levels[i]; b <= UUART_FIFO_SIZE; b++)
+			reached += w->hist[b];
+
+		if ((uint64_t)reached * 10 >= (uint64_t)w->n * 9)
+			return trigger_levels[i];
+	}
+
+	return 1;
+}
+
+/* Returns the trigger level to switch to once the window fills, else zero */
+static unsigned int window_record(struct fifo_window *w, size_t len)
+{
+	unsigned int level;
+
+	w->hist[len]++;
+	if (++w->n < FIFO_AUTO_BURSTS)
+		return 0;
+
+	level = pick_trigger(w);
+	memset(w, 0, sizeof(*w));
+
+	return level;
+}
+
+static void fifo_record_rx(struct uuart *ctx, size_t len)
+{
+	unsigned int level;
+
+	ctx->fifo.rx_bursts[len]++;
+
+	if (!ctx->cfg.fifo_auto)
+		return;
+
+	level = window_record(&ctx->rx_window, len);
+	if (!level || level == ctx->fifo.rx_trigger ||
+	    ctx->tx_room != UUART_FIFO_SIZE)
+		return;
+
+	/* Without the reset bits, and with FCR[FIFOE] kept, nothing is lost */
+	writeb(ctx, R_FCR, FCR_FIFOE | trigger_bits(level) << FCR_RFT_SHIFT);
+	ctx->fifo.rx_trigger = level;
+	ctx->fifo.retunes++;
+}
+
+static void fifo_record_tx(struct uuart *ctx, size_t len)
+{
+	unsigned int level;
+	uint8_t gcra;
+
+	ctx->fifo.tx_bursts[len]++;
+
+	if (!ctx->cfg.fifo_auto)
+		return;
+
+	level = window_record(&ctx->tx_window, len);
+	if (!level || level == ctx->fifo.host_rx_trigger || !ctx->vuart)
+		return;
+
+	gcra = readb(ctx, R_GCRA) & ~GCRA_H_RFT;
+	writeb(ctx, R_GCRA, gcra | trigger_bits(level) << GCRA_H_RFT_SHIFT);
+	ctx->fifo.host_rx_trigger = level;
+	ctx->fifo.retunes++;
+}
+
+/* Pass staged Rx data to the sink, keeping whatever it doesn't accept */
+static void step_rx_flush(struct uuart *ctx)
+{
+	size_t n;
+
+	if (!ctx->rx_len)
+		return;
+
+	n = ctx->ops->rx(ctx->priv, &ctx->rx_buf[ctx->rx_off], ctx->rx_len);
+	ctx->rx_off += n;
+	ctx->rx_len -= n;
+}
+
+/* Account for the @len bytes a step drained into rx_buf and offer them on */
+static void step_rx_done(struct uuart *ctx, size_t len, struct uuart_step *step)
+{
+	ctx->rx_off = 0;
+	ctx->rx_len = len;
+	ctx->rx_ns = now_ns();
+	step->rxd = len;
+	fifo_record_rx(ctx, len);
+
+	step_rx_flush(ctx);
+}
+
+/*
+ * Tx is held while the host deasserts RTS or DTR, which we see as MSR[CTS]
+ * and MSR[DSR].
+ */
+static bool step_tx_held(struct uuart *ctx)
+{
+	uint8_t msr = readb(ctx, R_MSR);
+	bool held = (msr & (MSR_CTS | MSR_DSR)) != (MSR_CTS | MSR_DSR);
+
+	if (held == ctx->tx_held)
+		return held;
+
+	ctx->tx_held = held;
+	if (held) {
+		ctx->tx_held_since = now_ns();
+		ctx->flow.tx_holds++;
+	} else {
+		ctx->flow.tx_held_ns += now_ns() - ctx->tx_held_since;
+	}
+
+	return held;
+}
+
+/*
+ * Corking holds Tx back in tx_buf rather than in the FIFO: the host can't be
+ * kept from seeing what is in there, and GCRA[DIS_H_TX_DISCARD] only controls
+ * whether the host's Tx to us is thrown away.
+ */
+static void tx_cork(struct uuart *ctx)
+{
+	ctx->corked = true;
+	ctx->corked_since = now_ns();
+}
+
+/* Account for a held burst of @n bytes going out back to back */
+static void tx_uncork(struct uuart *ctx, size_t n, bool timeout)
+{
+	uint64_t latency;
+
+	ctx->corked = false;
+	latency = now_ns() - ctx->corked_since;
+
+	ctx->cork.bursts++;
+	ctx->cork.bytes += n;
+	if (n > ctx->cork.max_burst)
+		ctx->cork.max_burst = n;
+	if (timeout)
+		ctx->cork.timeouts++;
+	ctx->cork.latency_total_ns += latency;
+	if (latency > ctx->cork.latency_max_ns)
+		ctx->cork.latency_max_ns = latency;
+}
+
+/* Top up the bucket for the time since it last was, to at most tx_burst */
+static void pace_refill(struct uuart *ctx, uint64_t now)
+{
+	uint64_t depth = ctx->cfg.tx_burst * PACE_SCALE;
+	uint64_t dt = now - ctx->pace_refilled;
+
+	/*
+	 * Pacing starts on a full bucket. Otherwise compare against the room
+	 * left before adding, as the sum could overflow with a deep enough one.
+	 */
+	if (!ctx->pace_refilled ||
+	    dt > (depth - ctx->pace_credit) / ctx->cfg.tx_rate)
+		ctx->pace_credit = depth;
+	else
+		ctx->pace_credit += dt * ctx->cfg.tx_rate;
+
+	ctx->pace_refilled = now;
+}
+
+/*
+ * How many of @want bytes the bucket lets out now. One clock read a step with
+ * Tx pending keeps it exact: the bucket may have filled and spilled since
+ * the last one.
+ */
+static size_t pace_room(struct uuart *ctx, size_t want)
+{
+	uint64_t now = now_ns();
+	uint64_t avail;
+
+	pace_refill(ctx, now);
+
+	avail = ctx->pace_credit / PACE_SCALE;
+	if (!avail) {
+		if (!ctx->pace_due) {
+			ctx->pace_due = now + (PACE_SCALE - ctx->pace_credit +
+					       ctx->cfg.tx_rate - 1) /
+					      ctx->cfg.tx_rate;
+			ctx->pace.waits++;
+			if (!ctx->pace_since)
+				ctx->pace_since = now;
+		}
+		return 0;
+	}
+
+	if (ctx->pace_due) {
+		uuart_hist_record(&ctx->pace.jitter, now > ctx->pace_due ?
+						     now - ctx->pace_due : 0);
+		ctx->pace_due = 0;
+	}
+
+	return avail < want ? avail : want;
+}
+
+/* Spend the bucket on the @n bytes written at the last refill */
+static void pace_spend(struct uuart *ctx, size_t n)
+{
+	ctx->pace_credit -= n * PACE_SCALE;
+	ctx->pace.bytes += n;
+
+	if (ctx->pace_since) {
+		ctx->pace.rate_bytes += n;
+		ctx->pace.rate_ns = ctx->pace_refilled - ctx->pace_since;
+	}
+}
+
+/* Start pacing over, on a full bucket and with fresh statistics */
+static void pace_reset(struct uuart *ctx)
+{
+	ctx->pace_credit = 0;
+	ctx->pace_refilled = 0;
+	ctx->pace_since = 0;
+	ctx->pace_due = 0;
+	memset(&ctx->pace, 0, sizeof(ctx->pace));
+	uuart_hist_init(&ctx->pace.jitter);
+}
+
+/* Top tx_buf up to @want bytes from the source, moving what is left forward */
+static void tx_fill(struct uuart *ctx, size_t want)
+{
+	if (ctx->tx_off) {
+		memmove(ctx->tx_buf, ctx->tx_buf + ctx->tx_off, ctx->tx_len);
+		ctx->tx_off = 0;
+	}
+
+	ctx->tx_len += ctx->ops->tx(ctx->priv, ctx->tx_buf + ctx->tx_len,
+				    want - ctx->tx_len);
+}
+
+/*
+ * Work out how many bytes of tx_buf to write to THR now, refilling it from the
+ * source first. While corked, hold them back until cork_burst have collected
+ * or cork_max_ns has passed, then write them all at once.
+ */
+static size_t step_tx_room(struct uuart *ctx, uint8_t lsr)
+{
+	size_t room;
+
+	if (ctx->cfg.cork_burst) {
+		if (ctx->tx_len < ctx->cfg.cork_burst)
+			tx_fill(ctx, ctx->cfg.cork_burst);
+		if (ctx->tx_len && !ctx->corked)
+			tx_cork(ctx);
+		if (ctx->corked && ctx->tx_len < ctx->cfg.cork_burst &&
+		    now_ns() - ctx->corked_since < ctx->cfg.cork_max_ns)
+			return 0;
+	} else if (!ctx->tx_len) {
+		ctx->tx_off = 0;
+		ctx->tx_len = ctx->ops->tx(ctx->priv, ctx->tx_buf,
+					   sizeof(ctx->tx_buf));
+	}
+
+	room = lsr & LSR_THRE ? ctx->tx_room : 0;
+
+	if (!ctx->tx_len || !room)
+		return 0;
+
+	if (ctx->tx_len < room)
+		room = ctx->tx_len;
+
+	/*
+	 * Only consult the bucket for bytes about to go out. While the host
+	 * holds Tx, that is what Tx waits on rather than the bucket.
+	 */
+	if (ctx->cfg.flow_control && step_tx_held(ctx)) {
+		ctx->pace_due = 0;
+		return 0;
+	}
+
+	if (ctx->cfg.tx_rate)
+		room = pace_room(ctx, room);
+
+	return room;
+}
+
+/* Account for the @n bytes of tx_buf a step wrote to THR */
+static void step_tx_done(struct uuart *ctx, size_t n, struct uuart_step *step)
+{
+	ctx->tx_off += n;
+	ctx->tx_len -= n;
+	step->txd = n;
+
+	if (ctx->cfg.tx_rate)
+		pace_spend(ctx, n);
+
+	fifo_record_tx(ctx, n);
+
+	/* A burst short of cork_burst was let go by cork_max_ns */
+	if (ctx->corked)
+		tx_uncork(ctx, n, ctx->tx_len + n < ctx->cfg.cork_burst);
+}
+
+/* Come back no later than @due, a corked burst or paced byte going out */
+static void wake_by(struct timespec *next, uint64_t due)
+{
+	if ((uint64_t)next->tv_sec * 1000000000ULL + next->tv_nsec <= due)
+		return;
+
+	next->tv_sec = due / 1000000000ULL;
+	next->tv_nsec = due % 1000000000ULL;
+}
+
+uint64_t uuart_rx_ns(const struct uuart *ctx)
+{
+	return ctx->rx_ns;
+}
+
+void uuart_throttle(struct uuart *ctx, bool throttle)
+{
+	uint8_t mcr;
+
+	if (!ctx->cfg.flow_control || throttle == ctx->throttled)
+		return;
+
+	mcr = readb(ctx, R_MCR);
+	if (throttle)
+		mcr &= ~(MCR_DTR | MCR_RTS);
+	else
+		mcr |= MCR_DTR | MCR_RTS;
+	writeb(ctx, R_MCR, mcr);
+
+	ctx->throttled = throttle;
+	if (throttle) {
+		ctx->throttled_since = now_ns();
+		ctx->flow.throttles++;
+	} else {
+		ctx->flow.throttled_ns += now_ns() - ctx->throttled_since;
+	}
+}
+
+void uuart_flow_stats(const struct uuart *ctx, struct uuart_flow_stats *stats)
+{
+	uint64_t now = now_ns();
+
+	*stats = ctx->flow;
+
+	/* Account for a throttle or hold still in progress */
+	if (ctx->throttled)
+		stats->throttled_ns += now - ctx->throttled_since;
+	if (ctx->tx_held)
+		stats->tx_held_ns += now - ctx->tx_held_since;
+}
+
+void uuart_cork_stats(const struct uuart *ctx, struct uuart_cork_stats *stats)
+{
+	*stats = ctx->cork;
+}
+
+void uuart_pace_stats(const struct uuart *ctx, struct uuart_pace_stats *stats)
+{
+	*stats = ctx->pace;
+}
+
+void uuart_fifo_stats(const struct uuart *ctx, struct uuart_fifo_stats *stats)
+{
+	*stats = ctx->fifo;
+}
+
+double uuart_fifo_irqs_per_byte(const uint64_t *hist, unsigned int level)
+{
+	uint64_t irqs = 0;
+	uint64_t bytes = 0;
+
+	if (!level)
+		level = 1;
+
+	for (size_t b = 1; b <= UUART_FIFO_SIZE; b++) {
+		irqs += hist[b] * ((b + level - 1) / level);
+		bytes += hist[b] * b;
+	}
+
+	return bytes ? (double)irqs / bytes : 0;
+}
+
+/* Point IER's @bit back at the startup state, or clear it while we poll */
+static uint8_t ier_for(const struct uuart *ctx, uint8_t ier, uint8_t bit,
+		       bool polled)
+{
+	if (polled)
+		return ier & ~bit;
+
+	return (ier & ~bit) | (ctx->saved.ier & bit);
+}
+
+/*
+ * Called between steps, so no burst is half written: a cork whose size
+ * changes is released first, as is a throttle or hold that flow control was
+ * keeping, a change of pace starts over on a full bucket, and the FIFO
+ * trigger registers are rewritten without the reset bits.
+ */
+int uuart_reconfigure(struct uuart *ctx, const struct uuart_config *cfg)
+{
+	struct uuart_config new = *cfg;
+	uint8_t gcra;
+	uint8_t ier;
+	int rc;
+
+	if (!ctx->saved.valid)
+		return -EINVAL;
+
+	rc = check_config(ctx, &new);
+	if (rc < 0)
+		return rc;
+
+	new.assume_dtr = ctx->cfg.assume_dtr;
+	new.assume_enabled = ctx->cfg.assume_enabled;
+	new.assume_fifos = ctx->cfg.assume_fifos;
+	if (new.cork_burst > ctx->tx_room)
+		new.cork_burst = ctx->tx_room;
+
+	if (!new.tx_burst)
+		new.tx_burst = ctx->tx_room;
+
+	/* Whatever is held goes out as plain Tx */
+	if (!new.cork_burst)
+		ctx->corked = false;
+
+	if (new.tx_rate != ctx->cfg.tx_rate ||
+	    new.tx_burst != ctx->cfg.tx_burst)
+		pace_reset(ctx);
+
+	if (ctx->cfg.flow_control && !new.flow_control) {
+		uuart_throttle(ctx, false);
+		if (ctx->tx_held) {
+			ctx->flow.tx_held_ns += now_ns() - ctx->tx_held_since;
+			ctx->tx_held = false;
+		}
+	}
+
+	/* A direction we stop driving goes back to the kernel driver */
+	if (new.no_rx != ctx->cfg.no_rx || new.no_tx != ctx->cfg.no_tx) {
+		ier = readb(ctx, R_IER);
+		ier = ier_for(ctx, ier, IER_ERBFI, !new.no_rx);
+		ier = ier_for(ctx, ier, IER_ETBEI, !new.no_tx);
+		writeb(ctx, R_IER, ier);
+	}
+
+	/* Only a changed setting overrides what fifo_auto has picked */
+	if (new.rx_trigger != ctx->cfg.rx_trigger &&
+	    ctx->tx_room == UUART_FIFO_SIZE) {
+		writeb(ctx, R_FCR, FCR_FIFOE |
+				   trigger_bits(new.rx_trigger) << FCR_RFT_SHIFT);
+		ctx->fifo.rx_trigger = new.rx_trigger;
+	}
+
+	if (ctx->vuart && (new.host_rx_trigger != ctx->cfg.host_rx_trigger ||
+			   new.rx_timeout != ctx->cfg.rx_timeout)) {
+		gcra = readb(ctx, R_GCRA) & ~(GCRA_H_RFT | GCRA_S_TIMEOUT);
+		gcra |= trigger_bits(new.host_rx_trigger) << GCRA_H_RFT_SHIFT;
+		gcra |= new.rx_timeout << GCRA_S_TIMEOUT_SHIFT;
+		writeb(ctx, R_GCRA, gcra);
+		ctx->fifo.host_rx_trigger = new.host_rx_trigger;
+	}
+
+	if (new.fifo_auto && !ctx->cfg.fifo_auto) {
+		memset(&ctx->rx_window, 0, sizeof(ctx->rx_window));
+		memset(&ctx->tx_window, 0, sizeof(ctx->tx_window));
+	}
+
+	ctx->cfg = new;
+	ctx->poll_ns = ctx->cfg.poll_min_ns;
+	ctx->step = pick_step(ctx);
+
+	return 0;
+}
+
+static void step_begin(struct uuart *ctx, uint8_t lsr, struct uuart_step *step)
+{
+	bool stalled;
+
+	stalled = !(lsr & (LSR_DR | LSR_THRE));
+	step->lsr = lsr;
+	step->stalled = stalled;
+	step->stall_changed = stalled != ctx->stalled;
+	ctx->stalled = stalled;
+
+	step->txd = 0;
+	step->rxd = 0;
+}
+
+static int step_end(struct uuart *ctx, struct uuart_step *step,
+		    struct timespec *next)
+{
+	int rc;
+
+	step->rx_pending = ctx->rx_len;
+	step->tx_pending = ctx->tx_len;
+
+	rc = next_wake(ctx, step->rxd || step->txd, next);
+	if (rc < 0)
+		return rc;
+
+	if (next && ctx->corked)
+		wake_by(next, ctx->corked_since + ctx->cfg.cork_max_ns);
+	if (next && ctx->pace_due)
+		wake_by(next, ctx->pace_due);
+
+	return step->rxd + step->txd;
+}
+
+#define VARIANT(fn)		fn##_mmio8_s0
+#define io_readb		mmio8_s0_readb
+#define io_writeb		mmio8_s0_writeb
+#define io_readb_relaxed	mmio8_s0_readb_relaxed
+#define io_writeb_relaxed	mmio8_s0_writeb_relaxed
+#define io_barrier		mmio_barrier
+#include "step.h"
+#undef VARIANT
+#undef io_readb
+#undef io_writeb
+#undef io_readb_relaxed
+#undef io_writeb_relaxed
+#undef io_barrier
+
+#define VARIANT(fn)		fn##_mmio8_s2
+#define io_readb		mmio8_s2_readb
+#define io_writeb		mmio8_s2_writeb
+#define io_readb_relaxed	mmio8_s2_readb_relaxed
+#define io_writeb_relaxed	mmio8_s2_writeb_relaxed
+#define io_barrier		mmio_barrier
+#include "step.h"
+#undef VARIANT
+#undef io_readb
+#undef io_writeb
+#undef io_readb_relaxed
+#undef io_writeb_relaxed
+#undef io_barrier
+
+#define VARIANT(fn)		fn##_mmio32_s2
+#define io_readb		mmio32_s2_readb
+#define io_writeb		mmio32_s2_writeb
+#define io_readb_relaxed	mmio32_s2_readb_relaxed
+#define io_writeb_relaxed	mmio32_s2_writeb_relaxed
+#define io_barrier		mmio_barrier
+#include "step.h"
+#undef VARIANT
+#undef io_readb
+#undef io_writeb
+#undef io_readb_relaxed
+#undef io_writeb_relaxed
+#undef io_barrier
+
+#define VARIANT(fn)		fn##_sim
+#define io_readb		sim_io_readb
+#define io_writeb		sim_io_writeb
+#define io_readb_relaxed	sim_io_readb
+#define io_writeb_relaxed	sim_io_writeb
+#define io_barrier		sim_barrier
+#include "step.h"
+#undef VARIANT
+#undef io_readb
+#undef io_writeb
+#undef io_readb_relaxed
+#undef io_writeb_relaxed
+#undef io_barrier
+
+int uuart_step(struct uuart *ctx, struct uuart_step *step,
+	       struct timespec *next)
+{
+	return ctx->step(ctx, step, next);
+}
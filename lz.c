@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_MIN_MATCH		4
+/* The format ends every block with at least this many literals */
+#define LZ_LAST_LITERALS	5
+/* ...and starts no match closer than this to the end */
+#define LZ_MF_LIMIT		12
+#define LZ_MAX_OFFSET		65535
+#define LZ_HASH_BITS		12
+/* Misses before each step through incompressible data grows by one */
+#define LZ_SKIP_TRIGGER		6
+
+static uint32_t read32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+
+	return val;
+}
+
+static uint32_t hash(uint32_t val)
+{
+	return (val * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* Write a length continuation, returning -1 if it doesn't fit */
+static int put_len(uint8_t *dst, size_t *op, size_t cap, size_t len)
+{
+	for (; len >= 255; len -= 255) {
+		if (*op == cap)
+			return -1;
+		dst[(*op)++] = 255;
+	}
+
+	if (*op == cap)
+		return -1;
+	dst[(*op)++] = len;
+
+	return 0;
+}
+
+/*
+ * Emit the literals from @lit and, unless @mlen is zero for the last sequence,
+ * a match of @mlen bytes @off back.
+ */
+static int put_seq(uint8_t *dst, size_t *op, size_t cap, const uint8_t *lit,
+		   size_t nlit, size_t off, size_t mlen)
+{
+	size_t mcode = mlen ? mlen - LZ_MIN_MATCH : 0;
+	uint8_t token;
+
+	token = (nlit < 15 ? nlit : 15) << 4 | (mcode < 15 ? mcode : 15);
+	if (*op == cap)
+		return -1;
+	dst[(*op)++] = token;
+
+	if (nlit >= 15 && put_len(dst, op, cap, nlit - 15))
+		return -1;
+
+	if (cap - *op < nlit)
+		return -1;
+	memcpy(&dst[*op], lit, nlit);
+	*op += nlit;
+
+	if (!mlen)
+		return 0;
+
+	if (cap - *op < 2)
+		return -1;
+	dst[(*op)++] = off;
+	dst[(*op)++] = off >> 8;
+
+	if (mcode >= 15 && put_len(dst, op, cap, mcode - 15))
+		return -1;
+
+	return 0;
+}
+
+size_t uuart_lz_compress(const void *src, size_t n, void *dst, size_t cap)
+{
+	/* Positions plus one, so zero means empty */
+	uint32_t table[1 << LZ_HASH_BITS] = {0};
+	const uint8_t *s = src;
+	size_t ip = 0, anchor = 0, op = 0;
+	unsigned int misses = 0;
+	size_t ref, len;
+	uint32_t h;
+
+	while (ip + LZ_MF_LIMIT < n) {
+		h = hash(read32(&s[ip]));
+		ref = table[h];
+		table[h] = ip + 1;
+
+		if (!ref || ip - (ref - 1) > LZ_MAX_OFFSET ||
+		    read32(&s[ref - 1]) != read32(&s[ip])) {
+			ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+			continue;
+		}
+
+		ref--;
+		len = LZ_MIN_MATCH;
+		while (ip + len < n - LZ_LAST_LITERALS &&
+		       s[ref + len] == s[ip + len])
+			len++;
+
+		if (put_seq(dst, &op, cap, &s[anchor], ip - anchor, ip - ref,
+			    len))
+			return 0;
+
+		ip += len;
+		anchor = ip;
+		misses = 0;
+	}
+
+	if (put_seq(dst, &op, cap, &s[anchor], n - anchor, 0, 0))
+		return 0;
+
+	return op;
+}
+
+static int get_len(const uint8_t *src, size_t *ip, size_t n, size_t *len)
+{
+	uint8_t b;
+
+	do {
+		if (*ip == n)
+			return -1;
+		b = src[(*ip)++];
+		*len += b;
+	} while (b == 255);
+
+	return 0;
+}
+
+ssize_t uuart_lz_decompress(const void *src, size_t n, void *dst, size_t cap)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	size_t ip = 0, op = 0;
+	size_t nlit, mlen, off;
+	uint8_t token;
+
+	while (ip < n) {
+		token = s[ip++];
+
+		nlit = token >> 4;
+		if (nlit == 15 && get_len(s, &ip, n, &nlit))
+			return -EINVAL;
+		if (nlit > n - ip || nlit > cap - op)
+			return -EINVAL;
+		memcpy(&d[op], &s[ip], nlit);
+		ip += nlit;
+		op += nlit;
+
+		/* The last sequence has no match */
+		if (ip == n)
+			break;
+
+		if (n - ip < 2)
+			return -EINVAL;
+		off = s[ip] | s[ip + 1] << 8;
+		ip += 2;
+		if (!off || off > op)
+			return -EINVAL;
+
+		mlen = token & 15;
+		if (mlen == 15 && get_len(s, &ip, n, &mlen))
+			return -EINVAL;
+		mlen += LZ_MIN_MATCH;
+		if (mlen > cap - op)
+			return -EINVAL;
+
+		/* Byte by byte, as a match may overlap its own output */
+		for (; mlen; mlen--, op++)
+			d[op] = d[op - off];
+	}
+
+	return op;
+}
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_LZ_H
+#define UUART_LZ_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * A small LZ77 block compressor producing the LZ4 block format, so blocks can
+ * also be read with liblz4's LZ4_decompress_safe(). It trades ratio for speed
+ * with a single-entry hash table and skips ahead through data that doesn't
+ * compress, which keeps it well above line rate on a BMC core.
+ */
+
+/* The largest output @n bytes of input can compress to */
+#define UUART_LZ_BOUND(n)	((n) + (n) / 255 + 16)
+
+/*
+ * Compress @n bytes from @src into @dst, which has room for @cap bytes.
+ * Returns the compressed length, or zero if it doesn't fit in @cap.
+ */
+size_t uuart_lz_compress(const void *src, size_t n, void *dst, size_t cap);
+
+/*
+ * Decompress the block of @n bytes at @src into @dst, which has room for @cap
+ * bytes. Returns the decompressed length, or -EINVAL if the block is corrupt
+ * or doesn't fit.
+ */
+ssize_t uuart_lz_decompress(const void *src, size_t n, void *dst, size_t cap);
+
+#endif
@@ -0,0 +1,547 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mux.h"
+
+#define MUX_SYNC		0xa5
+#define MUX_HDR_LEN		4
+#define MUX_CRC_LEN		2
+#define MUX_OFF_LEN		2
+#define MUX_FRAME_MAX		(MUX_HDR_LEN + UUART_MUX_MAX_PAYLOAD + MUX_CRC_LEN)
+#define MUX_DATA_MAX		(UUART_MUX_MAX_PAYLOAD - MUX_OFF_LEN)
+/* How long a sender waits without credit before asking for the total again */
+#define MUX_PROBE_NS		100000000ULL
+#define MUX_TX_RING		4096
+#define MUX_MARKS		64
+
+enum { FRAME_DATA, FRAME_CREDIT };
+
+struct ring {
+	uint8_t *buf;
+	size_t size;
+	/* Free-running byte counters */
+	uint64_t head;
+	uint64_t tail;
+};
+
+/* When the bytes up to @end were queued, for latency accounting */
+struct mux_mark {
+	uint64_t end;
+	uint64_t ns;
+};
+
+struct mux_channel {
+	struct uuart_mux_channel_config cfg;
+	struct ring tx;
+	struct ring rx;
+	struct mux_mark marks[MUX_MARKS];
+	unsigned int mark_head;
+	unsigned int mark_tail;
+	/* Bytes the peer will still accept, and its last running total */
+	size_t credit;
+	uint16_t peer_credited;
+	/* Bytes consumed locally but not yet credited back, and the total */
+	size_t owed;
+	uint16_t credited;
+	/* The peer asked for the total, with an empty DATA frame */
+	bool credit_due;
+	/* The offset the next DATA frame from the peer should start at */
+	uint16_t rx_off;
+	uint64_t stall_since;
+	uint64_t probe_ns;
+	struct uuart_mux_stats stats;
+};
+
+struct uuart_mux {
+	struct mux_channel chans[UUART_MUX_MAX_CHANNELS];
+	size_t n;
+	size_t window;
+	uint64_t errors;
+
+	/* The frame being fed to the link */
+	uint8_t txf[MUX_FRAME_MAX];
+	size_t txf_off;
+	size_t txf_len;
+
+	/* The frame being assembled from the link */
+	uint8_t rxf[MUX_FRAME_MAX];
+	size_t rxf_len;
+};
+
+static uint16_t crc16_table[256];
+static pthread_once_t crc16_once = PTHREAD_ONCE_INIT;
+
+static void crc16_init(void)
+{
+	for (unsigned int i = 0; i < 256; i++) {
+		uint16_t crc = i << 8;
+
+		for (int j = 0; j < 8; j++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+
+		crc16_table[i] = crc;
+	}
+}
+
+static uint16_t crc16(const uint8_t *buf, size_t len)
+{
+	uint16_t crc = 0xffff;
+
+	while (len--)
+		crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *buf++];
+
+	return crc;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t ring_used(const struct ring *r)
+{
+	return r->head - r->tail;
+}
+
+static size_t ring_space(const struct ring *r)
+{
+	return r->size - ring_used(r);
+}
+
+static size_t ring_put(struct ring *r, const uint8_t *buf, size_t len)
+{
+	size_t space = ring_space(r);
+
+	if (len > space)
+		len = space;
+
+	for (size_t i = 0; i < len; i++)
+		r->buf[(r->head + i) % r->size] = buf[i];
+
+	r->head += len;
+
+	return len;
+}
+
+static size_t ring_get(struct ring *r, uint8_t *buf, size_t len)
+{
+	size_t used = ring_used(r);
+
+	if (len > used)
+		len = used;
+
+	for (size_t i = 0; i < len; i++)
+		buf[i] = r->buf[(r->tail + i) % r->size];
+
+	r->tail += len;
+
+	return len;
+}
+
+int uuart_mux_new(struct uuart_mux **muxp,
+		  const struct uuart_mux_channel_config *chans, size_t n,
+		  size_t window)
+{
+	struct uuart_mux *mux;
+
+	if (!n || n > UUART_MUX_MAX_CHANNELS || !window || window > 0xffff)
+		return -EINVAL;
+
+	pthread_once(&crc16_once, crc16_init);
+
+	mux = calloc(1, sizeof(*mux));
+	if (!mux)
+		return -errno;
+
+	mux->n = n;
+	mux->window = window;
+
+	for (size_t i = 0; i < n; i++) {
+		struct mux_channel *ch = &mux->chans[i];
+
+		ch->cfg = chans[i];
+		if (!ch->cfg.max_frame || ch->cfg.max_frame > MUX_DATA_MAX)
+			ch->cfg.max_frame = MUX_DATA_MAX;
+
+		ch->cfg.name = strdup(chans[i].name);
+		ch->tx.size = MUX_TX_RING;
+		ch->tx.buf = malloc(ch->tx.size);
+		ch->rx.size = window;
+		ch->rx.buf = malloc(ch->rx.size);
+		if (!ch->cfg.name || !ch->tx.buf || !ch->rx.buf) {
+			mux->n = i + 1;
+			uuart_mux_free(mux);
+			return -ENOMEM;
+		}
+
+		ch->credit = window;
+	}
+
+	*muxp = mux;
+
+	return 0;
+}
+
+void uuart_mux_free(struct uuart_mux *mux)
+{
+	for (size_t i = 0; i < mux->n; i++) {
+		free((char *)mux->chans[i].cfg.name);
+		free(mux->chans[i].tx.buf);
+		free(mux->chans[i].rx.buf);
+	}
+
+	free(mux);
+}
+
+size_t uuart_mux_channels(const struct uuart_mux *mux)
+{
+	return mux->n;
+}
+
+const char *uuart_mux_channel_name(const struct uuart_mux *mux, size_t id)
+{
+	return id < mux->n ? mux->chans[id].cfg.name : NULL;
+}
+
+ssize_t uuart_mux_send(struct uuart_mux *mux, size_t id, const void *buf,
+		       size_t len)
+{
+	struct mux_channel *ch;
+	struct mux_mark *mark;
+	size_t n;
+
+	if (id >= mux->n)
+		return -EINVAL;
+
+	ch = &mux->chans[id];
+	n = ring_put(&ch->tx, buf, len);
+	if (!n)
+		return 0;
+
+	/* Out of marks: fold the new bytes into the most recent one */
+	if (ch->mark_head - ch->mark_tail == MUX_MARKS) {
+		mark = &ch->marks[(ch->mark_head - 1) % MUX_MARKS];
+	} else {
+		mark = &ch->marks[ch->mark_head++ % MUX_MARKS];
+		mark->ns = now_ns();
+	}
+	mark->end = ch->tx.head;
+
+	return n;
+}
+
+ssize_t uuart_mux_recv(struct uuart_mux *mux, size_t id, void *buf,
+		       size_t len)
+{
+	struct mux_channel *ch;
+	size_t n;
+
+	if (id >= mux->n)
+		return -EINVAL;
+
+	ch = &mux->chans[id];
+	n = ring_get(&ch->rx, buf, len);
+	ch->owed += n;
+
+	return n;
+}
+
+size_t uuart_mux_tx_pending(const struct uuart_mux *mux, size_t id)
+{
+	return id < mux->n ? ring_used(&mux->chans[id].tx) : 0;
+}
+
+size_t uuart_mux_tx_space(const struct uuart_mux *mux, size_t id)
+{
+	return id < mux->n ? ring_space(&mux->chans[id].tx) : 0;
+}
+
+size_t uuart_mux_rx_pending(const struct uuart_mux *mux, size_t id)
+{
+	return id < mux->n ? ring_used(&mux->chans[id].rx) : 0;
+}
+
+static void frame_seal(struct uuart_mux *mux, uint8_t type, uint8_t chan,
+		       size_t len)
+{
+	uint16_t crc;
+
+	mux->txf[0] = MUX_SYNC;
+	mux->txf[1] = type;
+	mux->txf[2] = chan;
+	mux->txf[3] = len;
+	crc = crc16(&mux->txf[1], MUX_HDR_LEN - 1 + len);
+	mux->txf[MUX_HDR_LEN + len] = crc >> 8;
+	mux->txf[MUX_HDR_LEN + len + 1] = crc & 0xff;
+
+	mux->txf_off = 0;
+	mux->txf_len = MUX_HDR_LEN + len + MUX_CRC_LEN;
+}
+
+static void frame_credit(struct uuart_mux *mux, size_t id)
+{
+	struct mux_channel *ch = &mux->chans[id];
+
+	ch->credited += ch->owed;
+	ch->owed = 0;
+	ch->credit_due = false;
+	mux->txf[MUX_HDR_LEN] = ch->credited >> 8;
+	mux->txf[MUX_HDR_LEN + 1] = ch->credited & 0xff;
+
+	frame_seal(mux, FRAME_CREDIT, id, 2);
+}
+
+/* Start a DATA frame with the offset of the channel's next byte */
+static void frame_offset(struct uuart_mux *mux, size_t id)
+{
+	uint64_t off = mux->chans[id].tx.tail;
+
+	mux->txf[MUX_HDR_LEN] = (off >> 8) & 0xff;
+	mux->txf[MUX_HDR_LEN + 1] = off & 0xff;
+}
+
+/* An empty DATA frame, which the peer answers with its running total */
+static void frame_probe(struct uuart_mux *mux, size_t id)
+{
+	frame_offset(mux, id);
+	frame_seal(mux, FRAME_DATA, id, MUX_OFF_LEN);
+}
+
+static void frame_data(struct uuart_mux *mux, size_t id)
+{
+	struct mux_channel *ch = &mux->chans[id];
+	uint64_t now = now_ns();
+	uint64_t latency;
+	size_t len;
+
+	len = ring_used(&ch->tx);
+	if (len > ch->credit)
+		len = ch->credit;
+	if (len > ch->cfg.max_frame)
+		len = ch->cfg.max_frame;
+
+	frame_offset(mux, id);
+	ring_get(&ch->tx, &mux->txf[MUX_HDR_LEN + MUX_OFF_LEN], len);
+	ch->credit -= len;
+
+	frame_seal(mux, FRAME_DATA, id, MUX_OFF_LEN + len);
+
+	ch->stats.tx_bytes += len;
+	ch->stats.tx_frames++;
+
+	/* The oldest outstanding mark covers the first byte of the frame */
+	latency = now - ch->marks[ch->mark_tail % MUX_MARKS].ns;
+	ch->stats.latency_total_ns += latency;
+	ch->stats.latency_samples++;
+	if (latency > ch->stats.latency_max_ns)
+		ch->stats.latency_max_ns = latency;
+
+	while (ch->mark_tail != ch->mark_head &&
+	       ch->marks[ch->mark_tail % MUX_MARKS].end <= ch->tx.tail)
+		ch->mark_tail++;
+}
+
+/*
+ * Pick the next frame: credit returns first as they unblock the peer, then
+ * data from the highest priority channel that has both data and credit. A
+ * channel that has waited MUX_PROBE_NS for credit probes for it instead.
+ * Channels are only ever preempted at frame boundaries, so max_frame bounds
+ * how long interactive traffic waits behind bulk.
+ */
+static bool schedule(struct uuart_mux *mux)
+{
+	struct mux_channel *best = NULL;
+	bool idle = true;
+	uint64_t now = 0;
+
+	for (size_t i = 0; i < mux->n; i++) {
+		if (ring_used(&mux->chans[i].tx))
+			idle = false;
+	}
+
+	for (size_t i = 0; i < mux->n; i++) {
+		struct mux_channel *ch = &mux->chans[i];
+
+		if (ch->owed >= mux->window / 4 || (ch->owed && idle) ||
+		    ch->credit_due) {
+			frame_credit(mux, i);
+			return true;
+		}
+	}
+
+	for (size_t i = 0; i < mux->n; i++) {
+		struct mux_channel *ch = &mux->chans[i];
+
+		if (!ring_used(&ch->tx))
+			continue;
+
+		if (!ch->credit) {
+			if (!now)
+				now = now_ns();
+			if (!ch->stall_since) {
+				ch->stall_since = now;
+				ch->probe_ns = now;
+			} else if (now - ch->probe_ns >= MUX_PROBE_NS) {
+				ch->probe_ns = now;
+				frame_probe(mux, i);
+				return true;
+			}
+			continue;
+		}
+
+		if (!best || ch->cfg.prio < best->cfg.prio)
+			best = ch;
+	}
+
+	if (!best)
+		return false;
+
+	frame_data(mux, best - mux->chans);
+
+	return true;
+}
+
+size_t uuart_mux_link_tx(void *priv, uint8_t *buf, size_t len)
+{
+	struct uuart_mux *mux = priv;
+	size_t filled = 0;
+	size_t n;
+
+	while (filled < len) {
+		if (mux->txf_off == mux->txf_len && !schedule(mux))
+			break;
+
+		n = mux->txf_len - mux->txf_off;
+		if (n > len - filled)
+			n = len - filled;
+
+		memcpy(&buf[filled], &mux->txf[mux->txf_off], n);
+		mux->txf_off += n;
+		filled += n;
+	}
+
+	return filled;
+}
+
+static void deliver(struct uuart_mux *mux)
+{
+	uint8_t type = mux->rxf[1];
+	uint8_t chan = mux->rxf[2];
+	size_t len = mux->rxf[3];
+	const uint8_t *payload = &mux->rxf[MUX_HDR_LEN];
+	struct mux_channel *ch;
+	uint16_t total, off, gap;
+
+	if (chan >= mux->n) {
+		mux->errors++;
+		return;
+	}
+
+	ch = &mux->chans[chan];
+
+	if (type == FRAME_CREDIT && len == 2) {
+		/* Totals wrap, but never move by more than the window */
+		total = (payload[0] << 8) | payload[1];
+		ch->credit += (uint16_t)(total - ch->peer_credited);
+		ch->peer_credited = total;
+		if (ch->credit > mux->window)
+			ch->credit = mux->window;
+		if (ch->stall_since) {
+			ch->stats.stalled_ns += now_ns() - ch->stall_since;
+			ch->stall_since = 0;
+		}
+	} else if (type == FRAME_DATA && len >= MUX_OFF_LEN) {
+		/* Bytes lost with a corrupt frame took credit: grant it back */
+		off = (payload[0] << 8) | payload[1];
+		gap = off - ch->rx_off;
+		if (gap && gap <= mux->window)
+			ch->owed += gap;
+		if (gap)
+			mux->errors++;
+
+		payload += MUX_OFF_LEN;
+		len -= MUX_OFF_LEN;
+		ch->rx_off = off + len;
+		if (!len) {
+			ch->credit_due = true;
+			return;
+		}
+
+		/* A well-behaved peer never exceeds its credit */
+		if (ring_put(&ch->rx, payload, len) != len)
+			mux->errors++;
+		ch->stats.rx_bytes += len;
+		ch->stats.rx_frames++;
+	} else {
+		mux->errors++;
+	}
+}
+
+/* Drop @skip bytes, then anything up to the next SYNC */
+static void hunt(struct uuart_mux *mux, size_t skip)
+{
+	size_t i;
+
+	for (i = skip; i < mux->rxf_len && mux->rxf[i] != MUX_SYNC; i++)
+		;
+
+	memmove(mux->rxf, &mux->rxf[i], mux->rxf_len - i);
+	mux->rxf_len -= i;
+}
+
+size_t uuart_mux_link_rx(void *priv, const uint8_t *buf, size_t len)
+{
+	struct uuart_mux *mux = priv;
+	size_t want;
+
+	for (size_t i = 0; i < len; i++) {
+		if (!mux->rxf_len && buf[i] != MUX_SYNC)
+			continue;
+
+		mux->rxf[mux->rxf_len++] = buf[i];
+
+		while (mux->rxf_len >= MUX_HDR_LEN) {
+			uint16_t crc;
+
+			want = MUX_HDR_LEN + mux->rxf[3] + MUX_CRC_LEN;
+			if (mux->rxf_len < want)
+				break;
+
+			crc = (mux->rxf[want - 2] << 8) | mux->rxf[want - 1];
+			if (crc != crc16(&mux->rxf[1], want - 1 - MUX_CRC_LEN)) {
+				mux->errors++;
+				hunt(mux, 1);
+				continue;
+			}
+
+			deliver(mux);
+			hunt(mux, want);
+		}
+	}
+
+	return len;
+}
+
+void uuart_mux_stats(const struct uuart_mux *mux, size_t id,
+		     struct uuart_mux_stats *stats)
+{
+	if (id < mux->n)
+		*stats = mux->chans[id].stats;
+}
+
+uint64_t uuart_mux_errors(const struct uuart_mux *mux)
+{
+	return mux->errors;
+}
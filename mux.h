@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_MUX_H
+#define UUART_MUX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Logical channels multiplexed over one VUART. On the wire each frame is
+ *
+ *	SYNC TYPE CHAN LEN PAYLOAD[LEN] CRC16
+ *
+ * where CRC16 is CRC-16/CCITT over TYPE through PAYLOAD, big-endian. DATA
+ * frames carry channel bytes after the 16-bit big-endian offset of the first
+ * in the channel's stream, CREDIT frames return receive window to the peer
+ * as a 16-bit big-endian running total of the bytes freed. A sender never has
+ * more bytes in flight on a channel than the peer has granted, so a slow
+ * consumer on one channel cannot block the others.
+ *
+ * Neither kind of frame is ever resent, so credit survives losing one: the
+ * receiver grants back the bytes a gap in the offsets shows were lost, and
+ * a running total makes up for any total that went missing. A sender left
+ * without credit for long sends an empty DATA frame, which the receiver
+ * answers with its total.
+ */
+
+#define UUART_MUX_MAX_CHANNELS	8
+#define UUART_MUX_MAX_PAYLOAD	255
+
+struct uuart_mux;
+
+struct uuart_mux_channel_config {
+	const char *name;
+	/* Lower values are scheduled first */
+	unsigned int prio;
+	/* Most channel bytes in a DATA frame, bounding how long others wait */
+	size_t max_frame;
+};
+
+struct uuart_mux_stats {
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	uint64_t tx_frames;
+	uint64_t rx_frames;
+	/* Time from uuart_mux_send() until the bytes were framed */
+	uint64_t latency_total_ns;
+	uint64_t latency_max_ns;
+	uint64_t latency_samples;
+	/* Time spent with data queued but no credit */
+	uint64_t stalled_ns;
+};
+
+/*
+ * Channel IDs are the indices into @chans. Both ends must agree on the
+ * channel table and @window, the per-channel receive window in bytes.
+ */
+int uuart_mux_new(struct uuart_mux **muxp,
+		  const struct uuart_mux_channel_config *chans, size_t n,
+		  size_t window);
+void uuart_mux_free(struct uuart_mux *mux);
+
+size_t uuart_mux_channels(const struct uuart_mux *mux);
+const char *uuart_mux_channel_name(const struct uuart_mux *mux, size_t id);
+
+/*
+ * Application side. uuart_mux_send() queues up to @len bytes on channel @id
+ * and returns how many were accepted. uuart_mux_recv() returns bytes received
+ * on @id, and consuming them is what returns credit to the peer.
+ */
+ssize_t uuart_mux_send(struct uuart_mux *mux, size_t id, const void *buf,
+		       size_t len);
+ssize_t uuart_mux_recv(struct uuart_mux *mux, size_t id, void *buf,
+		       size_t len);
+
+/* Bytes queued for sending, and received but not yet consumed, on @id */
+size_t uuart_mux_tx_pending(const struct uuart_mux *mux, size_t id);
+size_t uuart_mux_tx_space(const struct uuart_mux *mux, size_t id);
+size_t uuart_mux_rx_pending(const struct uuart_mux *mux, size_t id);
+
+/* Link side, matching uuart_ops.tx and uuart_ops.rx for uuart_step() */
+size_t uuart_mux_link_tx(void *mux, uint8_t *buf, size_t len);
+size_t uuart_mux_link_rx(void *mux, const uint8_t *buf, size_t len);
+
+void uuart_mux_stats(const struct uuart_mux *mux, size_t id,
+		     struct uuart_mux_stats *stats);
+
+/* Frames discarded for a bad CRC or an unknown channel, and offset gaps */
+uint64_t uuart_mux_errors(const struct uuart_mux *mux);
+
+#endif
@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "muxsock.h"
+
+#define MUXSOCK_BUF		512
+
+struct muxsock_channel {
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int listen_fd;
+	int client_fd;
+	/* Received from the mux but not yet accepted by the client */
+	uint8_t pend[MUXSOCK_BUF];
+	size_t pend_off;
+	size_t pend_len;
+};
+
+struct muxsock {
+	struct uuart_mux *mux;
+	size_t n;
+	struct muxsock_channel chans[UUART_MUX_MAX_CHANNELS];
+};
+
+static int listen_unix(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+	int rc;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd, 1)) {
+		rc = -errno;
+		close(fd);
+		return rc;
+	}
+
+	return fd;
+}
+
+int muxsock_open(struct muxsock **msp, struct uuart_mux *mux, const char *dir)
+{
+	struct muxsock *ms;
+	int rc;
+
+	ms = calloc(1, sizeof(*ms));
+	if (!ms)
+		return -errno;
+
+	ms->mux = mux;
+
+	for (size_t i = 0; i < uuart_mux_channels(mux); i++) {
+		struct muxsock_channel *ch = &ms->chans[i];
+
+		rc = snprintf(ch->path, sizeof(ch->path), "%s/%s", dir,
+			      uuart_mux_channel_name(mux, i));
+		if (rc < 0 || (size_t)rc >= sizeof(ch->path)) {
+			rc = -ENAMETOOLONG;
+			goto cleanup;
+		}
+
+		ch->client_fd = -1;
+		ch->listen_fd = listen_unix(ch->path);
+		if (ch->listen_fd < 0) {
+			rc = ch->listen_fd;
+			goto cleanup;
+		}
+
+		ms->n++;
+	}
+
+	*msp = ms;
+
+	return 0;
+
+cleanup:
+	muxsock_close(ms);
+
+	return rc;
+}
+
+void muxsock_close(struct muxsock *ms)
+{
+	for (size_t i = 0; i < ms->n; i++) {
+		struct muxsock_channel *ch = &ms->chans[i];
+
+		if (ch->client_fd >= 0)
+			close(ch->client_fd);
+		close(ch->listen_fd);
+		unlink(ch->path);
+	}
+
+	free(ms);
+}
+
+static void drop_client(struct muxsock_channel *ch)
+{
+	close(ch->client_fd);
+	ch->client_fd = -1;
+	ch->pend_len = 0;
+}
+
+static int service_client(struct muxsock *ms, size_t id, short revents)
+{
+	struct muxsock_channel *ch = &ms->chans[id];
+	uint8_t buf[MUXSOCK_BUF];
+	size_t space;
+	ssize_t n;
+
+	/* Socket to mux, bounded by the channel's Tx ring */
+	space = uuart_mux_tx_space(ms->mux, id);
+	if ((revents & (POLLIN | POLLHUP)) && space) {
+		n = read(ch->client_fd, buf, space < sizeof(buf) ? space : sizeof(buf));
+		if (n == 0 || (n < 0 && errno != EAGAIN)) {
+			drop_client(ch);
+			return 0;
+		}
+
+		if (n > 0)
+			uuart_mux_send(ms->mux, id, buf, n);
+	}
+
+	/* Mux to socket: the client only consumes what it can take */
+	if (!ch->pend_len) {
+		n = uuart_mux_recv(ms->mux, id, ch->pend, sizeof(ch->pend));
+		if (n < 0)
+			return n;
+		ch->pend_off = 0;
+		ch->pend_len = n;
+	}
+
+	if (ch->pend_len) {
+		n = send(ch->client_fd, &ch->pend[ch->pend_off], ch->pend_len,
+			 MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0 && errno != EAGAIN) {
+			drop_client(ch);
+			return 0;
+		}
+
+		if (n > 0) {
+			ch->pend_off += n;
+			ch->pend_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+int muxsock_service(struct muxsock *ms)
+{
+	struct pollfd fds[UUART_MUX_MAX_CHANNELS];
+	int rc;
+
+	for (size_t i = 0; i < ms->n; i++) {
+		struct muxsock_channel *ch = &ms->chans[i];
+
+		if (ch->client_fd < 0) {
+			fds[i].fd = ch->listen_fd;
+			fds[i].events = POLLIN;
+		} else {
+			fds[i].fd = ch->client_fd;
+			fds[i].events = POLLIN;
+			if (ch->pend_len || uuart_mux_rx_pending(ms->mux, i))
+				fds[i].events |= POLLOUT;
+		}
+	}
+
+	rc = poll(fds, ms->n, 0);
+	if (rc < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (size_t i = 0; i < ms->n; i++) {
+		struct muxsock_channel *ch = &ms->chans[i];
+
+		if (ch->client_fd < 0) {
+			if (!(fds[i].revents & POLLIN))
+				continue;
+
+			ch->client_fd = accept4(ch->listen_fd, NULL, NULL,
+						SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (ch->client_fd < 0 && errno != EAGAIN)
+				return -errno;
+
+			continue;
+		}
+
+		rc = service_client(ms, i, fds[i].revents);
+		if (rc < 0)
+			return rc;
+	}
+
+	return 0;
+}
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef MUXSOCK_H
+#define MUXSOCK_H
+
+#include "mux.h"
+
+struct muxsock;
+
+/*
+ * Expose each channel of @mux as a listening AF_UNIX stream socket named
+ * after the channel in @dir. One client is served per channel at a time.
+ */
+int muxsock_open(struct muxsock **msp, struct uuart_mux *mux, const char *dir);
+void muxsock_close(struct muxsock *ms);
+
+/* Move data between the sockets and the mux without blocking */
+int muxsock_service(struct muxsock *ms);
+
+#endif
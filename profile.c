@@ -0,0 +1,564 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+enum key_type {
+	KEY_BOOL,
+	KEY_INT,
+	KEY_UINT,
+	KEY_ULONG,
+	KEY_SIZE,
+	KEY_STR,
+	KEY_POLICY,
+	KEY_MILESTONE,
+};
+
+struct profile_key {
+	const char *name;
+	enum key_type type;
+	size_t offset;
+};
+
+#define KEY(name, type, field) { name, type, offsetof(struct profile, field) }
+
+static const struct profile_key keys[] = {
+	/* The device */
+	KEY("base",           KEY_ULONG, mmio.base),
+	KEY("reg-shift",      KEY_UINT,  mmio.reg_shift),
+	KEY("io-width",       KEY_UINT,  mmio.io_width),
+	KEY("vuart",          KEY_BOOL,  mmio.vuart),
+	KEY("vuart-index",    KEY_UINT,  vuart_index),
+	KEY("monitor",        KEY_BOOL,  monitor),
+	KEY("uio",            KEY_STR,   uio),
+	KEY("sim",            KEY_STR,   sim),
+	KEY("sim-side",       KEY_INT,   sim_side),
+	/* Init register values */
+	KEY("assume-dtr",     KEY_BOOL,  cfg.assume_dtr),
+	KEY("assume-enabled", KEY_BOOL,  cfg.assume_enabled),
+	KEY("assume-fifos",   KEY_BOOL,  cfg.assume_fifos),
+	KEY("rx-trigger",     KEY_UINT,  cfg.rx_trigger),
+	KEY("host-trigger",   KEY_UINT,  cfg.host_rx_trigger),
+	KEY("rx-timeout",     KEY_UINT,  cfg.rx_timeout),
+	KEY("fifo-auto",      KEY_BOOL,  cfg.fifo_auto),
+	/* Poll and idle policy */
+	KEY("no-rx",          KEY_BOOL,  cfg.no_rx),
+	KEY("no-tx",          KEY_BOOL,  cfg.no_tx),
+	KEY("poll-min-ns",    KEY_ULONG, cfg.poll_min_ns),
+	KEY("poll-max-ns",    KEY_ULONG, cfg.poll_max_ns),
+	KEY("batch-barriers", KEY_BOOL,  cfg.batch_barriers),
+	KEY("quiet",          KEY_BOOL,  quiet),
+	/* Bursts and flow control */
+	KEY("cork",           KEY_SIZE,  cfg.cork_burst),
+	KEY("cork-ns",        KEY_ULONG, cfg.cork_max_ns),
+	KEY("flow-control",   KEY_BOOL,  cfg.flow_control),
+	KEY("tx-rate",        KEY_ULONG, cfg.tx_rate),
+	KEY("tx-burst",       KEY_SIZE,  cfg.tx_burst),
+	/* Sinks and transforms */
+	KEY("sink-size",      KEY_SIZE,  sink.size),
+	KEY("sink-high",      KEY_SIZE,  sink.high),
+	KEY("sink-low",       KEY_SIZE,  sink.low),
+	KEY("sink-policy",    KEY_POLICY, sink),
+	KEY("flush-min",      KEY_SIZE,  flush_min),
+	KEY("output",         KEY_STR,   output),
+	KEY("compress",       KEY_BOOL,  compress),
+	KEY("index",          KEY_BOOL,  index),
+	KEY("tx-stdin",       KEY_BOOL,  tx_stdin),
+	KEY("mux",            KEY_STR,   mux),
+	KEY("tun",            KEY_STR,   tun),
+	KEY("control",        KEY_STR,   control),
+	KEY("scrollback",     KEY_SIZE,  scrollback),
+	/* Analysis */
+	KEY("milestone",      KEY_MILESTONE, boot),
+	KEY("boot-report",    KEY_STR,   boot_report),
+};
+
+#define NR_KEYS (sizeof(keys) / sizeof(keys[0]))
+
+static int fail(char *err, size_t len, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(err, len, fmt, ap);
+	va_end(ap);
+
+	return -EINVAL;
+}
+
+static char *trim(char *s)
+{
+	char *end;
+
+	while (isspace((unsigned char)*s))
+		s++;
+
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+
+	return s;
+}
+
+static int parse_bool(const char *val, bool *out)
+{
+	static const char *const yes[] = { "yes", "true", "on", "1" };
+	static const char *const no[] = { "no", "false", "off", "0" };
+
+	for (size_t i = 0; i < sizeof(yes) / sizeof(yes[0]); i++) {
+		if (!strcmp(val, yes[i])) {
+			*out = true;
+			return 0;
+		}
+		if (!strcmp(val, no[i])) {
+			*out = false;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static int parse_ulong(const char *val, unsigned long max, unsigned long *out)
+{
+	char *end;
+
+	if (!isdigit((unsigned char)*val))
+		return -EINVAL;
+
+	errno = 0;
+	*out = strtoul(val, &end, 0);
+	if (errno || *end || *out > max)
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Strings are copied, as are the spill path and milestone pattern, which would
+ * otherwise point into @val.
+ */
+static int set_key(struct profile *p, const struct profile_key *key,
+		   const char *val)
+{
+	void *field = (char *)p + key->offset;
+	struct uuart_sink_config *sink;
+	struct uuart_boot_config *boot;
+	const char **pattern;
+	unsigned long num;
+	char *str;
+	int rc;
+
+	switch (key->type) {
+	case KEY_BOOL:
+		return parse_bool(val, field);
+	case KEY_INT:
+		rc = parse_ulong(val, INT_MAX, &num);
+		if (!rc)
+			*(int *)field = num;
+		return rc;
+	case KEY_UINT:
+		rc = parse_ulong(val, UINT_MAX, &num);
+		if (!rc)
+			*(unsigned int *)field = num;
+		return rc;
+	case KEY_ULONG:
+		return parse_ulong(val, ULONG_MAX, field);
+	case KEY_SIZE:
+		rc = parse_ulong(val, SIZE_MAX, &num);
+		if (!rc)
+			*(size_t *)field = num;
+		return rc;
+	case KEY_STR:
+		if (!*val)
+			return -EINVAL;
+		str = strdup(val);
+		if (!str)
+			return -ENOMEM;
+		*(const char **)field = str;
+		return 0;
+	case KEY_POLICY:
+		sink = field;
+		rc = uuart_sink_parse_policy(sink, val);
+		if (rc || !sink->spill_path)
+			return rc;
+		sink->spill_path = strdup(sink->spill_path);
+		return sink->spill_path ? 0 : -ENOMEM;
+	case KEY_MILESTONE:
+		boot = field;
+		rc = uuart_boot_parse_milestone(boot, val);
+		if (rc)
+			return rc;
+		pattern = &boot->milestones[boot->n - 1].pattern;
+		*pattern = strdup(*pattern);
+		if (*pattern)
+			return 0;
+		boot->n--;
+		return -ENOMEM;
+	}
+
+	return -EINVAL;
+}
+
+static const struct profile_key *find_key(const char *name)
+{
+	for (size_t i = 0; i < NR_KEYS; i++) {
+		if (!strcmp(keys[i].name, name))
+			return &keys[i];
+	}
+
+	return NULL;
+}
+
+int profile_set(struct profile *p, const char *name, const char *val)
+{
+	const struct profile_key *key = find_key(name);
+
+	return key ? set_key(p, key, val) : -ENOENT;
+}
+
+int profile_get(const struct profile *p, const char *name, char *buf,
+		size_t len)
+{
+	const struct profile_key *key = NULL;
+	const void *field;
+
+	for (size_t i = 0; i < NR_KEYS; i++) {
+		if (!strcmp(keys[i].name, name)) {
+			key = &keys[i];
+			break;
+		}
+	}
+
+	if (!key)
+		return -ENOENT;
+
+	field = (const char *)p + key->offset;
+
+	switch (key->type) {
+	case KEY_BOOL:
+		snprintf(buf, len, "%s", *(const bool *)field ? "yes" : "no");
+		break;
+	case KEY_INT:
+		snprintf(buf, len, "%d", *(const int *)field);
+		break;
+	case KEY_UINT:
+		snprintf(buf, len, "%u", *(const unsigned int *)field);
+		break;
+	case KEY_ULONG:
+		snprintf(buf, len, "%lu", *(const unsigned long *)field);
+		break;
+	case KEY_SIZE:
+		snprintf(buf, len, "%zu", *(const size_t *)field);
+		break;
+	case KEY_STR:
+		snprintf(buf, len, "%s", *(const char *const *)field ?: "");
+		break;
+	case KEY_POLICY: {
+		const struct uuart_sink_config *sink = field;
+
+		snprintf(buf, len, "%s%s%s", uuart_sink_policy_name(sink->policy),
+			 sink->spill_path ? ":" : "", sink->spill_path ?: "");
+		break;
+	}
+	case KEY_MILESTONE: {
+		const struct uuart_boot_config *boot = field;
+		int n = 0;
+
+		if (len)
+			buf[0] = '\0';
+		for (size_t i = 0; i < boot->n && (size_t)n < len; i++)
+			n += snprintf(buf + n, len - n, "%s%s", i ? "," : "",
+				      boot->milestones[i].name);
+		break;
+	}
+	}
+
+	return 0;
+}
+
+static bool valid_trigger(unsigned int level)
+{
+	return level == 0 || level == 1 || level == 4 || level == 8 ||
+	       level == 14;
+}
+
+int profile_check(const struct profile *p, char *err, size_t len)
+{
+	const struct uuart_mmio *m = &p->mmio;
+
+	if (p->sim && p->uio)
+		return fail(err, len, "sim and uio are mutually exclusive");
+
+	if (p->sim_side != 0 && p->sim_side != 1)
+		return fail(err, len, "sim-side must be 0 or 1");
+
+	if (!p->sim && !p->uio && !m->base && !p->vuart_index)
+		return fail(err, len, "no base address or vuart-index");
+
+	if (!(m->reg_shift == 0 && m->io_width == 8) &&
+	    !(m->reg_shift == 2 && (m->io_width == 8 || m->io_width == 32)))
+		return fail(err, len,
+			    "reg-shift %u with io-width %u is unsupported",
+			    m->reg_shift, m->io_width);
+
+	if (!p->sim && !m->vuart &&
+	    (p->cfg.host_rx_trigger > 1 || p->cfg.rx_timeout))
+		return fail(err, len,
+			    "host-trigger and rx-timeout need a VUART");
+
+	if (!valid_trigger(p->cfg.rx_trigger) ||
+	    !valid_trigger(p->cfg.host_rx_trigger))
+		return fail(err, len, "trigger levels are 1, 4, 8 or 14");
+
+	if (p->cfg.rx_timeout > 3)
+		return fail(err, len, "rx-timeout must be 0 to 3");
+
+	if (p->cfg.poll_min_ns && p->cfg.poll_max_ns &&
+	    p->cfg.poll_min_ns > p->cfg.poll_max_ns)
+		return fail(err, len, "poll-min-ns exceeds poll-max-ns");
+
+	if ((p->sink.size && p->sink.high > p->sink.size) ||
+	    (p->sink.high && p->sink.low >= p->sink.high))
+		return fail(err, len,
+			    "sink watermarks need sink-low < sink-high <= sink-size");
+
+	if (!!p->tx_stdin + !!p->mux + !!p->tun > 1)
+		return fail(err, len,
+			    "tx-stdin, mux and tun are mutually exclusive");
+
+	if (p->scrollback && !p->control)
+		return fail(err, len, "scrollback needs a control socket");
+
+	/* Both watch the console's Rx, which mux and tun take over */
+	if (p->boot.n && (p->mux || p->tun))
+		return fail(err, len, "milestone can't be used with mux or tun");
+
+	if (p->scrollback && (p->mux || p->tun))
+		return fail(err, len, "scrollback can't be used with mux or tun");
+
+	if (p->boot_report && !p->boot.n)
+		return fail(err, len, "boot-report needs a milestone");
+
+	return 0;
+}
+
+/* Free the strings @cur was given on top of those it started with in @base */
+static void free_profile(struct profile *cur, const struct profile *base)
+{
+	const struct uuart_sink_config *sink = &cur->sink;
+	const struct uuart_boot_config *boot = &cur->boot;
+	const char *const *str;
+	const char *const *was;
+
+	for (size_t i = 0; i < NR_KEYS; i++) {
+		if (keys[i].type != KEY_STR)
+			continue;
+		str = (const void *)((const char *)cur + keys[i].offset);
+		was = (const void *)((const char *)base + keys[i].offset);
+		if (*str != *was)
+			free((char *)*str);
+	}
+
+	if (sink->spill_path != base->sink.spill_path)
+		free((char *)sink->spill_path);
+
+	for (size_t i = base->boot.n; i < boot->n; i++)
+		free((char *)boot->milestones[i].pattern);
+}
+
+static int end_profile(const struct profile *cur, const char *path,
+		       const char *sect, char *err, size_t len)
+{
+	char why[256];
+
+	if (!profile_check(cur, why, sizeof(why)))
+		return 0;
+
+	return fail(err, len, "%s: profile %s: %s", path, sect, why);
+}
+
+/*
+ * Every profile in the file is parsed and checked, so a mistake in one board's
+ * profile shows up the first time any of them is used. Each starts from @p,
+ * as the selected one will, and the strings the others set are freed. A key
+ * may only be set once per profile, milestones aside, as a profile may only be
+ * defined once per file.
+ */
+int profile_load(struct profile *p, const char *path, const char *name,
+		 char *err, size_t len)
+{
+	const struct profile_key *key;
+	char (*seen)[128] = NULL;
+	bool set[NR_KEYS] = {0};
+	bool in_profile = false;
+	bool selected = false;
+	struct profile found;
+	size_t nr_seen = 0;
+	bool kept = false;
+	struct profile cur;
+	bool have = false;
+	char sect[128];
+	char line[512];
+	int lineno = 0;
+	void *grown;
+	FILE *f;
+	int rc;
+	int n;
+
+	f = fopen(path, "re");
+	if (!f) {
+		rc = -errno;
+		snprintf(err, len, "%s: %s", path, strerror(errno));
+		return rc;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *s, *val;
+
+		lineno++;
+		if (!strchr(line, '\n') && !feof(f) && getc(f) != EOF) {
+			rc = fail(err, len, "%s:%d: line longer than %zu bytes",
+				  path, lineno, sizeof(line) - 2);
+			goto out;
+		}
+
+		s = trim(line);
+
+		if (!*s || *s == '#' || *s == ';')
+			continue;
+
+		if (*s == '[') {
+			if (in_profile) {
+				rc = end_profile(&cur, path, sect, err, len);
+				if (rc < 0)
+					goto out;
+				if (selected) {
+					found = cur;
+					kept = true;
+				} else {
+					free_profile(&cur, p);
+				}
+				in_profile = false;
+			}
+
+			n = 0;
+			if (sscanf(s, "[profile %127[^] \t]]%n", sect, &n) != 1 ||
+			    !n || s[n]) {
+				rc = fail(err, len,
+					  "%s:%d: expected [profile NAME]",
+					  path, lineno);
+				goto out;
+			}
+
+			for (size_t i = 0; i < nr_seen; i++) {
+				if (strcmp(seen[i], sect))
+					continue;
+				rc = fail(err, len,
+					  "%s:%d: profile %s defined twice",
+					  path, lineno, sect);
+				goto out;
+			}
+
+			grown = realloc(seen, (nr_seen + 1) * sizeof(*seen));
+			if (!grown) {
+				rc = -ENOMEM;
+				snprintf(err, len, "%s: %s", path, strerror(ENOMEM));
+				goto out;
+			}
+			seen = grown;
+			strcpy(seen[nr_seen++], sect);
+
+			selected = !strcmp(sect, name);
+			have |= selected;
+
+			memset(set, 0, sizeof(set));
+			cur = *p;
+			in_profile = true;
+			continue;
+		}
+
+		if (!in_profile) {
+			rc = fail(err, len, "%s:%d: setting outside a profile",
+				  path, lineno);
+			goto out;
+		}
+
+		val = strchr(s, '=');
+		if (!val) {
+			rc = fail(err, len, "%s:%d: expected KEY = VALUE", path,
+				  lineno);
+			goto out;
+		}
+		*val++ = '\0';
+		s = trim(s);
+		val = trim(val);
+
+		key = find_key(s);
+		if (!key) {
+			rc = fail(err, len, "%s:%d: unknown key %s", path, lineno,
+				  s);
+			goto out;
+		}
+
+		if (key->type != KEY_MILESTONE && set[key - keys]) {
+			rc = fail(err, len, "%s:%d: %s set twice in profile %s",
+				  path, lineno, s, sect);
+			goto out;
+		}
+		set[key - keys] = true;
+
+		rc = set_key(&cur, key, val);
+		if (rc < 0) {
+			snprintf(err, len, "%s:%d: bad value for %s: %s", path,
+				 lineno, s, val);
+			goto out;
+		}
+	}
+
+	if (ferror(f)) {
+		rc = -EIO;
+		snprintf(err, len, "%s: read error", path);
+		goto out;
+	}
+
+	if (in_profile) {
+		rc = end_profile(&cur, path, sect, err, len);
+		if (rc < 0)
+			goto out;
+		if (selected) {
+			found = cur;
+			kept = true;
+		} else {
+			free_profile(&cur, p);
+		}
+		in_profile = false;
+	}
+
+	if (!have) {
+		rc = -ENOENT;
+		snprintf(err, len, "%s: no profile %s", path, name);
+		goto out;
+	}
+
+	*p = found;
+	rc = 0;
+
+out:
+	if (in_profile)
+		free_profile(&cur, p);
+	if (rc < 0 && kept)
+		free_profile(&found, p);
+	free(seen);
+	fclose(f);
+
+	return rc;
+}
@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "boot.h"
+#include "sink.h"
+#include "uuart.h"
+
+/*
+ * Named device profiles, so per-board setup lives in a file instead of in
+ * wrapper scripts:
+ *
+ *	# An AST2500 BMC talking to a chatty host
+ *	[profile ast2500]
+ *	base = 0x1e788000
+ *	rx-trigger = 8
+ *	cork = 8
+ *	flow-control = yes
+ *
+ * Keys are the long option names, plus those for things only a profile can
+ * set: uio, reg-shift, io-width, vuart, sim-side, poll-min-ns, poll-max-ns,
+ * sink-size, sink-high, sink-low, flush-min and output.
+ */
+
+#define PROFILE_PATH		"/etc/uuart.conf"
+
+struct profile {
+	struct uuart_config cfg;
+	/* The device: a simulator, a UIO device or an MMIO window */
+	const char *sim;
+	int sim_side;
+	const char *uio;
+	struct uuart_mmio mmio;
+	/* Without any of those, discovery picks VUART<vuart_index> */
+	unsigned int vuart_index;
+	/* Share the device read-only instead of owning it */
+	bool monitor;
+	/* The console sink, and the file it writes instead of stdout */
+	struct uuart_sink_config sink;
+	const char *output;
+	/* Write output and captures as zlog.h blocks */
+	bool compress;
+	/* Keep an index.h index next to each output file */
+	bool index;
+	/* Hold console output until this much is buffered or Rx goes idle */
+	size_t flush_min;
+	/* What runs over the VUART, at most one of these */
+	bool tx_stdin;
+	const char *mux;
+	const char *tun;
+	bool quiet;
+	/* The control socket, see ctlsock.h */
+	const char *control;
+	/* Bytes of console history to keep for the control socket */
+	size_t scrollback;
+	/* Boot milestones to time on the console, and where to report them */
+	struct uuart_boot_config boot;
+	const char *boot_report;
+};
+
+/*
+ * Parse and validate every profile in @path, then apply the one named @name
+ * on top of @p. On failure returns a negative errno and describes the problem
+ * in @err. Strings the profile sets live until exit.
+ */
+int profile_load(struct profile *p, const char *path, const char *name,
+		 char *err, size_t len);
+
+/*
+ * Set the key @name as a profile line would. Returns -ENOENT for an unknown
+ * key and -EINVAL for a bad value.
+ */
+int profile_set(struct profile *p, const char *name, const char *val);
+
+/* Format the value of the key @name into @buf, or return -ENOENT */
+int profile_get(const struct profile *p, const char *name, char *buf,
+		size_t len);
+
+/* Check @p for settings that contradict each other */
+int profile_check(const struct profile *p, char *err, size_t len);
+
+#endif
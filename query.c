@@ -0,0 +1,326 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "zlog.h"
+
+/* The capture file, its index, and the part of the stream wanted */
+struct query {
+	const char *path;
+	int fd;
+	int idx;
+	size_t n;
+	bool compressed;
+	uint64_t start;
+	uint64_t end;
+	/* Blocks record when they end, so ones done before this are skipped */
+	uint64_t from_ns;
+};
+
+static void write_out(const uint8_t *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(STDOUT_FILENO, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			err(EXIT_FAILURE, "write");
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * Parse @SECONDS since the epoch, "YYYY-MM-DD HH:MM[:SS]", or "HH:MM[:SS]"
+ * today, in local time, into CLOCK_REALTIME ns
+ */
+static uint64_t parse_time(const char *arg)
+{
+	static const char * const formats[] = {
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%H:%M:%S", "%H:%M",
+	};
+	struct tm tm;
+	const char *end;
+	time_t now;
+	double secs;
+	char *endp;
+
+	if (arg[0] == '@') {
+		secs = strtod(arg + 1, &endp);
+		if (endp == arg + 1 || *endp || secs < 0)
+			errx(EXIT_FAILURE, "Invalid time: %s", arg);
+		return secs * 1e9;
+	}
+
+	for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		now = time(NULL);
+		localtime_r(&now, &tm);
+		tm.tm_sec = 0;
+
+		end = strptime(arg, formats[i], &tm);
+		if (!end || *end)
+			continue;
+
+		tm.tm_isdst = -1;
+		now = mktime(&tm);
+		if (now < 0)
+			break;
+		return (uint64_t)now * 1000000000ULL;
+	}
+
+	errx(EXIT_FAILURE, "Invalid time: %s", arg);
+}
+
+static void get_entry(const struct query *q, size_t i,
+		      struct uuart_index_entry *e)
+{
+	if (uuart_index_get(q->idx, i, e))
+		errx(EXIT_FAILURE, "%s: Truncated index", q->path);
+}
+
+/* Where the stream ends: the file's end, or past the last block's data */
+static uint64_t stream_end(const struct query *q)
+{
+	uint8_t hdr[UUART_ZLOG_HDR_LEN];
+	struct uuart_zlog_block blk;
+	struct uuart_index_entry e;
+	uint64_t pos, end = 0;
+	struct stat st;
+
+	if (!q->compressed) {
+		if (fstat(q->fd, &st))
+			err(EXIT_FAILURE, "stat: %s", q->path);
+		return st.st_size;
+	}
+
+	if (!q->n)
+		return 0;
+
+	/* Only the blocks written since the last index update are read */
+	get_entry(q, q->n - 1, &e);
+	for (pos = e.pos;
+	     pread(q->fd, hdr, sizeof(hdr), pos) == (ssize_t)sizeof(hdr) &&
+	     !uuart_zlog_parse(hdr, &blk);
+	     pos += sizeof(hdr) + blk.len)
+		end = blk.raw_off + blk.raw_len;
+
+	return end;
+}
+
+/* The stream offset of the first byte at or after @ns, to index granularity */
+static uint64_t time_start(const struct query *q, uint64_t ns)
+{
+	struct uuart_index_entry e;
+
+	if (!q->n)
+		return 0;
+
+	get_entry(q, uuart_index_find_time(q->idx, q->n, ns), &e);
+	if (e.ns > ns)
+		return 0;
+
+	return e.raw_off;
+}
+
+/* The stream offset of the first byte after @ns, to index granularity */
+static uint64_t time_end(const struct query *q, uint64_t ns, uint64_t end)
+{
+	struct uuart_index_entry e;
+	size_t i;
+
+	if (!q->n)
+		return end;
+
+	i = uuart_index_find_time(q->idx, q->n, ns);
+	get_entry(q, i, &e);
+	if (e.ns > ns)
+		return e.raw_off;
+	if (i + 1 == q->n)
+		return end;
+
+	get_entry(q, i + 1, &e);
+
+	return e.raw_off;
+}
+
+static void copy_plain(const struct query *q)
+{
+	uint8_t buf[65536];
+	uint64_t pos = q->start;
+	ssize_t n;
+
+	while (pos < q->end) {
+		n = pread(q->fd, buf, q->end - pos < sizeof(buf) ?
+				      q->end - pos : sizeof(buf), pos);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			err(EXIT_FAILURE, "read: %s", q->path);
+		if (!n)
+			break;
+		write_out(buf, n);
+		pos += n;
+	}
+}
+
+static void copy_blocks(const struct query *q)
+{
+	static uint8_t payload[UUART_ZLOG_BLOCK_MAX], raw[UUART_ZLOG_BLOCK_MAX];
+	uint8_t hdr[UUART_ZLOG_HDR_LEN];
+	struct uuart_zlog_block blk;
+	struct uuart_index_entry e;
+	uint64_t from, to, pos = 0;
+
+	if (q->n) {
+		get_entry(q, uuart_index_find_raw(q->idx, q->n, q->start), &e);
+		pos = e.pos;
+	}
+
+	while (pread(q->fd, hdr, sizeof(hdr), pos) == (ssize_t)sizeof(hdr)) {
+		if (uuart_zlog_parse(hdr, &blk))
+			errx(EXIT_FAILURE, "%s: Bad block at %llu", q->path,
+			     (unsigned long long)pos);
+		if (blk.raw_off >= q->end)
+			break;
+
+		pos += sizeof(hdr);
+		if (blk.raw_off + blk.raw_len > q->start &&
+		    blk.last_ns >= q->from_ns) {
+			if (pread(q->fd, payload, blk.len, pos) !=
+			    (ssize_t)blk.len ||
+			    uuart_zlog_decode(&blk, payload, raw))
+				errx(EXIT_FAILURE, "%s: Corrupt block at %llu",
+				     q->path, (unsigned long long)pos);
+
+			from = q->start > blk.raw_off ?
+			       q->start - blk.raw_off : 0;
+			to = q->end - blk.raw_off < blk.raw_len ?
+			     q->end - blk.raw_off : blk.raw_len;
+			write_out(raw + from, to - from);
+		}
+		pos += blk.len;
+	}
+}
+
+static const char help_text[] =
+"Usage: %s [OPTION]... FILE\n"
+"\n"
+"Print part of a capture file written with --index, finding it through\n"
+"FILE.idx rather than reading what comes before. Times are @SECONDS since\n"
+"the epoch, YYYY-MM-DD HH:MM[:SS] or HH:MM[:SS] today, and are matched to\n"
+"the index's granularity of one flush. The whole capture by default.\n"
+"\n"
+"-f, --from TIME\n"
+"\tStart with the data that arrived at TIME\n"
+"\n"
+"-h, --help\n"
+"\tHelp!\n"
+"\n"
+"-n, --tail BYTES\n"
+"\tPrint at most the last BYTES bytes of what is selected\n"
+"\n"
+"-t, --to TIME\n"
+"\tEnd with the data that arrived by TIME\n";
+
+int main(int argc, char * const argv[])
+{
+	struct query q = {0};
+	char ipath[PATH_MAX];
+	bool from = false, to = false;
+	uint64_t from_ns = 0, to_ns = 0;
+	uint64_t tail = 0;
+	uint32_t flags;
+	ssize_t n;
+	int o;
+
+	while (1) {
+		static struct option long_options [] = {
+			{ "from", required_argument, NULL, 'f' },
+			{ "help", no_argument,       NULL, 'h' },
+			{ "tail", required_argument, NULL, 'n' },
+			{ "to",   required_argument, NULL, 't' },
+			{ NULL,   0,                 NULL,  0  },
+		};
+		int oi = 0;
+
+		o = getopt_long(argc, argv, "f:hn:t:", long_options, &oi);
+		if (o == -1)
+			break;
+
+		if (o == 'f') {
+			from = true;
+			from_ns = parse_time(optarg);
+		} else if (o == 'h')
+			errx(EXIT_SUCCESS, help_text, argv[0]);
+		else if (o == 'n')
+			tail = strtoull(optarg, NULL, 0);
+		else if (o == 't') {
+			to = true;
+			to_ns = parse_time(optarg);
+		} else {
+			errx(EXIT_FAILURE, "Unexpected option: %c", o);
+		}
+	}
+
+	if (optind + 1 != argc)
+		errx(EXIT_FAILURE, help_text, argv[0]);
+
+	q.path = argv[optind];
+	q.fd = open(q.path, O_RDONLY | O_CLOEXEC);
+	if (q.fd < 0)
+		err(EXIT_FAILURE, "open: %s", q.path);
+
+	if (snprintf(ipath, sizeof(ipath), "%s" UUART_INDEX_SUFFIX, q.path) >=
+	    (int)sizeof(ipath))
+		errx(EXIT_FAILURE, "%s: Path too long", q.path);
+
+	q.idx = open(ipath, O_RDONLY | O_CLOEXEC);
+	if (q.idx < 0)
+		err(EXIT_FAILURE, "open: %s", ipath);
+
+	n = uuart_index_load(q.idx, &flags);
+	if (n < 0)
+		errx(EXIT_FAILURE, "%s: Not an index", ipath);
+	q.n = n;
+	q.compressed = flags & UUART_INDEX_COMPRESSED;
+
+	q.end = stream_end(&q);
+	if (to)
+		q.end = time_end(&q, to_ns, q.end);
+	if (from) {
+		q.start = time_start(&q, from_ns);
+		q.from_ns = from_ns;
+	}
+	if (tail && q.end > tail && q.end - tail > q.start)
+		q.start = q.end - tail;
+
+	if (q.start < q.end) {
+		if (q.compressed)
+			copy_blocks(&q);
+		else
+			copy_plain(&q);
+	}
+
+	close(q.idx);
+	close(q.fd);
+
+	return EXIT_SUCCESS;
+}
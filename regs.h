@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_REGS_H
+#define UUART_REGS_H
+
+#define BIT(x) (1UL << (unsigned long)(x))
+
+#define R_RBR			0x00
+#define R_THR			0x00
+#define R_DLL			0x00
+#define R_IER			0x04
+#define   IER_ERBFI		BIT(0)
+#define   IER_ETBEI		BIT(1)
+#define   IER_ELSI		BIT(2)
+#define   IER_EDSSI		BIT(3)
+#define R_DLM			0x04
+#define R_IIR			0x08
+#define   IIR_NO_INT		BIT(0)
+#define   IIR_FIFOS		(BIT(7) | BIT(6))
+#define R_FCR			0x08
+#define   FCR_FIFOE		BIT(0)
+#define   FCR_RFIFOR		BIT(1)
+#define   FCR_XFIFOR		BIT(2)
+#define   FCR_RFT		(BIT(7) | BIT(6))
+#define   FCR_RFT_SHIFT		6
+#define R_LCR			0x0c
+#define R_MCR			0x10
+#define   MCR_DTR		BIT(0)
+#define   MCR_RTS		BIT(1)
+#define   MCR_OUT1		BIT(2)
+#define   MCR_OUT2		BIT(3)
+#define   MCR_LOOP		BIT(4)
+#define R_LSR			0x14
+#define   LSR_DR		BIT(0)
+#define   LSR_OE		BIT(1)
+#define   LSR_PE		BIT(2)
+#define   LSR_FE		BIT(3)
+#define   LSR_BI		BIT(4)
+#define   LSR_THRE		BIT(5)
+#define   LSR_TEMT		BIT(6)
+#define   LSR_RFE		BIT(7)
+#define R_MSR			0x18
+#define   MSR_DCTS		BIT(0)
+#define   MSR_DDSR		BIT(1)
+#define   MSR_TERI		BIT(2)
+#define   MSR_DDCD		BIT(3)
+#define   MSR_CTS		BIT(4)
+#define   MSR_DSR		BIT(5)
+#define   MSR_RI		BIT(6)
+#define   MSR_DCD		BIT(7)
+#define R_SCR			0x1c
+#define R_GCRA			0x20
+#define   GCRA_H_RFT		(BIT(7) | BIT(6))
+#define   GCRA_H_RFT_SHIFT	6
+#define   GCRA_DIS_H_TX_DISCARD	BIT(5)
+#define   GCRA_H_LOOP		BIT(4)
+#define   GCRA_S_TIMEOUT	(BIT(3) | BIT(2))
+#define   GCRA_S_TIMEOUT_SHIFT	2
+#define   GCRA_SIRQ_POL		BIT(1)
+#define   GCRA_VUART_EN		BIT(0)
+#define R_GCRB			0x24
+#define R_VARL			0x28
+#define R_VARH			0x2c
+#define R_GCRE			0x30
+#define R_GCRF			0x34
+#define R_GCRG			0x38
+#define R_GCRH			0x3c
+
+#define NR_REGS			(R_GCRH / 4 + 1)
+
+#endif
@@ -0,0 +1,248 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scrollback.h"
+
+#define CACHE_LINE		64
+#define SCROLLBACK_MIN_SIZE	4096
+/* Line starts kept per byte of scrollback, as the average line length */
+#define SCROLLBACK_LINE_BYTES	32
+
+/* Where a line starts in the stream, and when its first byte arrived */
+struct scrollback_line {
+	_Atomic uint64_t pos;
+	_Atomic uint64_t ns;
+};
+
+struct uuart_scrollback {
+	/* Set up by uuart_scrollback_new(), then read-only */
+	uint8_t *buf;
+	size_t size;
+	struct scrollback_line *lines;
+	size_t nr_lines;
+
+	/* The writer's alone: whether the next byte starts a line */
+	bool bol;
+
+	/*
+	 * How much data and how many line starts have been written, and how
+	 * many will have been once the write in progress is done. The writer
+	 * advances a claim before it overwrites anything, so a reader that
+	 * copied something out knows it is intact unless the claim has since
+	 * passed it by a whole ring.
+	 */
+	_Alignas(CACHE_LINE) _Atomic uint64_t head;
+	_Atomic uint64_t claim;
+	_Atomic uint64_t line_head;
+	_Atomic uint64_t line_claim;
+};
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define load(p)		atomic_load_explicit(p, memory_order_relaxed)
+#define store(p, v)	atomic_store_explicit(p, v, memory_order_relaxed)
+
+int uuart_scrollback_new(struct uuart_scrollback **sbp, size_t size)
+{
+	struct uuart_scrollback *sb;
+	size_t ring = SCROLLBACK_MIN_SIZE;
+
+	while (ring < size) {
+		if (ring > SIZE_MAX / 2)
+			return -EINVAL;
+		ring <<= 1;
+	}
+
+	sb = calloc(1, sizeof(*sb));
+	if (!sb)
+		return -errno;
+
+	sb->size = ring;
+	sb->nr_lines = ring / SCROLLBACK_LINE_BYTES;
+	sb->buf = malloc(sb->size);
+	sb->lines = calloc(sb->nr_lines, sizeof(*sb->lines));
+	if (!sb->buf || !sb->lines) {
+		free(sb->lines);
+		free(sb->buf);
+		free(sb);
+		return -ENOMEM;
+	}
+
+	sb->bol = true;
+	*sbp = sb;
+
+	return 0;
+}
+
+void uuart_scrollback_free(struct uuart_scrollback *sb)
+{
+	free(sb->lines);
+	free(sb->buf);
+	free(sb);
+}
+
+size_t uuart_scrollback_size(const struct uuart_scrollback *sb)
+{
+	return sb->size;
+}
+
+static void add_line(struct uuart_scrollback *sb, uint64_t pos, uint64_t ns)
+{
+	uint64_t k = load(&sb->line_head);
+	struct scrollback_line *l = &sb->lines[k & (sb->nr_lines - 1)];
+
+	store(&sb->line_claim, k + 1);
+	atomic_thread_fence(memory_order_release);
+	store(&l->pos, pos);
+	store(&l->ns, ns);
+	atomic_store_explicit(&sb->line_head, k + 1, memory_order_release);
+}
+
+void uuart_scrollback_write(struct uuart_scrollback *sb, const uint8_t *buf,
+			    size_t len)
+{
+	const uint8_t *p = buf, *end = buf + len, *nl;
+	uint64_t head = load(&sb->head);
+	uint64_t ns = 0;
+	size_t off, pos, n;
+
+	if (!len)
+		return;
+
+	store(&sb->claim, head + len);
+	atomic_thread_fence(memory_order_release);
+
+	/* Only the last ring's worth of a huge write would survive it */
+	for (off = len > sb->size ? len - sb->size : 0; off < len; off += n) {
+		pos = (head + off) & (sb->size - 1);
+		n = len - off < sb->size - pos ? len - off : sb->size - pos;
+		memcpy(sb->buf + pos, buf + off, n);
+	}
+
+	atomic_store_explicit(&sb->head, head + len, memory_order_release);
+
+	/* Then the lines, so a reader never sees a line before its data */
+	while (p < end) {
+		if (sb->bol) {
+			if (!ns)
+				ns = clock_ns(CLOCK_REALTIME_COARSE);
+			add_line(sb, head + (p - buf), ns);
+			sb->bol = false;
+		}
+
+		nl = memchr(p, '\n', end - p);
+		if (!nl)
+			break;
+
+		p = nl + 1;
+		sb->bol = true;
+	}
+}
+
+/* Read line start @i, returning false if it has been overwritten */
+static bool get_line(struct uuart_scrollback *sb, uint64_t i, uint64_t *pos,
+		     uint64_t *ns)
+{
+	struct scrollback_line *l = &sb->lines[i & (sb->nr_lines - 1)];
+
+	*pos = load(&l->pos);
+	*ns = load(&l->ns);
+	atomic_thread_fence(memory_order_acquire);
+
+	return load(&sb->line_claim) <= i + sb->nr_lines;
+}
+
+/* Where the earliest intact line from @i on starts, or @head */
+static uint64_t line_from(struct uuart_scrollback *sb, uint64_t i,
+			  uint64_t lines, uint64_t head)
+{
+	uint64_t pos, ns;
+
+	for (; i < lines; i++) {
+		if (get_line(sb, i, &pos, &ns))
+			return pos;
+	}
+
+	return head;
+}
+
+/* Where the first line begun at or after @since starts, or @head */
+static uint64_t line_since(struct uuart_scrollback *sb, uint64_t since,
+			   uint64_t first, uint64_t lines, uint64_t head)
+{
+	uint64_t lo = first, hi = lines, mid;
+	uint64_t pos, ns;
+
+	/* Line starts overwritten under the search count as too old */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (get_line(sb, mid, &pos, &ns) && ns >= since)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return line_from(sb, lo, lines, head);
+}
+
+size_t uuart_scrollback_read(struct uuart_scrollback *sb,
+			     enum uuart_scrollback_query query, uint64_t arg,
+			     uint8_t *buf, size_t len)
+{
+	uint64_t lines = atomic_load_explicit(&sb->line_head,
+					      memory_order_acquire);
+	uint64_t head = atomic_load_explicit(&sb->head, memory_order_acquire);
+	uint64_t first = lines > sb->nr_lines ? lines - sb->nr_lines : 0;
+	uint64_t from = head, valid, claim;
+	size_t off, pos, n;
+
+	if (query == UUART_SCROLLBACK_BYTES)
+		from = arg < head ? head - arg : 0;
+	else if (query == UUART_SCROLLBACK_LINES && arg)
+		from = line_from(sb, arg < lines - first ? lines - arg : first,
+				 lines, head);
+	else if (query == UUART_SCROLLBACK_SINCE)
+		from = line_since(sb, arg, first, lines, head);
+
+	if (head - from > sb->size)
+		from = head - sb->size;
+	if (head - from > len)
+		from = head - len;
+
+	for (off = 0; from + off < head; off += n) {
+		pos = (from + off) & (sb->size - 1);
+		n = head - from - off < sb->size - pos ?
+		    head - from - off : sb->size - pos;
+		memcpy(buf + off, sb->buf + pos, n);
+	}
+
+	/* Drop what the writer may have overwritten while it was copied */
+	atomic_thread_fence(memory_order_acquire);
+	claim = load(&sb->claim);
+	valid = claim > sb->size ? claim - sb->size : 0;
+	if (valid <= from)
+		return head - from;
+	if (valid >= head)
+		return 0;
+
+	memmove(buf, buf + (valid - from), head - valid);
+
+	return head - valid;
+}
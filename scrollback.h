@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_SCROLLBACK_H
+#define UUART_SCROLLBACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A bounded in-memory history of the console, for a client that attaches
+ * late to catch up on. One thread appends, overwriting the oldest data, and
+ * notes where each line starts and when its first byte arrived. Any number
+ * of other threads read the tail without taking a lock: a reader copies what
+ * it wants, then checks the writer hasn't got round to overwriting it in the
+ * meantime, and drops whatever it has.
+ */
+
+struct uuart_scrollback;
+
+enum uuart_scrollback_query {
+	/* The last @arg bytes */
+	UUART_SCROLLBACK_BYTES,
+	/* The last @arg lines, a partial last line counting as one */
+	UUART_SCROLLBACK_LINES,
+	/* The lines begun at or after @arg, in CLOCK_REALTIME ns */
+	UUART_SCROLLBACK_SINCE,
+};
+
+/* Keep the last @size bytes, rounded up to a power of two */
+int uuart_scrollback_new(struct uuart_scrollback **sbp, size_t size);
+void uuart_scrollback_free(struct uuart_scrollback *sb);
+
+size_t uuart_scrollback_size(const struct uuart_scrollback *sb);
+
+/* Append @buf. Only ever from one thread at a time */
+void uuart_scrollback_write(struct uuart_scrollback *sb, const uint8_t *buf,
+			    size_t len);
+
+/*
+ * Copy what @query and @arg select into @buf, at most its most recent @len
+ * bytes, and return how many were copied.
+ */
+size_t uuart_scrollback_read(struct uuart_scrollback *sb,
+			     enum uuart_scrollback_query query, uint64_t arg,
+			     uint8_t *buf, size_t len);
+
+#endif
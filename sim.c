@@ -0,0 +1,275 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "regs.h"
+#include "sim.h"
+#include "uuart.h"
+
+/*
+ * A pair of VUART register files sharing a backing file. fifo[n] carries side
+ * n's Tx bytes to the other side's Rx, as a single-producer single-consumer
+ * ring, so the two sides can live in separate processes. Each side plays the
+ * host to the other: while a side has GCRA[VUART_EN] set and
+ * GCRA[DIS_H_TX_DISCARD] clear, the bytes its peer sends it are discarded.
+ *
+ * For tests, UUART_SIM_CORRUPT=N in the environment flips the low bit of every
+ * Nth byte a side sends, standing in for noise on the line.
+ */
+#define SIM_MAGIC		0x55554131
+
+struct sim_fifo {
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+	uint8_t buf[UUART_FIFO_SIZE];
+};
+
+struct sim_shared {
+	_Atomic uint32_t magic;
+	struct sim_fifo fifo[2];
+	_Atomic uint8_t mcr[2];
+	/* Side n discards what the other side sends it */
+	_Atomic bool discard[2];
+};
+
+struct uuart_sim {
+	struct sim_shared *shm;
+	int side;
+	/* Registers with no side effects are plain storage */
+	uint8_t regs[NR_REGS];
+	bool fifos;
+	/* Corrupt every Nth byte sent, if non-zero */
+	unsigned long corrupt;
+	unsigned long sent;
+};
+
+int sim_open(struct uuart_sim **simp, const char *path, int side)
+{
+	struct uuart_sim *sim;
+	uint32_t magic = 0;
+	struct stat st;
+	const char *env;
+	int rc;
+	int fd;
+
+	if (side != 0 && side != 1)
+		return -EINVAL;
+
+	sim = calloc(1, sizeof(*sim));
+	if (!sim)
+		return -errno;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		rc = -errno;
+		goto cleanup_sim;
+	}
+
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		goto cleanup_fd;
+	}
+
+	if ((size_t)st.st_size < sizeof(*sim->shm) &&
+	    ftruncate(fd, sizeof(*sim->shm))) {
+		rc = -errno;
+		goto cleanup_fd;
+	}
+
+	sim->shm = mmap(NULL, sizeof(*sim->shm), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (sim->shm == MAP_FAILED) {
+		rc = -errno;
+		goto cleanup_fd;
+	}
+
+	close(fd);
+
+	/* A fresh, zero-filled file is a valid idle pair */
+	if (!atomic_compare_exchange_strong(&sim->shm->magic, &magic,
+					    SIM_MAGIC) &&
+	    magic != SIM_MAGIC) {
+		munmap(sim->shm, sizeof(*sim->shm));
+		free(sim);
+		return -EINVAL;
+	}
+
+	sim->side = side;
+	env = getenv("UUART_SIM_CORRUPT");
+	if (env)
+		sim->corrupt = strtoul(env, NULL, 0);
+	*simp = sim;
+
+	return 0;
+
+cleanup_fd:
+	close(fd);
+
+cleanup_sim:
+	free(sim);
+
+	return rc;
+}
+
+void sim_close(struct uuart_sim *sim)
+{
+	munmap(sim->shm, sizeof(*sim->shm));
+	free(sim);
+}
+
+static size_t fifo_depth(const struct uuart_sim *sim)
+{
+	return sim->fifos ? UUART_FIFO_SIZE : 1;
+}
+
+static struct sim_fifo *tx_fifo(struct uuart_sim *sim)
+{
+	return &sim->shm->fifo[sim->side];
+}
+
+static struct sim_fifo *rx_fifo(struct uuart_sim *sim)
+{
+	return &sim->shm->fifo[!sim->side];
+}
+
+static uint32_t fifo_used(struct sim_fifo *f)
+{
+	return atomic_load_explicit(&f->head, memory_order_acquire) -
+	       atomic_load_explicit(&f->tail, memory_order_acquire);
+}
+
+/*
+ * Bytes written to a full FIFO are lost, as an overrun would lose them, and so
+ * are those the peer is discarding
+ */
+static void fifo_push(struct uuart_sim *sim, uint8_t val)
+{
+	struct sim_fifo *f = tx_fifo(sim);
+	uint32_t head = atomic_load_explicit(&f->head, memory_order_relaxed);
+
+	if (atomic_load(&sim->shm->discard[!sim->side]))
+		return;
+
+	if (fifo_used(f) >= fifo_depth(sim))
+		return;
+
+	f->buf[head % UUART_FIFO_SIZE] = val;
+	atomic_store_explicit(&f->head, head + 1, memory_order_release);
+}
+
+static uint8_t fifo_pop(struct uuart_sim *sim)
+{
+	struct sim_fifo *f = rx_fifo(sim);
+	uint32_t tail = atomic_load_explicit(&f->tail, memory_order_relaxed);
+	uint8_t val;
+
+	if (!fifo_used(f))
+		return 0;
+
+	val = f->buf[tail % UUART_FIFO_SIZE];
+	atomic_store_explicit(&f->tail, tail + 1, memory_order_release);
+
+	return val;
+}
+
+static uint8_t sim_lsr(struct uuart_sim *sim)
+{
+	uint8_t lsr = 0;
+
+	if (fifo_used(rx_fifo(sim)))
+		lsr |= LSR_DR;
+
+	if (!fifo_used(tx_fifo(sim)))
+		lsr |= LSR_THRE | LSR_TEMT;
+
+	/*
+	 * Real hardware runs alongside the poller. With both sides sharing a
+	 * CPU, waiting for Rx data is the cue to let the peer run, otherwise
+	 * each side moves one FIFO per timeslice.
+	 */
+	if (!(lsr & LSR_DR))
+		sched_yield();
+
+	return lsr;
+}
+
+/* A null-modem cable: RTS drives CTS, DTR drives DSR and DCD */
+static uint8_t sim_msr(struct uuart_sim *sim)
+{
+	uint8_t mcr = atomic_load(&sim->shm->mcr[!sim->side]);
+	uint8_t msr = 0;
+
+	if (mcr & MCR_RTS)
+		msr |= MSR_CTS;
+
+	if (mcr & MCR_DTR)
+		msr |= MSR_DSR | MSR_DCD;
+
+	return msr;
+}
+
+uint8_t sim_readb(struct uuart_sim *sim, unsigned long offset)
+{
+	switch (offset) {
+	case R_RBR:
+		return fifo_pop(sim);
+	case R_IIR:
+		return (sim->fifos ? IIR_FIFOS : 0) | IIR_NO_INT;
+	case R_MCR:
+		return atomic_load(&sim->shm->mcr[sim->side]);
+	case R_LSR:
+		return sim_lsr(sim);
+	case R_MSR:
+		return sim_msr(sim);
+	default:
+		return offset / 4 < NR_REGS ? sim->regs[offset / 4] : 0;
+	}
+}
+
+void sim_writeb(struct uuart_sim *sim, unsigned long offset, uint8_t val)
+{
+	struct sim_fifo *f;
+
+	switch (offset) {
+	case R_THR:
+		if (sim->corrupt && ++sim->sent % sim->corrupt == 0)
+			val ^= 1;
+		fifo_push(sim, val);
+		break;
+	case R_FCR:
+		sim->fifos = val & FCR_FIFOE;
+		/* Only the consumer may move the tail */
+		if (val & FCR_RFIFOR) {
+			f = rx_fifo(sim);
+			atomic_store(&f->tail, atomic_load(&f->head));
+		}
+		break;
+	case R_MCR:
+		atomic_store(&sim->shm->mcr[sim->side], val);
+		break;
+	case R_GCRA:
+		sim->regs[R_GCRA / 4] = val;
+		/* GCRA[DIS_H_TX_DISCARD] is active low */
+		atomic_store(&sim->shm->discard[sim->side],
+			     (val & (GCRA_VUART_EN | GCRA_DIS_H_TX_DISCARD)) ==
+			     GCRA_VUART_EN);
+		break;
+	case R_LSR:
+	case R_MSR:
+		break;
+	default:
+		if (offset / 4 < NR_REGS)
+			sim->regs[offset / 4] = val;
+		break;
+	}
+}
@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_SIM_H
+#define UUART_SIM_H
+
+#include <stdint.h>
+
+struct uuart_sim;
+
+int sim_open(struct uuart_sim **simp, const char *path, int side);
+void sim_close(struct uuart_sim *sim);
+
+uint8_t sim_readb(struct uuart_sim *sim, unsigned long offset);
+void sim_writeb(struct uuart_sim *sim, unsigned long offset, uint8_t val);
+
+#endif
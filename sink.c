@@ -0,0 +1,499 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hist.h"
+#include "sink.h"
+#include "uuart.h"
+
+#define SINK_DEFAULT_SIZE	65536
+/* Bursts timed in the buffer at once, a power of two */
+#define SINK_MARKS		1024
+/* Scratch for moving data within the spill file */
+#define SPILL_CHUNK		4096
+
+/* A burst: where its last byte ends in the buffer, and when it was read */
+struct sink_mark {
+	uint64_t end;
+	uint64_t ns;
+};
+
+struct uuart_sink {
+	/*
+	 * The fd stays blocking, as it may share its open file description
+	 * with stdin. Unless it is a regular file, a flush waits for POLLOUT
+	 * and writes at most PIPE_BUF, which a pipe takes without blocking.
+	 */
+	int fd;
+	bool poll_out;
+	struct uuart *dev;
+	struct uuart_sink_config cfg;
+
+	uint8_t *buf;
+	/* Free-running counters */
+	uint64_t head;
+	uint64_t tail;
+
+	/*
+	 * Spilled data lives in the file between the read and write offsets.
+	 * While there is any, new data queues behind it to keep the order.
+	 */
+	int spill_fd;
+	uint64_t spill_rd;
+	uint64_t spill_wr;
+
+	bool throttled;
+	uint64_t throttle_start;
+
+	/* Bytes refused last time, which uuart_step() offers again first */
+	size_t refusing;
+
+	/*
+	 * Bursts buffered and not yet written out. Data that goes through the
+	 * spill file isn't timed.
+	 */
+	struct sink_mark marks[SINK_MARKS];
+	uint64_t mark_head;
+	uint64_t mark_tail;
+	struct uuart_hist latency;
+
+	struct uuart_sink_stats stats;
+};
+
+static const char *const policy_names[] = {
+	[UUART_SINK_BLOCK]       = "block",
+	[UUART_SINK_DROP_OLDEST] = "drop-oldest",
+	[UUART_SINK_DROP_NEWEST] = "drop-newest",
+	[UUART_SINK_SPILL]       = "spill",
+};
+
+#define NR_POLICIES (sizeof(policy_names) / sizeof(policy_names[0]))
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int uuart_sink_parse_policy(struct uuart_sink_config *cfg, const char *arg)
+{
+	const char *spill = policy_names[UUART_SINK_SPILL];
+	size_t len = strlen(spill);
+
+	if (!strncmp(arg, spill, len) && arg[len] == ':' && arg[len + 1]) {
+		cfg->policy = UUART_SINK_SPILL;
+		cfg->spill_path = arg + len + 1;
+		return 0;
+	}
+
+	for (size_t i = 0; i < NR_POLICIES; i++) {
+		if (i != UUART_SINK_SPILL && !strcmp(arg, policy_names[i])) {
+			cfg->policy = i;
+			cfg->spill_path = NULL;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+const char *uuart_sink_policy_name(enum uuart_sink_policy policy)
+{
+	return policy < NR_POLICIES ? policy_names[policy] : "unknown";
+}
+
+int uuart_sink_new(struct uuart_sink **sp, int fd, struct uuart *dev,
+		   const struct uuart_sink_config *cfg)
+{
+	struct uuart_sink *s;
+	struct stat st;
+	int rc;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -errno;
+
+	s->spill_fd = -1;
+	s->cfg = *cfg;
+	uuart_hist_init(&s->latency);
+	if (!s->cfg.size)
+		s->cfg.size = SINK_DEFAULT_SIZE;
+	if (!s->cfg.high)
+		s->cfg.high = s->cfg.size / 4 * 3;
+	if (!s->cfg.low)
+		s->cfg.low = s->cfg.size / 4;
+
+	if (s->cfg.low >= s->cfg.high || s->cfg.high > s->cfg.size ||
+	    s->cfg.policy >= NR_POLICIES ||
+	    (s->cfg.policy == UUART_SINK_SPILL) != !!s->cfg.spill_path) {
+		rc = -EINVAL;
+		goto cleanup;
+	}
+
+	s->buf = malloc(s->cfg.size);
+	if (!s->buf) {
+		rc = -ENOMEM;
+		goto cleanup;
+	}
+
+	if (s->cfg.policy == UUART_SINK_SPILL) {
+		s->spill_fd = open(s->cfg.spill_path,
+				   O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (s->spill_fd < 0) {
+			rc = -errno;
+			goto cleanup;
+		}
+	}
+
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		goto cleanup;
+	}
+
+	s->fd = fd;
+	s->poll_out = !S_ISREG(st.st_mode);
+	s->dev = dev;
+
+	*sp = s;
+
+	return 0;
+
+cleanup:
+	if (s->spill_fd >= 0) {
+		close(s->spill_fd);
+		unlink(s->cfg.spill_path);
+	}
+	free(s->buf);
+	free(s);
+
+	return rc;
+}
+
+static size_t used(const struct uuart_sink *s)
+{
+	return s->head - s->tail;
+}
+
+/* Copy @len bytes of the spill file from @from to @to, which may overlap */
+static bool move_spill(int fd, uint64_t from, uint64_t to, uint64_t len)
+{
+	uint8_t chunk[SPILL_CHUNK];
+	uint64_t off;
+	size_t n;
+
+	for (uint64_t done = 0; done < len; done += n) {
+		n = len - done < sizeof(chunk) ? len - done : sizeof(chunk);
+		/* Moving up, start at the end so nothing is overwritten unread */
+		off = to > from ? len - done - n : done;
+		if (pread(fd, chunk, n, from + off) != (ssize_t)n ||
+		    pwrite(fd, chunk, n, to + off) != (ssize_t)n)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Rewrite the spill file to hold what is left, in order: the buffer, which
+ * comes first, then the unreplayed data. The buffer is only read.
+ */
+static void keep_spill(struct uuart_sink *s)
+{
+	uint64_t len = s->spill_wr - s->spill_rd;
+	size_t off = s->tail % s->cfg.size;
+	size_t ring = used(s);
+	size_t first;
+
+	first = s->cfg.size - off < ring ? s->cfg.size - off : ring;
+
+	if (!move_spill(s->spill_fd, s->spill_rd, ring, len) ||
+	    pwrite(s->spill_fd, &s->buf[off], first, 0) != (ssize_t)first ||
+	    pwrite(s->spill_fd, s->buf, ring - first, first) !=
+	    (ssize_t)(ring - first))
+		return;
+
+	if (!ftruncate(s->spill_fd, ring + len)) {
+		s->spill_rd = 0;
+		s->spill_wr = ring + len;
+	}
+}
+
+/* Write out everything pending, waiting on the fd as long as it takes */
+static void drain(struct uuart_sink *s)
+{
+	struct pollfd pfd = { .fd = s->fd, .events = POLLOUT };
+
+	while (uuart_sink_pending(s)) {
+		if (s->poll_out && poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			return;
+		if (uuart_sink_flush(s) < 0)
+			return;
+	}
+}
+
+void uuart_sink_free(struct uuart_sink *s)
+{
+	drain(s);
+
+	if (s->spill_fd >= 0) {
+		if (!uuart_sink_pending(s))
+			unlink(s->cfg.spill_path);
+		else
+			keep_spill(s);
+		close(s->spill_fd);
+	}
+
+	free(s->buf);
+	free(s);
+}
+
+size_t uuart_sink_pending(const struct uuart_sink *s)
+{
+	return used(s) + (s->spill_wr - s->spill_rd);
+}
+
+static void throttle(struct uuart_sink *s, bool on)
+{
+	uint64_t now = now_ns();
+
+	if (on) {
+		s->stats.throttles++;
+		s->throttle_start = now;
+	} else {
+		s->stats.throttled_ns += now - s->throttle_start;
+	}
+
+	s->throttled = on;
+	if (s->dev)
+		uuart_throttle(s->dev, on);
+}
+
+/*
+ * Count @n bytes refused. uuart_step() offers refused bytes again, ahead of
+ * anything new, so only those beyond the last refusal are new.
+ */
+static void refuse(struct uuart_sink *s, size_t n)
+{
+	if (n > s->refusing)
+		s->stats.refused += n - s->refusing;
+	s->refusing = n;
+}
+
+static void copy_in(struct uuart_sink *s, const uint8_t *buf, size_t len)
+{
+	size_t off = s->head % s->cfg.size;
+	size_t first = s->cfg.size - off;
+
+	if (first > len)
+		first = len;
+
+	memcpy(&s->buf[off], buf, first);
+	memcpy(s->buf, buf + first, len - first);
+	s->head += len;
+}
+
+/* Time the burst just copied in, from when the device read it */
+static void mark(struct uuart_sink *s)
+{
+	uint64_t ns = s->dev ? uuart_rx_ns(s->dev) : now_ns();
+	struct sink_mark *m;
+
+	/* Out of marks, the newest covers this burst too, overstating it */
+	if (s->mark_head - s->mark_tail == SINK_MARKS) {
+		s->marks[(s->mark_head - 1) % SINK_MARKS].end = s->head;
+		return;
+	}
+
+	m = &s->marks[s->mark_head++ % SINK_MARKS];
+	m->end = s->head;
+	m->ns = ns;
+}
+
+/* Retire the bursts that have left the buffer, timing them if written */
+static void retire(struct uuart_sink *s, bool written)
+{
+	uint64_t now = written ? now_ns() : 0;
+	const struct sink_mark *m;
+
+	for (; s->mark_tail != s->mark_head; s->mark_tail++) {
+		m = &s->marks[s->mark_tail % SINK_MARKS];
+		if (m->end > s->tail)
+			break;
+		if (written)
+			uuart_hist_record(&s->latency, now - m->ns);
+	}
+}
+
+/* Append to the spill file, returning how much of @buf made it */
+static size_t spill(struct uuart_sink *s, const uint8_t *buf, size_t len)
+{
+	ssize_t n = pwrite(s->spill_fd, buf, len, s->spill_wr);
+
+	if (n <= 0)
+		return 0;
+
+	s->spill_wr += n;
+	s->stats.spilled += n;
+
+	return n;
+}
+
+size_t uuart_sink_rx(void *priv, const uint8_t *buf, size_t len)
+{
+	struct uuart_sink *s = priv;
+	size_t space = s->cfg.size - used(s);
+	size_t offered = len, taken = len;
+	size_t over;
+
+	if (s->cfg.policy == UUART_SINK_SPILL && s->spill_wr > s->spill_rd) {
+		/* A failed spill falls back to refusing, which keeps order */
+		taken = spill(s, buf, len);
+		refuse(s, len - taken);
+		s->stats.bytes_in += taken;
+		return taken;
+	}
+
+	if (len > space) {
+		over = len - space;
+
+		switch (s->cfg.policy) {
+		case UUART_SINK_BLOCK:
+			taken = len = space;
+			break;
+		case UUART_SINK_DROP_OLDEST:
+			if (len > s->cfg.size) {
+				s->stats.dropped += len - s->cfg.size;
+				buf += len - s->cfg.size;
+				over -= len - s->cfg.size;
+				len = s->cfg.size;
+			}
+			s->tail += over;
+			s->stats.dropped += over;
+			retire(s, false);
+			break;
+		case UUART_SINK_DROP_NEWEST:
+			s->stats.dropped += over;
+			len = space;
+			break;
+		case UUART_SINK_SPILL:
+			taken = space + spill(s, buf + space, over);
+			len = space;
+			break;
+		}
+	}
+
+	refuse(s, offered - taken);
+	copy_in(s, buf, len);
+	s->stats.bytes_in += taken;
+	if (len)
+		mark(s);
+
+	if (s->cfg.policy == UUART_SINK_BLOCK && !s->throttled &&
+	    used(s) >= s->cfg.high)
+		throttle(s, true);
+
+	return taken;
+}
+
+/* Refill the buffer from the spill file as far as it has room */
+static void replay(struct uuart_sink *s)
+{
+	size_t space = s->cfg.size - used(s);
+	size_t off = s->head % s->cfg.size;
+	size_t want;
+	ssize_t n;
+
+	while (space && s->spill_rd < s->spill_wr) {
+		want = s->cfg.size - off;
+		if (want > space)
+			want = space;
+		if (want > s->spill_wr - s->spill_rd)
+			want = s->spill_wr - s->spill_rd;
+
+		n = pread(s->spill_fd, &s->buf[off], want, s->spill_rd);
+		if (n <= 0)
+			return;
+
+		s->head += n;
+		s->spill_rd += n;
+		s->stats.replayed += n;
+		space -= n;
+		off = s->head % s->cfg.size;
+	}
+
+	/* Caught up, so start the file over rather than let it grow */
+	if (s->spill_rd == s->spill_wr && s->spill_wr &&
+	    !ftruncate(s->spill_fd, 0))
+		s->spill_rd = s->spill_wr = 0;
+}
+
+ssize_t uuart_sink_flush(struct uuart_sink *s)
+{
+	size_t off, len;
+	struct pollfd pfd = { .fd = s->fd, .events = POLLOUT };
+	struct iovec iov[2];
+	ssize_t n;
+
+	if (s->spill_wr > s->spill_rd)
+		replay(s);
+
+	len = used(s);
+	if (!len)
+		return 0;
+
+	/* Errors and hangups are left for writev() to report */
+	if (s->poll_out) {
+		if (poll(&pfd, 1, 0) <= 0)
+			return 0;
+		if (len > PIPE_BUF)
+			len = PIPE_BUF;
+	}
+
+	off = s->tail % s->cfg.size;
+	iov[0].iov_base = &s->buf[off];
+	iov[0].iov_len = s->cfg.size - off < len ? s->cfg.size - off : len;
+	iov[1].iov_base = s->buf;
+	iov[1].iov_len = len - iov[0].iov_len;
+
+	n = writev(s->fd, iov, iov[1].iov_len ? 2 : 1);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	s->tail += n;
+	s->stats.bytes_out += n;
+	retire(s, true);
+
+	if (s->throttled && used(s) <= s->cfg.low)
+		throttle(s, false);
+
+	return n;
+}
+
+void uuart_sink_stats(const struct uuart_sink *s,
+		      struct uuart_sink_stats *stats)
+{
+	*stats = s->stats;
+	if (s->throttled)
+		stats->throttled_ns += now_ns() - s->throttle_start;
+}
+
+void uuart_sink_latency(const struct uuart_sink *s, struct uuart_hist *hist)
+{
+	*hist = s->latency;
+}
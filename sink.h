@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_SINK_H
+#define UUART_SINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hist.h"
+
+struct uuart;
+struct uuart_sink;
+
+/*
+ * What the sink does with Rx data it has no room for:
+ *
+ * BLOCK	refuse it, leaving it in the FIFO, and throttle the host through
+ *		uuart_throttle() from the high-water mark until the buffer
+ *		drains to the low-water mark
+ * DROP_OLDEST	discard buffered data to make room, keeping the latest output
+ * DROP_NEWEST	discard what doesn't fit, keeping the earliest output
+ * SPILL	append it to the spill file, which is replayed to the fd in
+ *		order once the buffer has room again
+ *
+ * Only BLOCK pushes back on the host; the others never stall the poller.
+ */
+enum uuart_sink_policy {
+	UUART_SINK_BLOCK,
+	UUART_SINK_DROP_OLDEST,
+	UUART_SINK_DROP_NEWEST,
+	UUART_SINK_SPILL,
+};
+
+/*
+ * A buffered consumer of Rx data writing to a file descriptor, without
+ * blocking the poller. Zero fields select the defaults, the BLOCK policy
+ * among them.
+ */
+struct uuart_sink_config {
+	size_t size;
+	size_t high;
+	size_t low;
+	enum uuart_sink_policy policy;
+	/* Where SPILL puts overflow, created or truncated by uuart_sink_new() */
+	const char *spill_path;
+};
+
+struct uuart_sink_stats {
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	/* Bytes refused because the buffer was full, however often offered */
+	uint64_t refused;
+	/* Bytes discarded by the drop policies */
+	uint64_t dropped;
+	/* Bytes written to the spill file, and read back from it */
+	uint64_t spilled;
+	uint64_t replayed;
+	/* Times BLOCK crossed the high-water mark, and for how long in total */
+	uint64_t throttles;
+	uint64_t throttled_ns;
+};
+
+/*
+ * Parse "block", "drop-oldest", "drop-newest" or "spill:FILE" into @cfg, with
+ * spill_path pointing into @arg. Returns zero or -EINVAL.
+ */
+int uuart_sink_parse_policy(struct uuart_sink_config *cfg, const char *arg);
+
+/* The name uuart_sink_parse_policy() takes for @policy, without any file */
+const char *uuart_sink_policy_name(enum uuart_sink_policy policy);
+
+/* @dev may be NULL to buffer without flow control */
+int uuart_sink_new(struct uuart_sink **sp, int fd, struct uuart *dev,
+		   const struct uuart_sink_config *cfg);
+
+/*
+ * Writes out everything pending, waiting on the fd as long as that takes.
+ * After a write error the spill file is kept, rewritten to hold what was
+ * left in order, buffered data first. Otherwise it is removed.
+ */
+void uuart_sink_free(struct uuart_sink *s);
+
+/* Matches uuart_ops.rx: take what the policy allows and report how much */
+size_t uuart_sink_rx(void *s, const uint8_t *buf, size_t len);
+
+/*
+ * Write out buffered data without blocking, replaying spilled data as the
+ * buffer drains. The fd is left blocking: unless it is a regular file, this
+ * writes only once poll() reports it writable, and then at most PIPE_BUF.
+ * Returns the bytes written or a negative errno.
+ */
+ssize_t uuart_sink_flush(struct uuart_sink *s);
+
+/* Bytes yet to be written, in the buffer or the spill file */
+size_t uuart_sink_pending(const struct uuart_sink *s);
+
+void uuart_sink_stats(const struct uuart_sink *s,
+		      struct uuart_sink_stats *stats);
+
+/*
+ * How long each burst took from the device reading it, by uuart_rx_ns(), to
+ * the write() that took its last byte
+ */
+void uuart_sink_latency(const struct uuart_sink *s, struct uuart_hist *hist);
+
+#endif
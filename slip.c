@@ -0,0 +1,327 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slip.h"
+
+#define SLIP_END		0xc0
+#define SLIP_ESC		0xdb
+#define SLIP_ESC_END		0xdc
+#define SLIP_ESC_ESC		0xdd
+
+#define SLIP_TX_RING		16384
+#define SLIP_RX_SLOTS		32
+
+struct slip_pkt {
+	size_t len;
+	uint8_t *data;
+};
+
+struct uuart_slip {
+	size_t mtu;
+
+	/* Encoded Tx stream, free-running counters over a power-of-two ring */
+	uint8_t tx[SLIP_TX_RING];
+	uint64_t tx_head;
+	uint64_t tx_tail;
+
+	/* The frame being decoded */
+	uint8_t *cur;
+	size_t cur_len;
+	bool esc;
+	bool bad;
+
+	struct slip_pkt rx[SLIP_RX_SLOTS];
+	unsigned int rx_head;
+	unsigned int rx_tail;
+
+	struct uuart_slip_stats stats;
+};
+
+/*
+ * Find the first END or ESC in @p. Both the encoder and the decoder spend
+ * nearly all their time here, and runs of ordinary bytes are then copied
+ * wholesale rather than byte by byte.
+ */
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+static size_t scan_special(const uint8_t *p, size_t len)
+{
+	const uint8x16_t end = vdupq_n_u8(SLIP_END);
+	const uint8x16_t esc = vdupq_n_u8(SLIP_ESC);
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8(p + i);
+		uint8x16_t m = vorrq_u8(vceqq_u8(v, end), vceqq_u8(v, esc));
+		uint8x8_t r = vorr_u8(vget_low_u8(m), vget_high_u8(m));
+
+		r = vpmax_u8(r, r);
+		r = vpmax_u8(r, r);
+		r = vpmax_u8(r, r);
+		if (vget_lane_u8(r, 0))
+			break;
+	}
+
+	for (; i < len; i++) {
+		if (p[i] == SLIP_END || p[i] == SLIP_ESC)
+			break;
+	}
+
+	return i;
+}
+#else
+#define ONES			0x0101010101010101ULL
+#define HIGHS			0x8080808080808080ULL
+
+static bool has_byte(uint64_t word, uint8_t c)
+{
+	uint64_t x = word ^ (ONES * c);
+
+	return (x - ONES) & ~x & HIGHS;
+}
+
+static size_t scan_special(const uint8_t *p, size_t len)
+{
+	uint64_t word;
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&word, p + i, sizeof(word));
+		if (has_byte(word, SLIP_END) || has_byte(word, SLIP_ESC))
+			break;
+	}
+
+	for (; i < len; i++) {
+		if (p[i] == SLIP_END || p[i] == SLIP_ESC)
+			break;
+	}
+
+	return i;
+}
+#endif
+
+int uuart_slip_new(struct uuart_slip **sp, size_t mtu)
+{
+	struct uuart_slip *s;
+
+	if (!mtu)
+		return -EINVAL;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -errno;
+
+	s->mtu = mtu;
+	s->cur = malloc(mtu);
+	if (!s->cur)
+		goto cleanup;
+
+	for (int i = 0; i < SLIP_RX_SLOTS; i++) {
+		s->rx[i].data = malloc(mtu);
+		if (!s->rx[i].data)
+			goto cleanup;
+	}
+
+	*sp = s;
+
+	return 0;
+
+cleanup:
+	uuart_slip_free(s);
+
+	return -ENOMEM;
+}
+
+void uuart_slip_free(struct uuart_slip *s)
+{
+	for (int i = 0; i < SLIP_RX_SLOTS; i++)
+		free(s->rx[i].data);
+
+	free(s->cur);
+	free(s);
+}
+
+static void tx_put(struct uuart_slip *s, const uint8_t *buf, size_t len)
+{
+	size_t off = s->tx_head % SLIP_TX_RING;
+	size_t first = SLIP_TX_RING - off;
+
+	if (first > len)
+		first = len;
+
+	memcpy(&s->tx[off], buf, first);
+	memcpy(s->tx, buf + first, len - first);
+	s->tx_head += len;
+}
+
+static void tx_putc(struct uuart_slip *s, uint8_t c)
+{
+	s->tx[s->tx_head++ % SLIP_TX_RING] = c;
+}
+
+int uuart_slip_send(struct uuart_slip *s, const void *pkt, size_t len)
+{
+	const uint8_t *p = pkt;
+	uint64_t start;
+	size_t n;
+
+	if (SLIP_TX_RING - (s->tx_head - s->tx_tail) < 2 * len + 2)
+		return -EAGAIN;
+
+	start = s->tx_head;
+
+	tx_putc(s, SLIP_END);
+
+	while (len) {
+		n = scan_special(p, len);
+		tx_put(s, p, n);
+		p += n;
+		len -= n;
+
+		if (!len)
+			break;
+
+		tx_putc(s, SLIP_ESC);
+		tx_putc(s, *p == SLIP_END ? SLIP_ESC_END : SLIP_ESC_ESC);
+		p++;
+		len--;
+	}
+
+	tx_putc(s, SLIP_END);
+
+	s->stats.tx_packets++;
+	s->stats.tx_bytes += p - (const uint8_t *)pkt;
+	s->stats.tx_wire_bytes += s->tx_head - start;
+
+	return 0;
+}
+
+size_t uuart_slip_link_tx(void *priv, uint8_t *buf, size_t len)
+{
+	struct uuart_slip *s = priv;
+	size_t used = s->tx_head - s->tx_tail;
+	size_t off = s->tx_tail % SLIP_TX_RING;
+	size_t first;
+
+	if (len > used)
+		len = used;
+
+	first = SLIP_TX_RING - off;
+	if (first > len)
+		first = len;
+
+	memcpy(buf, &s->tx[off], first);
+	memcpy(buf + first, s->tx, len - first);
+	s->tx_tail += len;
+
+	return len;
+}
+
+static void frame_end(struct uuart_slip *s)
+{
+	struct slip_pkt *pkt;
+
+	if (s->bad) {
+		s->stats.rx_errors++;
+	} else if (s->cur_len) {
+		if (s->rx_head - s->rx_tail == SLIP_RX_SLOTS) {
+			s->stats.rx_errors++;
+		} else {
+			pkt = &s->rx[s->rx_head++ % SLIP_RX_SLOTS];
+			memcpy(pkt->data, s->cur, s->cur_len);
+			pkt->len = s->cur_len;
+			s->stats.rx_packets++;
+			s->stats.rx_bytes += s->cur_len;
+		}
+	}
+
+	s->cur_len = 0;
+	s->bad = false;
+}
+
+static void frame_append(struct uuart_slip *s, const uint8_t *buf, size_t len)
+{
+	if (s->cur_len + len > s->mtu) {
+		s->bad = true;
+		return;
+	}
+
+	memcpy(&s->cur[s->cur_len], buf, len);
+	s->cur_len += len;
+}
+
+size_t uuart_slip_link_rx(void *priv, const uint8_t *buf, size_t len)
+{
+	struct uuart_slip *s = priv;
+	const uint8_t *p = buf;
+	size_t remaining = len;
+	uint8_t c;
+	size_t n;
+
+	s->stats.rx_wire_bytes += len;
+
+	while (remaining) {
+		if (s->esc) {
+			s->esc = false;
+			c = *p++;
+			remaining--;
+
+			if (c == SLIP_ESC_END)
+				frame_append(s, (const uint8_t[]){ SLIP_END }, 1);
+			else if (c == SLIP_ESC_ESC)
+				frame_append(s, (const uint8_t[]){ SLIP_ESC }, 1);
+			else if (c == SLIP_END)
+				frame_end(s);
+			else
+				s->bad = true;
+			continue;
+		}
+
+		n = scan_special(p, remaining);
+		frame_append(s, p, n);
+		p += n;
+		remaining -= n;
+
+		if (!remaining)
+			break;
+
+		if (*p == SLIP_END)
+			frame_end(s);
+		else
+			s->esc = true;
+		p++;
+		remaining--;
+	}
+
+	return len;
+}
+
+ssize_t uuart_slip_recv(struct uuart_slip *s, void *buf, size_t len)
+{
+	struct slip_pkt *pkt;
+
+	if (s->rx_head == s->rx_tail)
+		return 0;
+
+	pkt = &s->rx[s->rx_tail % SLIP_RX_SLOTS];
+	if (pkt->len > len)
+		return -EMSGSIZE;
+
+	memcpy(buf, pkt->data, pkt->len);
+	s->rx_tail++;
+
+	return pkt->len;
+}
+
+void uuart_slip_stats(const struct uuart_slip *s,
+		      struct uuart_slip_stats *stats)
+{
+	*stats = s->stats;
+}
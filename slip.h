@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_SLIP_H
+#define UUART_SLIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * RFC 1055 SLIP framing of packets over a VUART. Frames are delimited by END
+ * on both sides so a corrupted frame costs only itself, and the encoded
+ * stream is packed back to back so the Tx FIFO is filled on every burst.
+ */
+
+struct uuart_slip;
+
+struct uuart_slip_stats {
+	uint64_t tx_packets;
+	uint64_t tx_bytes;
+	uint64_t tx_wire_bytes;
+	uint64_t rx_packets;
+	uint64_t rx_bytes;
+	uint64_t rx_wire_bytes;
+	/* Oversized frames, bad escapes and packets dropped on a full queue */
+	uint64_t rx_errors;
+};
+
+/* @mtu bounds the decoded packet size */
+int uuart_slip_new(struct uuart_slip **sp, size_t mtu);
+void uuart_slip_free(struct uuart_slip *s);
+
+/*
+ * Encode a packet for transmission. Returns zero, or -EAGAIN if the encoded
+ * stream has no room for the worst case encoding of @len bytes.
+ */
+int uuart_slip_send(struct uuart_slip *s, const void *pkt, size_t len);
+
+/*
+ * Dequeue the next decoded packet. Returns its length, zero if none is
+ * waiting, or -EMSGSIZE if @len is too small.
+ */
+ssize_t uuart_slip_recv(struct uuart_slip *s, void *pkt, size_t len);
+
+/* Link side, matching uuart_ops.tx and uuart_ops.rx for uuart_step() */
+size_t uuart_slip_link_tx(void *s, uint8_t *buf, size_t len);
+size_t uuart_slip_link_rx(void *s, const uint8_t *buf, size_t len);
+
+void uuart_slip_stats(const struct uuart_slip *s,
+		      struct uuart_slip_stats *stats);
+
+#endif
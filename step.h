@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+/*
+ * The uuart data path for one register access variant. libuuart.c includes
+ * this once per variant, with VARIANT() naming the functions and io_readb()
+ * and io_writeb() bound to that variant's accessors, so every register access
+ * below compiles to a single load or store. io_readb_relaxed(),
+ * io_writeb_relaxed() and io_barrier() serve the batch_barriers policy.
+ * Everything that isn't per byte stays in libuuart.c. There is deliberately no
+ * include guard.
+ */
+
+static ssize_t VARIANT(read)(struct uuart *ctx, void *buf, size_t n)
+{
+	uint8_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < n && (io_readb(ctx, R_LSR) & LSR_DR); i++)
+		p[i] = io_readb(ctx, R_RBR);
+
+	return i;
+}
+
+static ssize_t VARIANT(write)(struct uuart *ctx, const void *buf, size_t n)
+{
+	const uint8_t *p = buf;
+	size_t i;
+
+	if (!(io_readb(ctx, R_LSR) & LSR_THRE))
+		return 0;
+
+	if (n > ctx->tx_room)
+		n = ctx->tx_room;
+
+	for (i = 0; i < n; i++)
+		io_writeb(ctx, R_THR, p[i]);
+
+	return n;
+}
+
+/* Register access under the barrier policy @batch */
+static inline uint8_t VARIANT(rd)(struct uuart *ctx, unsigned long reg,
+				  bool batch)
+{
+	return batch ? io_readb_relaxed(ctx, reg) : io_readb(ctx, reg);
+}
+
+static inline void VARIANT(wr)(struct uuart *ctx, unsigned long reg,
+			       uint8_t val, bool batch)
+{
+	if (batch)
+		io_writeb_relaxed(ctx, reg, val);
+	else
+		io_writeb(ctx, reg, val);
+}
+
+static inline void VARIANT(step_rx)(struct uuart *ctx, uint8_t lsr,
+				    struct uuart_step *step, bool batch)
+{
+	size_t i;
+
+	step_rx_flush(ctx);
+
+	/* Hold further data in the FIFO until the sink catches up */
+	if (ctx->rx_len || !(lsr & LSR_DR))
+		return;
+
+	/* The sampled LSR[DR] vouches for the first byte */
+	i = 0;
+	do {
+		ctx->rx_buf[i++] = VARIANT(rd)(ctx, R_RBR, batch);
+	} while (i < sizeof(ctx->rx_buf) &&
+		 (VARIANT(rd)(ctx, R_LSR, batch) & LSR_DR));
+
+	step_rx_done(ctx, i, step);
+}
+
+static inline void VARIANT(step_tx)(struct uuart *ctx, uint8_t lsr,
+				    struct uuart_step *step, bool batch)
+{
+	size_t n = step_tx_room(ctx, lsr);
+
+	if (!n)
+		return;
+
+	for (size_t i = 0; i < n; i++)
+		VARIANT(wr)(ctx, R_THR, ctx->tx_buf[ctx->tx_off + i], batch);
+
+	step_tx_done(ctx, n, step);
+}
+
+/*
+ * Written once, and called with constant @rx, @tx and @batch, so each wrapper
+ * below compiles to a step with the tests for the disabled directions and the
+ * unused barrier policy folded away. Only step_generic passes them at run time.
+ */
+static inline __attribute__((always_inline)) int
+VARIANT(step_body)(struct uuart *ctx, struct uuart_step *step,
+		   struct timespec *next, const bool rx, const bool tx,
+		   const bool batch)
+{
+	uint8_t lsr;
+
+	/* Keep the Rx interrupt masked so the kernel driver can't drain RBR */
+	if (rx)
+		VARIANT(wr)(ctx, R_IER,
+			    ~IER_ERBFI & VARIANT(rd)(ctx, R_IER, batch), batch);
+
+	lsr = VARIANT(rd)(ctx, R_LSR, batch);
+	step_begin(ctx, lsr, step);
+
+	if (tx && ctx->ops && ctx->ops->tx)
+		VARIANT(step_tx)(ctx, lsr, step, batch);
+
+	if (rx && ctx->ops && ctx->ops->rx)
+		VARIANT(step_rx)(ctx, lsr, step, batch);
+
+	if (batch)
+		io_barrier();
+
+	return step_end(ctx, step, next);
+}
+
+#define DEFINE_STEP(name, rx, tx, batch)				\
+static int VARIANT(name)(struct uuart *ctx, struct uuart_step *step,	\
+			 struct timespec *next)				\
+{									\
+	return VARIANT(step_body)(ctx, step, next, rx, tx, batch);	\
+}
+
+DEFINE_STEP(step_idle,    false, false, false)
+DEFINE_STEP(step_tx_only, false, true,  false)
+DEFINE_STEP(step_rx_only, true,  false, false)
+DEFINE_STEP(step_rx_tx,   true,  true,  false)
+DEFINE_STEP(step_idle_b,    false, false, true)
+DEFINE_STEP(step_tx_only_b, false, true,  true)
+DEFINE_STEP(step_rx_only_b, true,  false, true)
+DEFINE_STEP(step_rx_tx_b,   true,  true,  true)
+
+#undef DEFINE_STEP
+
+/* The same body testing the configuration on every call, to compare against */
+static int VARIANT(step_generic)(struct uuart *ctx, struct uuart_step *step,
+				 struct timespec *next)
+{
+	return VARIANT(step_body)(ctx, step, next, !ctx->cfg.no_rx,
+				  !ctx->cfg.no_tx, ctx->cfg.batch_barriers);
+}
+
+static const struct uuart_io VARIANT(io) = {
+	.readb = io_readb,
+	.writeb = io_writeb,
+	.read = VARIANT(read),
+	.write = VARIANT(write),
+	.step = {
+		[0][0] = { VARIANT(step_idle),    VARIANT(step_idle_b)    },
+		[0][1] = { VARIANT(step_tx_only), VARIANT(step_tx_only_b) },
+		[1][0] = { VARIANT(step_rx_only), VARIANT(step_rx_only_b) },
+		[1][1] = { VARIANT(step_rx_tx),   VARIANT(step_rx_tx_b)   },
+	},
+	.step_generic = VARIANT(step_generic),
+};
@@ -0,0 +1,95 @@
+#!/bin/sh
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (C) 2021 IBM Corp.
+#
+# Discover VUARTs in a fake devicetree and sysfs under UUART_SYSROOT, and check
+# what --discover lists, and when the discovery cache is reused and when it is
+# not. Run from the build directory by make check.
+
+set -eu
+
+UUART=${UUART:-./uuart}
+root=$(mktemp -d)
+trap 'rm -rf "$root"' EXIT
+
+export UUART_SYSROOT=$root
+
+apb=$root/proc/device-tree/ahb/apb
+uio=$root/sys/class/uio/uio0/maps/map0
+
+fail() {
+	echo "FAIL: $*" >&2
+	exit 1
+}
+
+# $1 as a big-endian devicetree cell
+cell() {
+	for shift in 24 16 8 0; do
+		printf "\\$(printf %o $(($1 >> shift & 255)))"
+	done
+}
+
+# A devicetree node at $1 with compatible $2, reg $3 $4 and status $5
+node() {
+	mkdir -p "$apb/$1"
+	printf '%s\0' "$2" > "$apb/$1/compatible"
+	{ cell "$3"; cell "$4"; } > "$apb/$1/reg"
+	printf '%s\0' "$5" > "$apb/$1/status"
+}
+
+# The VUART count a run that selects VUART4, of which there is none, reports
+missing() {
+	if "$UUART" -V 4 2> "$root/err"; then
+		fail "VUART4 was found"
+	fi
+	sed -n 's/.*No VUART4, \([0-9]*\) discovered$/\1/p' "$root/err"
+}
+
+mkdir -p "$apb" "$uio" "$root/proc/sys/kernel/random" "$root/run"
+cell 1 > "$apb/#address-cells"
+cell 1 > "$apb/#size-cells"
+node serial@1e787000 aspeed,ast2500-vuart 0x1e787000 0x1000 okay
+node serial@1e788000 aspeed,ast2500-vuart 0x1e788000 0x1000 disabled
+node serial@1e789000 aspeed,ast2600-vuart 0x1e789000 0x1000 okay
+node serial@1e783000 ns16550a 0x1e783000 0x20 okay
+echo 0x1e787000 > "$uio/addr"
+echo 0x1000 > "$uio/size"
+echo 11111111-1111-1111-1111-111111111111 \
+	> "$root/proc/sys/kernel/random/boot_id"
+
+t=$(printf '\t')
+cat > "$root/want" << EOF
+VUART1${t}0x1e787000${t}0x1000${t}uio0${t}aspeed,ast2500-vuart${t}okay
+VUART2${t}0x1e788000${t}0x1000${t}-${t}aspeed,ast2500-vuart${t}disabled
+VUART3${t}0x1e789000${t}0x1000${t}-${t}aspeed,ast2600-vuart${t}okay
+EOF
+
+"$UUART" -d > "$root/got"
+if ! diff -u "$root/want" "$root/got"; then
+	fail "listing"
+fi
+echo "PASS: listing"
+
+if [ "$(head -n 1 "$root/run/uuart.cache")" != \
+     "boot 11111111-1111-1111-1111-111111111111" ]; then
+	fail "cache not written for this boot"
+fi
+
+# Within a boot the cache stands in for the tree
+rm -r "$apb/serial@1e789000"
+[ "$(missing)" = 3 ] || fail "cache not reused"
+echo "PASS: cache reused"
+
+# A new boot scans again
+echo 22222222-2222-2222-2222-222222222222 \
+	> "$root/proc/sys/kernel/random/boot_id"
+[ "$(missing)" = 2 ] || fail "cache not invalidated by a new boot"
+echo "PASS: cache invalidated by boot_id"
+
+# As does a UIO device rebound to other registers
+node serial@1e789000 aspeed,ast2600-vuart 0x1e789000 0x1000 okay
+echo 0x1e780000 > "$uio/addr"
+[ "$(missing)" = 3 ] || fail "cache not invalidated by a UIO rebind"
+"$UUART" -d | grep -q "^VUART1${t}0x1e787000${t}0x1000${t}-${t}" ||
+	fail "VUART1 still matched to uio0"
+echo "PASS: cache invalidated by UIO rebind"
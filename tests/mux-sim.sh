@@ -0,0 +1,72 @@
+#!/bin/sh
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (C) 2021 IBM Corp.
+#
+# Push data through a --mux channel across a simulated VUART pair that corrupts
+# bytes on the line, and check the channel keeps flowing once frames, and the
+# credit they carry, are lost. Run from the build directory by make check.
+
+set -eu
+
+UUART=${UUART:-./uuart}
+MUXCAT=${MUXCAT:-./tests/muxcat}
+dir=$(mktemp -d)
+pids=
+trap 'kill $pids 2> /dev/null || true; rm -rf "$dir"' EXIT
+
+# Much more than the mux window, so lost credit would stall the sender
+len=262144
+
+mkdir "$dir/a" "$dir/b"
+
+UUART_SIM_CORRUPT=1009 "$UUART" -S "$dir/sim" -q -m "$dir/a" -- -1 \
+	> /dev/null 2> "$dir/a.log" &
+pids="$pids $!"
+UUART_SIM_CORRUPT=1013 "$UUART" -S "$dir/sim" -P -q -m "$dir/b" -- -1 \
+	> /dev/null 2> "$dir/b.log" &
+pids="$pids $!"
+
+tries=0
+until [ -S "$dir/a/bulk" ] && [ -S "$dir/b/bulk" ]; do
+	tries=$((tries + 1))
+	if [ "$tries" -gt 100 ]; then
+		cat "$dir/a.log" "$dir/b.log" >&2
+		echo "FAIL: mux sockets never appeared" >&2
+		exit 1
+	fi
+	sleep 0.1
+done
+
+timeout 120 "$MUXCAT" "$dir/b/bulk" recv 3000 > "$dir/count" &
+recv=$!
+
+if ! timeout 60 "$MUXCAT" "$dir/a/bulk" send "$len"; then
+	echo "FAIL: bulk channel stalled" >&2
+	exit 1
+fi
+
+if ! wait "$recv"; then
+	echo "FAIL: receiver failed" >&2
+	exit 1
+fi
+
+kill $pids
+wait
+pids=
+
+got=$(cat "$dir/count")
+errors=$(sed -n 's/^Mux errors:[[:space:]]*//p' "$dir/b.log")
+
+if [ "$errors" -eq 0 ]; then
+	echo "FAIL: no frames were corrupted" >&2
+	exit 1
+fi
+
+# Lost frames are not resent, but most of the data gets through
+if [ "$got" -lt $((len / 2)) ]; then
+	cat "$dir/a.log" "$dir/b.log" >&2
+	echo "FAIL: received $got of $len bytes" >&2
+	exit 1
+fi
+
+echo "PASS: $got of $len bytes past $errors mux errors"
@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+/*
+ * A client for one uuart --mux channel socket, for the tests.
+ *
+ *   muxcat SOCKET send N	write N bytes to the channel, then close it
+ *   muxcat SOCKET recv MS	read until the channel is idle for MS
+ *				milliseconds, then print the byte count
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int connect_channel(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		errx(EXIT_FAILURE, "socket path too long: %s", path);
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		err(EXIT_FAILURE, "socket");
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		err(EXIT_FAILURE, "connect: %s", path);
+
+	return fd;
+}
+
+static void send_bytes(int fd, unsigned long len)
+{
+	char buf[4096];
+	ssize_t n;
+
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = i % 251;
+
+	while (len) {
+		n = write(fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "write");
+		}
+		len -= n;
+	}
+}
+
+static void recv_bytes(int fd, int idle_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	unsigned long total = 0;
+	char buf[4096];
+	ssize_t n;
+	int rc;
+
+	while ((rc = poll(&pfd, 1, idle_ms))) {
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "poll");
+		}
+
+		n = read(fd, buf, sizeof(buf));
+		if (n < 0)
+			err(EXIT_FAILURE, "read");
+		if (!n)
+			break;
+		total += n;
+	}
+
+	printf("%lu\n", total);
+}
+
+int main(int argc, char *argv[])
+{
+	int fd;
+
+	if (argc != 4)
+		errx(EXIT_FAILURE, "usage: %s SOCKET send|recv N", argv[0]);
+
+	fd = connect_channel(argv[1]);
+
+	if (!strcmp(argv[2], "send"))
+		send_bytes(fd, strtoul(argv[3], NULL, 0));
+	else if (!strcmp(argv[2], "recv"))
+		recv_bytes(fd, atoi(argv[3]));
+	else
+		errx(EXIT_FAILURE, "unknown mode: %s", argv[2]);
+
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,266 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+/*
+ * Overrun a sink under each policy and check what reaches its reader. The
+ * reader first stalls while INPUT bytes arrive, far past the high-water mark,
+ * then drains the pipe a little at a time while the FIFO offers the rest: for
+ * BLOCK what was refused, for SPILL a second INPUT bytes. Last, a spilling
+ * sink is freed with its reader gone, which must keep everything in order.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sink.h"
+#include "uuart.h"
+
+#define SINK_SIZE	8192
+#define INPUT		32768
+/* What the reader takes at a time once it gets going */
+#define READ_SIZE	100
+
+static uint8_t in[2 * INPUT];
+static uint8_t out[2 * INPUT];
+static char spill_path[] = "/tmp/sink-test.XXXXXX";
+
+static bool failed;
+
+/* Fail the test this is in, and move on to the next */
+#define CHECK(cond, ...)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "FAIL: " __VA_ARGS__);		\
+			fprintf(stderr, "\n");				\
+			failed = true;					\
+			return;						\
+		}							\
+	} while (0)
+
+static struct uuart_sink *new_sink(enum uuart_sink_policy policy, int p[2])
+{
+	struct uuart_sink_config cfg = {
+		.size = SINK_SIZE,
+		.policy = policy,
+		.spill_path = policy == UUART_SINK_SPILL ? spill_path : NULL,
+	};
+	struct uuart_sink *s;
+	int rc;
+
+	if (pipe(p))
+		err(EXIT_FAILURE, "pipe");
+
+	if (fcntl(p[0], F_SETFL, O_NONBLOCK))
+		err(EXIT_FAILURE, "fcntl");
+
+	rc = uuart_sink_new(&s, p[1], NULL, &cfg);
+	if (rc < 0) {
+		errno = -rc;
+		err(EXIT_FAILURE, "uuart_sink_new");
+	}
+
+	return s;
+}
+
+/* Offer @len bytes as the FIFO would, UUART_FIFO_SIZE at most at a time */
+static size_t offer(struct uuart_sink *s, const uint8_t *buf, size_t len)
+{
+	if (len > UUART_FIFO_SIZE)
+		len = UUART_FIFO_SIZE;
+
+	return uuart_sink_rx(s, buf, len);
+}
+
+/*
+ * Run @policy through both phases, returning what the reader got in out[].
+ * The stats are taken after the stall, in @stalled, and at the end.
+ */
+static size_t run(enum uuart_sink_policy policy,
+		  struct uuart_sink_stats *stalled,
+		  struct uuart_sink_stats *stats)
+{
+	size_t offered = 0, got = 0, total = INPUT;
+	struct uuart_sink *s;
+	ssize_t n;
+	int p[2];
+
+	s = new_sink(policy, p);
+
+	/* The reader stalls, and nothing is flushed */
+	while (offered < INPUT) {
+		n = offer(s, &in[offered], INPUT - offered);
+		if (!n)
+			break;
+		offered += n;
+	}
+	uuart_sink_stats(s, stalled);
+
+	if (policy == UUART_SINK_SPILL)
+		total += INPUT;
+
+	/* The reader drains slowly as the rest arrives */
+	while (1) {
+		if (offered < total)
+			offered += offer(s, &in[offered], total - offered);
+
+		if (uuart_sink_flush(s) < 0)
+			err(EXIT_FAILURE, "uuart_sink_flush");
+
+		n = read(p[0], &out[got], READ_SIZE);
+		if (n < 0 && errno != EAGAIN)
+			err(EXIT_FAILURE, "read");
+		if (n > 0)
+			got += n;
+
+		if (n <= 0 && offered == total && !uuart_sink_pending(s))
+			break;
+	}
+
+	uuart_sink_stats(s, stats);
+	uuart_sink_free(s);
+	close(p[0]);
+	close(p[1]);
+
+	return got;
+}
+
+static void test_block(void)
+{
+	struct uuart_sink_stats stalled, stats;
+	size_t got = run(UUART_SINK_BLOCK, &stalled, &stats);
+
+	CHECK(stalled.bytes_in == SINK_SIZE, "block took %llu bytes stalled",
+	      (unsigned long long)stalled.bytes_in);
+	CHECK(stalled.throttles == 1, "block throttled %llu times stalled",
+	      (unsigned long long)stalled.throttles);
+	CHECK(stats.refused && !stats.dropped,
+	      "block refused %llu and dropped %llu bytes",
+	      (unsigned long long)stats.refused,
+	      (unsigned long long)stats.dropped);
+	CHECK(got == INPUT && !memcmp(out, in, INPUT),
+	      "block delivered %zu bytes, not the input", got);
+
+	printf("PASS: block kept all %d bytes, throttles %llu\n", INPUT,
+	       (unsigned long long)stats.throttles);
+}
+
+static void test_drop_oldest(void)
+{
+	struct uuart_sink_stats stalled, stats;
+	size_t got = run(UUART_SINK_DROP_OLDEST, &stalled, &stats);
+
+	CHECK(stats.dropped == INPUT - SINK_SIZE,
+	      "drop-oldest dropped %llu bytes",
+	      (unsigned long long)stats.dropped);
+	CHECK(stats.refused == 0, "drop-oldest refused %llu bytes",
+	      (unsigned long long)stats.refused);
+	CHECK(got == SINK_SIZE &&
+	      !memcmp(out, &in[INPUT - SINK_SIZE], SINK_SIZE),
+	      "drop-oldest delivered %zu bytes, not the newest", got);
+
+	printf("PASS: drop-oldest kept the last %d bytes, dropping %llu\n",
+	       SINK_SIZE, (unsigned long long)stats.dropped);
+}
+
+static void test_drop_newest(void)
+{
+	struct uuart_sink_stats stalled, stats;
+	size_t got = run(UUART_SINK_DROP_NEWEST, &stalled, &stats);
+
+	CHECK(stats.dropped == INPUT - SINK_SIZE,
+	      "drop-newest dropped %llu bytes",
+	      (unsigned long long)stats.dropped);
+	CHECK(stats.refused == 0, "drop-newest refused %llu bytes",
+	      (unsigned long long)stats.refused);
+	CHECK(got == SINK_SIZE && !memcmp(out, in, SINK_SIZE),
+	      "drop-newest delivered %zu bytes, not the oldest", got);
+
+	printf("PASS: drop-newest kept the first %d bytes, dropping %llu\n",
+	       SINK_SIZE, (unsigned long long)stats.dropped);
+}
+
+static void test_spill(void)
+{
+	struct uuart_sink_stats stalled, stats;
+	size_t got = run(UUART_SINK_SPILL, &stalled, &stats);
+
+	CHECK(stalled.spilled == INPUT - SINK_SIZE,
+	      "spill spilled %llu bytes stalled",
+	      (unsigned long long)stalled.spilled);
+	CHECK(stats.replayed == stats.spilled,
+	      "spill replayed %llu of %llu bytes",
+	      (unsigned long long)stats.replayed,
+	      (unsigned long long)stats.spilled);
+	CHECK(stats.dropped == 0 && stats.refused == 0,
+	      "spill dropped %llu and refused %llu bytes",
+	      (unsigned long long)stats.dropped,
+	      (unsigned long long)stats.refused);
+	CHECK(got == 2 * INPUT && !memcmp(out, in, 2 * INPUT),
+	      "spill delivered %zu bytes, not the input in order", got);
+
+	printf("PASS: spill kept all %d bytes in order, spilling %llu\n",
+	       2 * INPUT, (unsigned long long)stats.spilled);
+}
+
+/* Freed with the reader gone, the spill file keeps it all, buffer first */
+static void test_spill_free(void)
+{
+	struct uuart_sink *s;
+	size_t offered = 0;
+	FILE *f;
+	size_t n;
+	int p[2];
+
+	s = new_sink(UUART_SINK_SPILL, p);
+
+	while (offered < INPUT)
+		offered += offer(s, &in[offered], INPUT - offered);
+
+	close(p[0]);
+	uuart_sink_free(s);
+	close(p[1]);
+
+	f = fopen(spill_path, "re");
+	CHECK(f, "spill file gone after a failed write");
+	n = fread(out, 1, sizeof(out), f);
+	fclose(f);
+
+	CHECK(n == INPUT && !memcmp(out, in, INPUT),
+	      "spill file kept %zu bytes, not the input in order", n);
+
+	printf("PASS: spill kept all %d bytes in order when freed\n", INPUT);
+}
+
+int main(void)
+{
+	int fd;
+
+	/* The freed sink's reader is gone */
+	signal(SIGPIPE, SIG_IGN);
+
+	fd = mkstemp(spill_path);
+	if (fd < 0)
+		err(EXIT_FAILURE, "mkstemp");
+	close(fd);
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(in); i++)
+		in[i] = rand();
+
+	test_block();
+	test_drop_oldest();
+	test_drop_newest();
+	test_spill();
+	test_spill_free();
+
+	unlink(spill_path);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,60 @@
+#!/bin/sh
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (C) 2021 IBM Corp.
+#
+# Send files both ways across a simulated VUART pair with --send and --recv,
+# and check they arrive intact. Run from the build directory by make check.
+
+set -eu
+
+UUART=${UUART:-./uuart}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# Send $1 bytes from side $2 to the other, through the simulator file $3
+round_trip() {
+	len=$1
+	side=$2
+	sim=$dir/sim$3
+
+	if [ "$side" = 0 ]; then
+		send_flags=
+		recv_flags=-P
+	else
+		send_flags=-P
+		recv_flags=
+	fi
+
+	head -c "$len" /dev/urandom > "$dir/in"
+	rm -f "$dir/out"
+
+	timeout 60 "$UUART" -S "$sim" $recv_flags -q -r "$dir/out" -- -1 \
+		2> "$dir/recv.log" &
+	recv=$!
+
+	if ! timeout 60 "$UUART" -S "$sim" $send_flags -q -s "$dir/in" -- -1 \
+		2> "$dir/send.log"; then
+		cat "$dir/send.log" >&2
+		kill "$recv" 2> /dev/null || true
+		return 1
+	fi
+
+	if ! wait "$recv"; then
+		cat "$dir/recv.log" >&2
+		return 1
+	fi
+
+	if ! cmp "$dir/in" "$dir/out"; then
+		echo "FAIL: $len bytes from side $side" >&2
+		return 1
+	fi
+
+	echo "PASS: $len bytes from side $side"
+}
+
+round_trip 65536 0 a
+round_trip 65536 1 b
+# Neither a whole number of packets nor of windows
+round_trip 100003 0 c
+round_trip 1 1 d
+round_trip 0 0 e
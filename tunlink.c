@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "tunlink.h"
+
+struct tunlink {
+	struct uuart_slip *slip;
+	int fd;
+	size_t mtu;
+	/* A packet read from the interface that the encoder had no room for */
+	size_t pend_len;
+	uint8_t buf[];
+};
+
+int tunlink_open(struct tunlink **tp, struct uuart_slip *slip, const char *name,
+		 size_t mtu)
+{
+	struct ifreq ifr = { .ifr_flags = IFF_TUN | IFF_NO_PI };
+	struct tunlink *t;
+	int rc;
+
+	if (strlen(name) >= sizeof(ifr.ifr_name))
+		return -ENAMETOOLONG;
+
+	strcpy(ifr.ifr_name, name);
+
+	t = calloc(1, sizeof(*t) + mtu);
+	if (!t)
+		return -errno;
+
+	t->fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (t->fd < 0) {
+		rc = -errno;
+		goto cleanup_t;
+	}
+
+	if (ioctl(t->fd, TUNSETIFF, &ifr)) {
+		rc = -errno;
+		goto cleanup_fd;
+	}
+
+	t->slip = slip;
+	t->mtu = mtu;
+
+	*tp = t;
+
+	return 0;
+
+cleanup_fd:
+	close(t->fd);
+
+cleanup_t:
+	free(t);
+
+	return rc;
+}
+
+void tunlink_close(struct tunlink *t)
+{
+	close(t->fd);
+	free(t);
+}
+
+int tunlink_service(struct tunlink *t)
+{
+	ssize_t n;
+	int rc;
+
+	/* Interface to VUART, until the encoder fills up */
+	while (1) {
+		if (!t->pend_len) {
+			n = read(t->fd, t->buf, t->mtu);
+			if (n < 0) {
+				/* EIO until the interface is brought up */
+				if (errno == EAGAIN || errno == EIO)
+					break;
+				return -errno;
+			}
+			t->pend_len = n;
+		}
+
+		rc = uuart_slip_send(t->slip, t->buf, t->pend_len);
+		if (rc == -EAGAIN)
+			break;
+
+		t->pend_len = 0;
+	}
+
+	/* VUART to interface; the kernel drops what it can't queue */
+	while (1) {
+		uint8_t pkt[t->mtu];
+
+		n = uuart_slip_recv(t->slip, pkt, t->mtu);
+		if (n <= 0)
+			return n;
+
+		if (write(t->fd, pkt, n) < 0 && errno != EAGAIN && errno != EIO)
+			return -errno;
+	}
+}
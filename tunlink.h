@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef TUNLINK_H
+#define TUNLINK_H
+
+#include <stddef.h>
+
+#include "slip.h"
+
+struct tunlink;
+
+/*
+ * Attach to the TUN interface @name, creating it if needed, and bridge its
+ * packets through @slip.
+ */
+int tunlink_open(struct tunlink **tp, struct uuart_slip *slip, const char *name,
+		 size_t mtu);
+void tunlink_close(struct tunlink *t);
+
+/* Move packets between the interface and the codec without blocking */
+int tunlink_service(struct tunlink *t);
+
+#endif
@@ -0,0 +1,327 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "txq.h"
+
+/*
+ * Each lane is an intrusive MPSC queue in the style of Dmitry Vyukov's: a
+ * producer publishes with a single exchange on the head and then links the
+ * previous node to the new one, and the single consumer walks from the tail.
+ * A stub node keeps the queue non-empty so neither side needs a lock.
+ */
+struct txq_node {
+	_Atomic(struct txq_node *) next;
+};
+
+struct txq_lane {
+	_Atomic(struct txq_node *) head;
+	struct txq_node *tail;
+	struct txq_node stub;
+};
+
+struct txq_msg {
+	struct txq_node node;
+	struct uuart_txq_producer *producer;
+	uint64_t queued_ns;
+	size_t len;
+	uint8_t data[];
+};
+
+struct uuart_txq_producer {
+	struct uuart_txq_producer *next;
+	struct uuart_txq *q;
+	char *name;
+	/* Written by the consumer only, read by anyone */
+	_Atomic uint64_t msgs;
+	_Atomic uint64_t bytes;
+	_Atomic uint64_t latency_total_ns;
+	_Atomic uint64_t latency_max_ns;
+};
+
+enum { LANE_URGENT, LANE_NORMAL, NR_LANES };
+
+struct uuart_txq {
+	struct txq_lane lanes[NR_LANES];
+	size_t limit;
+	_Atomic size_t queued;
+
+	/* Consumer state: the message being drained */
+	struct txq_msg *cur;
+	size_t off;
+
+	pthread_mutex_t lock;
+	struct uuart_txq_producer *producers;
+	struct uuart_txq_producer **tail;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void lane_init(struct txq_lane *lane)
+{
+	atomic_init(&lane->stub.next, NULL);
+	atomic_init(&lane->head, &lane->stub);
+	lane->tail = &lane->stub;
+}
+
+static void lane_push(struct txq_lane *lane, struct txq_node *node)
+{
+	struct txq_node *prev;
+
+	atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+	prev = atomic_exchange_explicit(&lane->head, node, memory_order_acq_rel);
+	atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/*
+ * Returns NULL if the lane is empty, or if a producer is between its exchange
+ * and its link; in the latter case the message shows up on a later call.
+ */
+static struct txq_node *lane_pop(struct txq_lane *lane)
+{
+	struct txq_node *tail = lane->tail;
+	struct txq_node *next;
+
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+	if (tail == &lane->stub) {
+		if (!next)
+			return NULL;
+		lane->tail = next;
+		tail = next;
+		next = atomic_load_explicit(&next->next, memory_order_acquire);
+	}
+
+	if (next) {
+		lane->tail = next;
+		return tail;
+	}
+
+	if (tail != atomic_load_explicit(&lane->head, memory_order_acquire))
+		return NULL;
+
+	lane_push(lane, &lane->stub);
+
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	if (next) {
+		lane->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+int uuart_txq_new(struct uuart_txq **qp, size_t limit)
+{
+	struct uuart_txq *q;
+	int rc;
+
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return -errno;
+
+	for (int i = 0; i < NR_LANES; i++)
+		lane_init(&q->lanes[i]);
+
+	q->limit = limit;
+	atomic_init(&q->queued, 0);
+	q->tail = &q->producers;
+
+	rc = pthread_mutex_init(&q->lock, NULL);
+	if (rc) {
+		free(q);
+		return -rc;
+	}
+
+	*qp = q;
+
+	return 0;
+}
+
+void uuart_txq_free(struct uuart_txq *q)
+{
+	struct uuart_txq_producer *p, *next;
+	struct txq_node *node;
+
+	free(q->cur);
+
+	for (int i = 0; i < NR_LANES; i++) {
+		while ((node = lane_pop(&q->lanes[i])))
+			free(node);
+	}
+
+	for (p = q->producers; p; p = next) {
+		next = p->next;
+		free(p->name);
+		free(p);
+	}
+
+	pthread_mutex_destroy(&q->lock);
+	free(q);
+}
+
+int uuart_txq_producer_new(struct uuart_txq *q, const char *name,
+			   struct uuart_txq_producer **pp)
+{
+	struct uuart_txq_producer *p;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -errno;
+
+	p->name = strdup(name);
+	if (!p->name) {
+		free(p);
+		return -ENOMEM;
+	}
+
+	p->q = q;
+
+	pthread_mutex_lock(&q->lock);
+	*q->tail = p;
+	q->tail = &p->next;
+	pthread_mutex_unlock(&q->lock);
+
+	*pp = p;
+
+	return 0;
+}
+
+int uuart_txq_write(struct uuart_txq_producer *p, const void *buf, size_t len,
+		    unsigned int flags)
+{
+	struct uuart_txq *q = p->q;
+	struct txq_msg *msg;
+	size_t queued;
+
+	if (!len)
+		return 0;
+
+	queued = atomic_fetch_add_explicit(&q->queued, len,
+					   memory_order_relaxed);
+	if (q->limit && queued + len > q->limit && queued) {
+		atomic_fetch_sub_explicit(&q->queued, len, memory_order_relaxed);
+		return -EAGAIN;
+	}
+
+	msg = malloc(sizeof(*msg) + len);
+	if (!msg) {
+		atomic_fetch_sub_explicit(&q->queued, len, memory_order_relaxed);
+		return -ENOMEM;
+	}
+
+	msg->producer = p;
+	msg->len = len;
+	memcpy(msg->data, buf, len);
+	msg->queued_ns = now_ns();
+
+	lane_push(&q->lanes[(flags & UUART_TXQ_URGENT) ? LANE_URGENT : LANE_NORMAL],
+		  &msg->node);
+
+	return 0;
+}
+
+static void account(struct txq_msg *msg)
+{
+	struct uuart_txq_producer *p = msg->producer;
+	uint64_t latency = now_ns() - msg->queued_ns;
+
+	atomic_fetch_add_explicit(&p->msgs, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&p->bytes, msg->len, memory_order_relaxed);
+	atomic_fetch_add_explicit(&p->latency_total_ns, latency,
+				  memory_order_relaxed);
+	if (latency > atomic_load_explicit(&p->latency_max_ns,
+					   memory_order_relaxed))
+		atomic_store_explicit(&p->latency_max_ns, latency,
+				      memory_order_relaxed);
+}
+
+size_t uuart_txq_fill(void *priv, uint8_t *buf, size_t len)
+{
+	struct uuart_txq *q = priv;
+	size_t filled = 0;
+	size_t n;
+
+	while (filled < len) {
+		/* Urgent messages only overtake at message boundaries */
+		if (!q->cur) {
+			struct txq_node *node;
+
+			node = lane_pop(&q->lanes[LANE_URGENT]);
+			if (!node)
+				node = lane_pop(&q->lanes[LANE_NORMAL]);
+			if (!node)
+				break;
+
+			q->cur = (struct txq_msg *)node;
+			q->off = 0;
+		}
+
+		n = q->cur->len - q->off;
+		if (n > len - filled)
+			n = len - filled;
+
+		memcpy(&buf[filled], &q->cur->data[q->off], n);
+		q->off += n;
+		filled += n;
+
+		if (q->off == q->cur->len) {
+			account(q->cur);
+			free(q->cur);
+			q->cur = NULL;
+		}
+	}
+
+	atomic_fetch_sub_explicit(&q->queued, filled, memory_order_relaxed);
+
+	return filled;
+}
+
+size_t uuart_txq_queued(struct uuart_txq *q)
+{
+	return atomic_load_explicit(&q->queued, memory_order_relaxed);
+}
+
+const char *uuart_txq_producer_name(const struct uuart_txq_producer *p)
+{
+	return p->name;
+}
+
+void uuart_txq_producer_stats(const struct uuart_txq_producer *p,
+			      struct uuart_txq_stats *stats)
+{
+	stats->msgs = atomic_load_explicit(&p->msgs, memory_order_relaxed);
+	stats->bytes = atomic_load_explicit(&p->bytes, memory_order_relaxed);
+	stats->latency_total_ns =
+		atomic_load_explicit(&p->latency_total_ns, memory_order_relaxed);
+	stats->latency_max_ns =
+		atomic_load_explicit(&p->latency_max_ns, memory_order_relaxed);
+}
+
+void uuart_txq_for_each_producer(struct uuart_txq *q,
+				 void (*fn)(struct uuart_txq_producer *p,
+					    void *arg),
+				 void *arg)
+{
+	struct uuart_txq_producer *p;
+
+	pthread_mutex_lock(&q->lock);
+	for (p = q->producers; p; p = p->next)
+		fn(p, arg);
+	pthread_mutex_unlock(&q->lock);
+}
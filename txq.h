@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_TXQ_H
+#define UUART_TXQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Jump ahead of normal messages at the next message boundary */
+#define UUART_TXQ_URGENT	(1U << 0)
+
+struct uuart_txq;
+struct uuart_txq_producer;
+
+struct uuart_txq_stats {
+	uint64_t msgs;
+	uint64_t bytes;
+	/* Time from uuart_txq_write() until the last byte left the queue */
+	uint64_t latency_total_ns;
+	uint64_t latency_max_ns;
+};
+
+/*
+ * A multi-producer, single-consumer queue of Tx messages. Producers may call
+ * uuart_txq_write() from any thread without locking. The consumer drains it
+ * with uuart_txq_fill(), which has the signature of uuart_ops.tx, so the
+ * queue can be plugged straight into uuart_step().
+ *
+ * @limit bounds the bytes queued across all producers, zero for no bound.
+ */
+int uuart_txq_new(struct uuart_txq **qp, size_t limit);
+
+/* Free the queue, its producers and any undelivered messages */
+void uuart_txq_free(struct uuart_txq *q);
+
+/* Producers are owned by the queue and live until uuart_txq_free() */
+int uuart_txq_producer_new(struct uuart_txq *q, const char *name,
+			   struct uuart_txq_producer **pp);
+
+/*
+ * Queue @len bytes as a single message. The bytes reach the device in order
+ * and are never interleaved with another message. Returns zero on success,
+ * -EAGAIN if the queue limit would be exceeded, or another negative errno.
+ */
+int uuart_txq_write(struct uuart_txq_producer *p, const void *buf, size_t len,
+		    unsigned int flags);
+
+/* Consumer side: copy up to @len queued bytes to @buf, returning the count */
+size_t uuart_txq_fill(void *q, uint8_t *buf, size_t len);
+
+/* Bytes accepted by uuart_txq_write() but not yet consumed */
+size_t uuart_txq_queued(struct uuart_txq *q);
+
+const char *uuart_txq_producer_name(const struct uuart_txq_producer *p);
+void uuart_txq_producer_stats(const struct uuart_txq_producer *p,
+			      struct uuart_txq_stats *stats);
+
+/* Call @fn for each producer in creation order */
+void uuart_txq_for_each_producer(struct uuart_txq *q,
+				 void (*fn)(struct uuart_txq_producer *p,
+					    void *arg),
+				 void *arg);
+
+#endif
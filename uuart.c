@@ -3,272 +3,1716 @@
 
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
-#include <sys/types.h>
-#include <sys/stat.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
-#define BIT(x) (1UL << (unsigned long)(x))
-
-#define D_VUART1		0x1e787000
-#define D_VUART2		0x1e788000
-
-#define R_RBR			0x00
-#define R_THR			0x00
-#define R_DLL			0x00
-#define R_IER			0x04
-#define   IER_ERBFI		BIT(0)
-#define   IER_ETBEI		BIT(1)
-#define   IER_ELSI		BIT(2)
-#define   IER_EDSSI		BIT(3)
-#define R_DLM			0x04
-#define R_IIR			0x08
-#define R_FCR			0x08
-#define R_LCR			0x0c
-#define R_MCR			0x10
-#define R_LSR			0x14
-#define   LSR_DR		BIT(0)
-#define   LSR_OE		BIT(1)
-#define   LSR_PE		BIT(2)
-#define   LSR_FE		BIT(3)
-#define   LSR_BI		BIT(4)
-#define   LSR_THRE		BIT(5)
-#define   LSR_TEMT		BIT(6)
-#define   LSR_RFE		BIT(7)
-#define R_MSR			0x18
-#define R_SCR			0x1c
-#define R_GCRA			0x20
-#define   GCRA_H_RFT		(BIT(7) | BIT(6))
-#define   GCRA_H_TX_CORK	BIT(5)
-#define   GCRA_H_LOOP		BIT(4)
-#define   GCRA_S_TIMEOUT	(BIT(3) | BIT(2))
-#define   GCRA_SIRQ_POL		BIT(1)
-#define   GCRA_VUART_EN		BIT(0)
-#define R_GCRB			0x24
-#define R_VARL			0x28
-#define R_VARH			0x2c
-#define R_GCRE			0x30
-#define R_GCRF			0x34
-#define R_GCRG			0x38
-#define R_GCRH			0x3c
-
-#ifdef __ARM_ARCH
-#define mb() asm volatile("dmb 3\n" : : : "memory")
-#else
-#error Unsupported host architecture!
-#endif
-
-static uint8_t readb(const volatile void *regs, unsigned long offset)
-{
-	uint8_t val;
-
-	val = ((const volatile uint8_t *)regs)[offset];
-	mb();
-	return val;
-}
-
-static void writeb(volatile void *regs, unsigned long offset, uint8_t val)
-{
-	((volatile uint8_t *)regs)[offset] = val;
-	mb();
-}
-
-static void dump_regs(const volatile void *regs, unsigned long dev)
-{
-	fprintf(stderr, "\t0x%08lx\tIER:\t0x%02x\n", dev + R_IER, readb(regs, R_IER));
-	fprintf(stderr, "\t0x%08lx\tIIR:\t0x%02x\n", dev + R_IIR, readb(regs, R_IIR));
-	fprintf(stderr, "\t0x%08lx\tLCR:\t0x%02x\n", dev + R_LCR, readb(regs, R_LCR));
-	fprintf(stderr, "\t0x%08lx\tMCR:\t0x%02x\n", dev + R_MCR, readb(regs, R_MCR));
-	fprintf(stderr, "\t0x%08lx\tLSR:\t0x%02x\n", dev + R_LSR, readb(regs, R_LSR));
-	fprintf(stderr, "\t0x%08lx\tMSR:\t0x%02x\n", dev + R_MSR, readb(regs, R_MSR));
-	fprintf(stderr, "\t0x%08lx\tGCRA:\t0x%02x\n", dev + R_GCRA, readb(regs, R_GCRA));
-	fprintf(stderr, "\t0x%08lx\tGCRB:\t0x%02x\n", dev + R_GCRB, readb(regs, R_GCRB));
-	fprintf(stderr, "\t0x%08lx\tVARL:\t0x%02x\n", dev + R_VARL, readb(regs, R_VARL));
-	fprintf(stderr, "\t0x%08lx\tVARH:\t0x%02x\n", dev + R_VARH, readb(regs, R_VARH));
-	fprintf(stderr, "\t0x%08lx\tGCRE:\t0x%02x\n", dev + R_GCRE, readb(regs, R_GCRE));
-	fprintf(stderr, "\t0x%08lx\tGCRF:\t0x%02x\n", dev + R_GCRF, readb(regs, R_GCRF));
-	fprintf(stderr, "\t0x%08lx\tGCRG:\t0x%02x\n", dev + R_GCRG, readb(regs, R_GCRG));
-	fprintf(stderr, "\t0x%08lx\tGCRH:\t0x%02x\n", dev + R_GCRH, readb(regs, R_GCRH));
-}
-
-struct uuart_config {
-	bool assume_dtr;
-	bool assume_enabled;
-	bool assume_fifos;
-	bool no_rx;
-	bool no_tx;
+#include "boot.h"
+#include "capture.h"
+#include "ctlsock.h"
+#include "discover.h"
+#include "index.h"
+#include "mux.h"
+#include "muxsock.h"
+#include "profile.h"
+#include "scrollback.h"
+#include "sink.h"
+#include "slip.h"
+#include "tunlink.h"
+#include "txq.h"
+#include "uuart.h"
+#include "xfer.h"
+#include "zlog.h"
+
+static struct uuart *dev;
+static volatile sig_atomic_t terminate;
+
+/* The devices --capture drives instead of dev */
+static struct uuart *capture_devs[UUART_CAPTURE_MAX];
+static size_t nr_capture_devs;
+
+static void restore_regs(void)
+{
+	if (dev)
+		uuart_restore(dev);
+
+	for (size_t i = 0; i < nr_capture_devs; i++)
+		uuart_restore(capture_devs[i]);
+}
+
+static void handle_signal(int signo)
+{
+	(void)signo;
+
+	terminate = 1;
+}
+
+static void install_handlers(void)
+{
+	static const int signals[] = { SIGHUP, SIGINT, SIGPIPE, SIGTERM };
+	struct sigaction sa = {0};
+
+	/* A second signal takes the default action if the loop is wedged */
+	sa.sa_handler = handle_signal;
+	sa.sa_flags = SA_RESETHAND;
+	sigemptyset(&sa.sa_mask);
+
+	for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+		if (sigaction(signals[i], &sa, NULL))
+			err(EXIT_FAILURE, "sigaction");
+	}
+
+	if (atexit(restore_regs))
+		errx(EXIT_FAILURE, "atexit");
+}
+
+/*
+ * An output file, and the compressor in front of it if there is one, or the
+ * raw zlog that keeps its index
+ */
+struct cli_output {
+	const char *path;
+	int fd;
+	struct uuart_zlog *zlog;
+	struct uuart_index *index;
+	bool compress;
+};
+
+static struct cli_output outputs[UUART_CAPTURE_MAX + 1];
+static size_t nr_outputs;
+
+/*
+ * Open @path, or stdout if it is NULL, for appending, through a compressor if
+ * @compress and keeping an index of it if @index. Returns the fd to write to.
+ */
+static int open_output(const char *path, bool compress, bool index)
+{
+	struct uuart_zlog_config zcfg = {0};
+	struct cli_output *out;
+	int input;
+	int rc;
+
+	assert(nr_outputs < sizeof(outputs) / sizeof(outputs[0]));
+	out = &outputs[nr_outputs++];
+	out->path = path ? path : "stdout";
+	out->fd = STDOUT_FILENO;
+	out->zlog = NULL;
+	out->index = NULL;
+	out->compress = compress;
+
+	if (index && !path)
+		errx(EXIT_FAILURE, "Only an output file can be indexed");
+
+	if (path) {
+		/* Read too, so the index can catch up with the file */
+		out->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+			       0644);
+		if (out->fd < 0)
+			err(EXIT_FAILURE, "open: %s", path);
+	}
+
+	if (index) {
+		rc = uuart_index_open(&out->index, path, out->fd, compress);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "uuart_index_open: %s", path);
+		}
+		zcfg.index = out->index;
+		zcfg.raw = !compress;
+	} else if (!compress) {
+		return out->fd;
+	}
+
+	rc = uuart_zlog_open(&out->zlog, out->fd, &zcfg, &input);
+	if (rc < 0) {
+		errno = -rc;
+		err(EXIT_FAILURE, "uuart_zlog_open");
+	}
+
+	return input;
+}
+
+/* Close the outputs, once nothing writes to them any more */
+static void close_outputs(void)
+{
+	struct uuart_zlog_stats stats;
+	struct cli_output *out;
+
+	for (size_t i = 0; i < nr_outputs; i++) {
+		out = &outputs[i];
+		if (out->zlog)
+			uuart_zlog_close(out->zlog, &stats);
+		if (out->index)
+			uuart_index_close(out->index);
+		if (out->fd != STDOUT_FILENO)
+			close(out->fd);
+		if (!out->compress)
+			continue;
+
+		fprintf(stderr,
+			"%s:\t%llu bytes compressed to %llu in %llu blocks, ratio %.2f, %.1f ns/byte, %.1f MiB/s per core, %llu write errors\n",
+			out->path, (unsigned long long)stats.raw_bytes,
+			(unsigned long long)stats.file_bytes,
+			(unsigned long long)stats.blocks,
+			stats.file_bytes ?
+				(double)stats.raw_bytes / stats.file_bytes : 0.0,
+			stats.raw_bytes ?
+				(double)stats.cpu_ns / stats.raw_bytes : 0.0,
+			stats.cpu_ns ? stats.raw_bytes * 1e9 / stats.cpu_ns /
+				       (1024 * 1024) : 0.0,
+			(unsigned long long)stats.write_errors);
+	}
+
+	nr_outputs = 0;
+}
+
+/* Where the default console mode sends and gets its data */
+struct cli_io {
+	struct uuart_sink *sink;
+	struct uuart_txq *txq;
+	struct uuart_scrollback *sb;
+	struct uuart_boot *boot;
+	FILE *boot_out;
+};
+
+static size_t rx_sink(void *priv, const uint8_t *buf, size_t len)
+{
+	struct cli_io *io = priv;
+	size_t n;
+
+	n = uuart_sink_rx(io->sink, buf, len);
+	if (io->sb)
+		uuart_scrollback_write(io->sb, buf, n);
+	if (io->boot)
+		uuart_boot_rx(io->boot, buf, n);
+
+	return n;
+}
+
+static size_t tx_yes(void *priv, uint8_t *buf, size_t len)
+{
+	(void)priv;
+
+	memset(buf, 'y', len);
+
+	return len;
+}
+
+static size_t tx_txq(void *priv, uint8_t *buf, size_t len)
+{
+	struct cli_io *io = priv;
+
+	return uuart_txq_fill(io->txq, buf, len);
+}
+
+static const struct uuart_ops cli_ops = {
+	.rx = rx_sink,
+	.tx = tx_yes,
+};
+
+static const struct uuart_ops txq_ops = {
+	.rx = rx_sink,
+	.tx = tx_txq,
+};
+
+static void report_flow(const struct uuart *dev, FILE *stream)
+{
+	struct uuart_flow_stats stats;
+
+	uuart_flow_stats(dev, &stats);
+
+	fprintf(stream, "Throttled:\t%llu times, %llu ns\n",
+		(unsigned long long)stats.throttles,
+		(unsigned long long)stats.throttled_ns);
+	fprintf(stream, "Tx held:\t%llu times, %llu ns\n",
+		(unsigned long long)stats.tx_holds,
+		(unsigned long long)stats.tx_held_ns);
+}
+
+static void report_cork(const struct uuart *dev, FILE *stream)
+{
+	struct uuart_cork_stats stats;
+
+	uuart_cork_stats(dev, &stats);
+
+	fprintf(stream,
+		"Tx bursts:\t%llu, avg %.1f max %llu bytes, %llu timed out, added latency avg %llu max %llu ns\n",
+		(unsigned long long)stats.bursts,
+		stats.bursts ? (double)stats.bytes / stats.bursts : 0,
+		(unsigned long long)stats.max_burst,
+		(unsigned long long)stats.timeouts,
+		(unsigned long long)(stats.bursts ?
+				     stats.latency_total_ns / stats.bursts : 0),
+		(unsigned long long)stats.latency_max_ns);
+}
+
+static void report_pace(const struct uuart *dev, unsigned long rate,
+			FILE *stream)
+{
+	struct uuart_pace_stats stats;
+
+	uuart_pace_stats(dev, &stats);
+
+	fprintf(stream,
+		"Tx pacing:\t%llu bytes, target %lu B/s, achieved %.1f B/s, %llu waits, jitter p50 %.1f p90 %.1f p99 %.1f max %.1f us\n",
+		(unsigned long long)stats.bytes, rate,
+		stats.rate_ns ? stats.rate_bytes * 1e9 / stats.rate_ns : 0,
+		(unsigned long long)stats.waits,
+		uuart_hist_quantile(&stats.jitter, 0.5) / 1e3,
+		uuart_hist_quantile(&stats.jitter, 0.9) / 1e3,
+		uuart_hist_quantile(&stats.jitter, 0.99) / 1e3,
+		stats.jitter.max / 1e3);
+}
+
+static void report_fifo_dir(FILE *stream, const char *name,
+			    const uint64_t *hist, unsigned int level)
+{
+	uint64_t bursts = 0, bytes = 0;
+
+	for (size_t b = 1; b <= UUART_FIFO_SIZE; b++) {
+		bursts += hist[b];
+		bytes += hist[b] * b;
+	}
+
+	fprintf(stream,
+		"%s:\t%llu bursts, avg %.1f bytes, trigger %u, %.3f interrupts/byte (%.3f at trigger 1)\n",
+		name, (unsigned long long)bursts,
+		bursts ? (double)bytes / bursts : 0, level,
+		uuart_fifo_irqs_per_byte(hist, level),
+		uuart_fifo_irqs_per_byte(hist, 1));
+}
+
+static void report_fifo(const struct uuart *dev, FILE *stream)
+{
+	struct uuart_fifo_stats stats;
+
+	uuart_fifo_stats(dev, &stats);
+
+	report_fifo_dir(stream, "Rx FIFO", stats.rx_bursts, stats.rx_trigger);
+	report_fifo_dir(stream, "Host FIFO", stats.tx_bursts,
+			stats.host_rx_trigger);
+	fprintf(stream, "FIFO retunes:\t%llu\n",
+		(unsigned long long)stats.retunes);
+}
+
+#define TXQ_LIMIT		65536
+
+static void *stdin_producer(void *arg)
+{
+	static const struct timespec backoff = { .tv_nsec = 100000 };
+	struct uuart_txq_producer *p = arg;
+	uint8_t buf[256];
+	ssize_t len;
+	int rc;
+
+	while ((len = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+		while ((rc = uuart_txq_write(p, buf, len, 0)) == -EAGAIN)
+			nanosleep(&backoff, NULL);
+
+		if (rc < 0) {
+			errno = -rc;
+			warn("uuart_txq_write");
+			break;
+		}
+	}
+
+	if (len < 0)
+		warn("read");
+
+	return NULL;
+}
+
+static void start_stdin_producer(struct uuart_txq *q)
+{
+	struct uuart_txq_producer *p;
+	pthread_t thread;
+	int rc;
+
+	rc = uuart_txq_producer_new(q, "stdin", &p);
+	if (rc < 0) {
+		errno = -rc;
+		err(EXIT_FAILURE, "uuart_txq_producer_new");
+	}
+
+	rc = pthread_create(&thread, NULL, stdin_producer, p);
+	if (rc) {
+		errno = rc;
+		err(EXIT_FAILURE, "pthread_create");
+	}
+
+	pthread_detach(thread);
+}
+
+static void report_producer(struct uuart_txq_producer *p, void *arg)
+{
+	struct uuart_txq_stats stats;
+
+	(void)arg;
+
+	uuart_txq_producer_stats(p, &stats);
+	fprintf(stderr,
+		"Producer %s:\t%llu messages, %llu bytes, latency avg %llu max %llu ns\n",
+		uuart_txq_producer_name(p),
+		(unsigned long long)stats.msgs,
+		(unsigned long long)stats.bytes,
+		(unsigned long long)(stats.msgs ?
+				     stats.latency_total_ns / stats.msgs : 0),
+		(unsigned long long)stats.latency_max_ns);
+}
+
+static const struct uuart_ops mux_ops = {
+	.rx = uuart_mux_link_rx,
+	.tx = uuart_mux_link_tx,
+};
+
+/* Interactive traffic goes first, and bulk frames stay short behind it */
+static const struct uuart_mux_channel_config mux_channels[] = {
+	{ .name = "console",   .prio = 0, .max_frame = 16  },
+	{ .name = "telemetry", .prio = 1, .max_frame = 64  },
+	{ .name = "bulk",      .prio = 2, .max_frame = 128 },
+};
+
+#define MUX_WINDOW		4096
+#define MUX_SERVICE_INTERVAL	32
+
+static double elapsed_s(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+	       (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void report_mux(const struct uuart_mux *mux, double secs)
+{
+	struct uuart_mux_stats stats;
+
+	for (size_t i = 0; i < uuart_mux_channels(mux); i++) {
+		uuart_mux_stats(mux, i, &stats);
+		fprintf(stderr,
+			"Channel %s:\tTx %llu bytes (%.0f B/s), Rx %llu bytes (%.0f B/s), latency avg %llu max %llu ns, stalled %llu ns\n",
+			uuart_mux_channel_name(mux, i),
+			(unsigned long long)stats.tx_bytes,
+			secs > 0 ? stats.tx_bytes / secs : 0,
+			(unsigned long long)stats.rx_bytes,
+			secs > 0 ? stats.rx_bytes / secs : 0,
+			(unsigned long long)(stats.latency_samples ?
+					     stats.latency_total_ns /
+					     stats.latency_samples : 0),
+			(unsigned long long)stats.latency_max_ns,
+			(unsigned long long)stats.stalled_ns);
+	}
+
+	fprintf(stderr, "Mux errors:\t%llu\n",
+		(unsigned long long)uuart_mux_errors(mux));
+}
+
+static const struct uuart_ops xfer_ops = {
+	.rx = uuart_xfer_link_rx,
+	.tx = uuart_xfer_link_tx,
+};
+
+static int xfer_fd = -1;
+
+static ssize_t xfer_read(void *priv, void *buf, size_t len)
+{
+	ssize_t n;
+
+	(void)priv;
+
+	n = read(xfer_fd, buf, len);
+
+	return n < 0 ? -errno : n;
+}
+
+static ssize_t xfer_write(void *priv, void *buf, size_t len)
+{
+	ssize_t n;
+
+	(void)priv;
+
+	n = write(xfer_fd, buf, len);
+
+	return n < 0 ? -errno : n;
+}
+
+static void report_xfer(const struct uuart_xfer *x)
+{
+	struct uuart_xfer_stats stats;
+	double secs;
+
+	uuart_xfer_stats(x, &stats);
+	secs = stats.elapsed_ns / 1e9;
+
+	fprintf(stderr,
+		"Transfer:\t%llu bytes in %.3f s (%.0f B/s), %llu packets, %llu retransmits, %llu CRC errors, %llu duplicates\n",
+		(unsigned long long)stats.bytes, secs,
+		secs > 0 ? stats.bytes / secs : 0,
+		(unsigned long long)stats.packets,
+		(unsigned long long)stats.retransmits,
+		(unsigned long long)stats.crc_errors,
+		(unsigned long long)stats.duplicates);
+}
+
+static const struct uuart_ops slip_ops = {
+	.rx = uuart_slip_link_rx,
+	.tx = uuart_slip_link_tx,
+};
+
+#define TUN_MTU			1500
+#define TUN_SERVICE_INTERVAL	32
+
+static void report_slip(const struct uuart_slip *slip, double secs)
+{
+	struct uuart_slip_stats stats;
+
+	uuart_slip_stats(slip, &stats);
+
+	fprintf(stderr,
+		"Tunnel Tx:\t%llu packets (%.0f pkt/s), %llu bytes (%.0f B/s goodput), %llu on the wire\n",
+		(unsigned long long)stats.tx_packets,
+		secs > 0 ? stats.tx_packets / secs : 0,
+		(unsigned long long)stats.tx_bytes,
+		secs > 0 ? stats.tx_bytes / secs : 0,
+		(unsigned long long)stats.tx_wire_bytes);
+	fprintf(stderr,
+		"Tunnel Rx:\t%llu packets (%.0f pkt/s), %llu bytes (%.0f B/s goodput), %llu on the wire, %llu errors\n",
+		(unsigned long long)stats.rx_packets,
+		secs > 0 ? stats.rx_packets / secs : 0,
+		(unsigned long long)stats.rx_bytes,
+		secs > 0 ? stats.rx_bytes / secs : 0,
+		(unsigned long long)stats.rx_wire_bytes,
+		(unsigned long long)stats.rx_errors);
+}
+
+/* BASE[,SHIFT[,WIDTH]] */
+static void parse_uart(struct uuart_mmio *mmio, const char *arg)
+{
+	char *end;
+
+	mmio->base = strtoul(arg, &end, 0);
+	mmio->reg_shift = 2;
+	mmio->io_width = 8;
+	mmio->vuart = false;
+
+	if (*end == ',')
+		mmio->reg_shift = strtoul(end + 1, &end, 0);
+	if (*end == ',')
+		mmio->io_width = strtoul(end + 1, &end, 0);
+
+	if (*end || !mmio->base)
+		errx(EXIT_FAILURE, "Invalid UART: %s", arg);
+}
+
+/*
+ * Pick VUART<index> from those discovered, numbered by address as the SoC
+ * manuals do, or list them all and exit. UUART_SYSROOT points
+ * discovery at a fake tree.
+ */
+static void discover_vuart(struct profile *p, bool list)
+{
+	struct uuart_found found[UUART_DISCOVER_MAX];
+	const struct uuart_found *f;
+	int n;
+
+	n = uuart_discover(found, UUART_DISCOVER_MAX, getenv("UUART_SYSROOT"),
+			   list);
+	if (n < 0) {
+		errno = -n;
+		err(EXIT_FAILURE, "uuart_discover");
+	}
+
+	if (list) {
+		for (int i = 0; i < n; i++) {
+			f = &found[i];
+			printf("VUART%u\t0x%08lx\t0x%lx\t%s\t%s\t%s\n", f->index,
+			       f->mmio.base, f->size, f->uio[0] ? f->uio : "-",
+			       f->compatible, f->disabled ? "disabled" : "okay");
+		}
+		exit(EXIT_SUCCESS);
+	}
+
+	f = NULL;
+	for (int i = 0; i < n; i++) {
+		if (found[i].index == p->vuart_index)
+			f = &found[i];
+	}
+
+	/*
+	 * Kernels without a devicetree only ran on the AST2400 and AST2500,
+	 * and every ASPEED SoC since keeps VUART1 and VUART2 where they were
+	 */
+	if (!f && (p->vuart_index == 1 || p->vuart_index == 2)) {
+		if (!n)
+			warnx("No VUARTs discovered, assuming AST2500 addresses");
+		p->mmio.base = p->vuart_index == 1 ? UUART_D_VUART1 :
+						     UUART_D_VUART2;
+		return;
+	}
+
+	if (!f)
+		errx(EXIT_FAILURE, "No VUART%u, %d discovered", p->vuart_index,
+		     n);
+
+	p->mmio = f->mmio;
+	if (f->uio[0]) {
+		p->uio = strdup(f->uio);
+		if (!p->uio)
+			err(EXIT_FAILURE, "strdup");
+	}
+}
+
+static struct uuart *open_device(const struct profile *p)
+{
+	struct uuart *ctx;
+	int rc;
+
+	if (p->sim)
+		rc = uuart_open_sim(&ctx, p->sim, p->sim_side);
+	else if (p->uio)
+		rc = uuart_open_uio(&ctx, p->uio, &p->mmio);
+	else
+		rc = uuart_open_mmio(&ctx, &p->mmio);
+	if (rc < 0) {
+		errno = -rc;
+		err(EXIT_FAILURE, "uuart_open");
+	}
+
+	return ctx;
+}
+
+/* Fail early, and say who has the device, rather than fight over RBR */
+static void claim_device(struct uuart *ctx, bool monitor)
+{
+	pid_t holder = 0;
+	int rc;
+
+	rc = uuart_claim(ctx, monitor, &holder);
+	if (rc == -EBUSY && holder > 0)
+		errx(EXIT_FAILURE,
+		     "Device is owned by pid %d (lock %s), use --monitor to watch it",
+		     (int)holder, uuart_lock_path(ctx));
+	if (rc == -EBUSY)
+		errx(EXIT_FAILURE,
+		     "Device is owned by another process (lock %s), use --monitor to watch it",
+		     uuart_lock_path(ctx));
+	if (rc < 0) {
+		errno = -rc;
+		err(EXIT_FAILURE, "uuart_claim: %s", uuart_lock_path(ctx));
+	}
+}
+
+#define MONITOR_INTERVAL_NS	1000000UL
+
+/*
+ * Report changes to the registers a monitor may read, sampling every
+ * @interval_ns for @iters samples, or until a signal if @iters is negative.
+ */
+static void run_monitor(int iters, unsigned long interval_ns)
+{
+	struct uuart_reg prev[UUART_MAX_REGS], cur[UUART_MAX_REGS];
+	struct timespec delay;
+	struct timespec ts;
+	size_t n;
+
+	if (!interval_ns)
+		interval_ns = MONITOR_INTERVAL_NS;
+	delay.tv_sec = interval_ns / 1000000000UL;
+	delay.tv_nsec = interval_ns % 1000000000UL;
+
+	fprintf(stderr, "Monitoring for %d samples\n", iters);
+	n = uuart_read_regs(dev, prev, UUART_MAX_REGS);
+
+	for (int i = 0; !terminate && (iters < 0 || i < iters); i++) {
+		nanosleep(&delay, NULL);
+		uuart_read_regs(dev, cur, n);
+
+		for (size_t r = 0; r < n; r++) {
+			if (cur[r].val == prev[r].val)
+				continue;
+
+			clock_gettime(CLOCK_BOOTTIME, &ts);
+			fprintf(stderr, "[%7ld.%06ld] %s: 0x%02x -> 0x%02x\n",
+				ts.tv_sec, ts.tv_nsec / 1000, cur[r].name,
+				prev[r].val, cur[r].val);
+		}
+
+		memcpy(prev, cur, n * sizeof(cur[0]));
+	}
+}
+
+/*
+ * Point @p at the device a --capture spec names: vuartN for a discovered
+ * VUART, uio:NAME, sim:PATH on the side --sim-peer selects, or a UART as
+ * --uart takes it.
+ */
+static void parse_capture_dev(struct profile *p, const char *spec)
+{
+	char *end;
+
+	p->sim = NULL;
+	p->uio = NULL;
+
+	if (!strncmp(spec, "vuart", 5)) {
+		p->vuart_index = strtoul(spec + 5, &end, 10);
+		if (*end || end == spec + 5)
+			errx(EXIT_FAILURE, "Invalid capture device: %s", spec);
+		p->mmio.base = 0;
+		discover_vuart(p, false);
+	} else if (!strncmp(spec, "uio:", 4) && spec[4]) {
+		p->uio = spec + 4;
+	} else if (!strncmp(spec, "sim:", 4) && spec[4]) {
+		p->sim = spec + 4;
+	} else {
+		parse_uart(&p->mmio, spec);
+	}
+}
+
+/* Percentiles of the time from reading a burst to writing it out */
+static void report_latency(FILE *stream, const char *name,
+			   const struct uuart_hist *h)
+{
+	fprintf(stream,
+		"%s:\t%llu bursts to write(), p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f us\n",
+		name, (unsigned long long)h->count,
+		uuart_hist_quantile(h, 0.5) / 1e3,
+		uuart_hist_quantile(h, 0.9) / 1e3,
+		uuart_hist_quantile(h, 0.99) / 1e3,
+		uuart_hist_quantile(h, 0.999) / 1e3, h->max / 1e3);
+}
+
+static void report_capture(const struct uuart_capture *c, double secs,
+			   bool merged)
+{
+	struct uuart_capture_stats stats;
+	struct uuart_hist hist;
+	uint64_t total = 0;
+
+	for (size_t i = 0; i < uuart_capture_count(c); i++) {
+		uuart_capture_stats(c, i, &stats);
+		total += stats.bytes;
+
+		fprintf(stderr,
+			"%s:\t%llu bytes in %llu bursts, latency %.1f us mean, %.1f us max, %llu ring full, %llu write errors\n",
+			uuart_capture_name(c, i),
+			(unsigned long long)stats.bytes,
+			(unsigned long long)stats.bursts,
+			stats.bursts ? stats.latency_total_ns / 1e3 /
+				       stats.bursts : 0.0,
+			stats.latency_max_ns / 1e3,
+			(unsigned long long)stats.ring_full,
+			(unsigned long long)stats.write_errors);
+
+		/* Merged devices share the merged output's latency */
+		if (merged)
+			continue;
+		uuart_capture_latency(c, i, &hist);
+		report_latency(stderr, uuart_capture_name(c, i), &hist);
+	}
+
+	fprintf(stderr, "Captured:\t%llu bytes in %.3f s, %.1f KiB/s\n",
+		(unsigned long long)total, secs,
+		secs > 0 ? total / 1024.0 / secs : 0.0);
+}
+
+static void report_merge(const struct uuart_capture *c)
+{
+	struct uuart_merge_stats stats;
+	struct uuart_hist hist;
+
+	uuart_capture_merge_stats(c, &stats);
+	fprintf(stderr,
+		"Merged:\t%llu bytes in %llu bursts, held %.1f us mean, %.1f us max, %llu write errors\n",
+		(unsigned long long)stats.bytes,
+		(unsigned long long)stats.bursts,
+		stats.bursts ? stats.hold_total_ns / 1e3 / stats.bursts : 0.0,
+		stats.hold_max_ns / 1e3,
+		(unsigned long long)stats.write_errors);
+	fprintf(stderr,
+		"Out of order:\t%llu bursts, %.1f us mean, %.1f us max late\n",
+		(unsigned long long)stats.late,
+		stats.late ? stats.late_total_ns / 1e3 / stats.late : 0.0,
+		stats.late_max_ns / 1e3);
+
+	uuart_capture_latency(c, -1, &hist);
+	report_latency(stderr, "Merged", &hist);
+}
+
+/* What --capture and the options that go with it ask for */
+struct cli_capture {
+	char *specs[UUART_CAPTURE_MAX];
+	size_t n;
+	struct uuart_capture_config cfg;
+	const char *merge;
+	struct uuart_merge_config merge_cfg;
+};
+
+/*
+ * Capture the Rx of each device in @cap->specs, given as DEV=FILE, or as
+ * DEV=NAME or just DEV when merging, with one poller thread for them all, for
+ * @iters passes over the devices or until a signal.
+ */
+static void run_capture(const struct cli_capture *cap,
+			const struct profile *opts, int iters)
+{
+	static const struct timespec tick = { .tv_nsec = 1000000 };
+	struct uuart_capture *c;
+	struct timespec start;
+	const char *name;
+	struct profile p;
+	struct uuart *ctx;
+	char why[256];
+	int fd;
+	char *file;
+	int rc;
+
+	rc = uuart_capture_new(&c, &cap->cfg);
+	if (rc < 0) {
+		errno = -rc;
+		err(EXIT_FAILURE, "uuart_capture_new");
+	}
+
+	if (cap->merge) {
+		fd = open_output(cap->merge, opts->compress, opts->index);
+
+		rc = uuart_capture_merge(c, fd, &cap->merge_cfg);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "uuart_capture_merge");
+		}
+	}
+
+	/* Restore every device initialised so far on exit and on signals */
+	install_handlers();
+
+	for (size_t i = 0; i < cap->n; i++) {
+		char *spec = cap->specs[i];
+
+		file = strrchr(spec, '=');
+		if (file == spec || (file && !file[1]) || (!file && !cap->merge))
+			errx(EXIT_FAILURE, "Invalid capture: %s", spec);
+		if (file)
+			*file++ = '\0';
+		name = cap->merge && file ? file : spec;
+
+		p = *opts;
+		p.cfg.no_tx = true;
+		parse_capture_dev(&p, spec);
+		if (profile_check(&p, why, sizeof(why)) < 0)
+			errx(EXIT_FAILURE, "%s: %s", spec, why);
+
+		ctx = open_device(&p);
+		claim_device(ctx, false);
+		capture_devs[nr_capture_devs++] = ctx;
+
+		rc = uuart_init(ctx, &p.cfg);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "uuart_init: %s", spec);
+		}
+
+		fd = -1;
+		if (!cap->merge)
+			fd = open_output(file, opts->compress, opts->index);
+
+		rc = uuart_capture_add(c, ctx, fd, name);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "uuart_capture_add");
+		}
+	}
+
+	fprintf(stderr, "Capturing %zu devices for %d passes\n", cap->n, iters);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	rc = uuart_capture_start(c);
+	if (rc < 0) {
+		errno = -rc;
+		err(EXIT_FAILURE, "uuart_capture_start");
+	}
+
+	while (!terminate &&
+	       (iters < 0 || uuart_capture_rounds(c) < (uint64_t)iters))
+		nanosleep(&tick, NULL);
+
+	uuart_capture_stop(c);
+	report_capture(c, elapsed_s(&start), cap->merge);
+	if (cap->merge)
+		report_merge(c);
+	uuart_capture_free(c);
+	close_outputs();
+}
+
+static void load_profile(struct profile *p, const char *path, const char *name)
+{
+	char why[256];
+
+	if (profile_load(p, path, name, why, sizeof(why)) < 0)
+		errx(EXIT_FAILURE, "%s", why);
+}
+
+#define CTL_SERVICE_INTERVAL	64
+
+/* What the main loop drives, and what it counts */
+struct cli_loop {
+	int iters;
+	/* Where a loop left by a change to stats resumes */
+	int i;
+	struct muxsock *ms;
+	struct tunlink *tun;
+	struct uuart_sink *sink;
+	struct uuart_xfer *xfer;
+	struct ctlsock *ctl;
+	/* The settings in force, which the control socket can change */
+	struct profile *opts;
+	bool stats;
+	unsigned long loops;
+	unsigned long txd;
+	unsigned long rxd;
 };
 
+/*
+ * The main loop, written once and only called with constant @bounded and
+ * @stats, so the wrappers below compile without the iteration bound or the
+ * statistics where they aren't wanted. Returns false if the control socket
+ * turned the statistics on or off, for the caller to switch wrappers.
+ */
+static inline __attribute__((always_inline)) bool
+run_loop(struct cli_loop *l, const bool bounded, const bool stats)
+{
+	struct uuart_step step;
+	int rc;
+
+	for (int i = l->i; !terminate && (!bounded || i < l->iters);
+	     i += bounded) {
+		l->loops++;
+
+		if (l->ctl && !(l->loops % CTL_SERVICE_INTERVAL)) {
+			ctlsock_service(l->ctl);
+			if (l->stats != stats) {
+				l->i = i;
+				return false;
+			}
+		}
+
+		if (l->ms && !(l->loops % MUX_SERVICE_INTERVAL)) {
+			rc = muxsock_service(l->ms);
+			if (rc < 0) {
+				errno = -rc;
+				err(EXIT_FAILURE, "muxsock_service");
+			}
+		}
+
+		if (l->tun && !(l->loops % TUN_SERVICE_INTERVAL)) {
+			rc = tunlink_service(l->tun);
+			if (rc < 0) {
+				errno = -rc;
+				err(EXIT_FAILURE, "tunlink_service");
+			}
+		}
+
+		rc = uuart_step(dev, &step, NULL);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "uuart_step");
+		}
+
+		if (stats && step.stall_changed) {
+			struct timespec ts;
+
+			rc = clock_gettime(CLOCK_BOOTTIME, &ts);
+			if (rc)
+				err(EXIT_FAILURE, "clock_gettime");
+
+			fprintf(stderr,
+				"[%7ld.%06ld] VUART %s at %d, LSR: 0x%02x\n",
+				ts.tv_sec, ts.tv_nsec / 1000,
+				step.stalled ? "stalled" : "resumed", i, step.lsr);
+		}
+
+		if (stats) {
+			l->txd += step.txd;
+			l->rxd += step.rxd;
+		}
+
+		/* Batch console writes up to flush_min, but not while Rx is idle */
+		if (l->sink && uuart_sink_pending(l->sink) &&
+		    (uuart_sink_pending(l->sink) >= l->opts->flush_min ||
+		     !step.rxd)) {
+			ssize_t n = uuart_sink_flush(l->sink);
+
+			if (n < 0) {
+				errno = -n;
+				err(EXIT_FAILURE, "uuart_sink_flush");
+			}
+		}
+
+		if (l->xfer && uuart_xfer_done(l->xfer))
+			break;
+	}
+
+	return true;
+}
+
+static bool run_unbounded(struct cli_loop *l)
+{
+	return run_loop(l, false, false);
+}
+
+static bool run_unbounded_stats(struct cli_loop *l)
+{
+	return run_loop(l, false, true);
+}
+
+static bool run_bounded(struct cli_loop *l)
+{
+	return run_loop(l, true, false);
+}
+
+static bool run_bounded_stats(struct cli_loop *l)
+{
+	return run_loop(l, true, true);
+}
+
+/* Indexed by [bounded][stats] */
+static bool (*const run_loops[2][2])(struct cli_loop *l) = {
+	{ run_unbounded, run_unbounded_stats },
+	{ run_bounded,   run_bounded_stats   },
+};
+
+static void report_sink(const struct uuart_sink *s,
+			enum uuart_sink_policy policy, FILE *stream)
+{
+	struct uuart_sink_stats sink;
+
+	uuart_sink_stats(s, &sink);
+	fprintf(stream,
+		"Sink:\t%llu bytes in, %llu out, %llu refused, %zu pending\n",
+		(unsigned long long)sink.bytes_in,
+		(unsigned long long)sink.bytes_out,
+		(unsigned long long)sink.refused, uuart_sink_pending(s));
+	fprintf(stream,
+		"\t%s: %llu dropped, %llu spilled, %llu replayed, "
+		"%llu throttles for %.3f ms\n",
+		uuart_sink_policy_name(policy),
+		(unsigned long long)sink.dropped,
+		(unsigned long long)sink.spilled,
+		(unsigned long long)sink.replayed,
+		(unsigned long long)sink.throttles, sink.throttled_ns / 1e6);
+}
+
+/* Milestones go out as JSON lines as they are seen, and a summary at exit */
+static void boot_event(void *priv, const struct uuart_boot *b,
+		       const struct uuart_boot_event *ev)
+{
+	FILE *out = priv;
+	const char *from = ev->from < 0 ? NULL : uuart_boot_name(b, ev->from);
+
+	fprintf(out,
+		"{\"event\":\"milestone\",\"boot\":%u,\"milestone\":\"%s\",\"from\":%s%s%s,\"realtime\":%llu.%06llu,\"phase_ms\":%.3f,\"boot_ms\":%.3f,\"offset\":%llu}\n",
+		ev->boot, uuart_boot_name(b, ev->milestone),
+		from ? "\"" : "", from ?: "null", from ? "\"" : "",
+		(unsigned long long)(ev->realtime_ns / 1000000000),
+		(unsigned long long)(ev->realtime_ns % 1000000000 / 1000),
+		ev->phase_ns / 1e6, ev->boot_ns / 1e6,
+		(unsigned long long)ev->offset);
+}
+
+static void report_boot(const struct uuart_boot *b, size_t n, FILE *out)
+{
+	struct uuart_boot_phase_stats stats;
+
+	fprintf(out,
+		"{\"event\":\"summary\",\"boots\":%u,\"last_boot_ms\":%.3f,\"phases\":[",
+		uuart_boot_count(b), uuart_boot_last_ns(b) / 1e6);
+
+	/* The first milestone starts a boot, so every phase ends at a later one */
+	for (size_t i = 1; i < n; i++) {
+		uuart_boot_phase_stats(b, i, &stats);
+		fprintf(out,
+			"%s{\"milestone\":\"%s\",\"count\":%llu,\"last_ms\":%.3f,\"min_ms\":%.3f,\"mean_ms\":%.3f,\"max_ms\":%.3f}",
+			i > 1 ? "," : "", uuart_boot_name(b, i),
+			(unsigned long long)stats.count, stats.last_ns / 1e6,
+			stats.min_ns / 1e6,
+			stats.count ? stats.total_ns / 1e6 / stats.count : 0.0,
+			stats.max_ns / 1e6);
+	}
+
+	fprintf(out, "]}\n");
+}
+
+/* Whether the sink ever fell behind, and so has anything to report */
+static bool sink_pressed(const struct uuart_sink *s)
+{
+	struct uuart_sink_stats sink;
+
+	uuart_sink_stats(s, &sink);
+
+	return sink.refused || sink.dropped || sink.spilled || sink.throttles;
+}
+
+static void report_stats(const struct cli_loop *l, FILE *stream)
+{
+	fprintf(stream, "Loops:\t%lu\n", l->loops);
+
+	if (l->stats)
+		fprintf(stream, "Transmitted:\t%lu\nReceived:\t%lu\n", l->txd,
+			l->rxd);
+
+	if (l->sink)
+		report_sink(l->sink, l->opts->sink.policy, stream);
+
+	report_flow(dev, stream);
+	report_cork(dev, stream);
+	if (l->opts->cfg.tx_rate)
+		report_pace(dev, l->opts->cfg.tx_rate, stream);
+	report_fifo(dev, stream);
+}
+
+/* Control socket requests, run by the main loop between steps */
+static int ctl_request(void *priv, enum ctl_op op, const struct profile *p,
+		       FILE *reply)
+{
+	struct cli_loop *l = priv;
+	int rc;
+
+	switch (op) {
+	case CTL_SET:
+		rc = uuart_reconfigure(dev, &p->cfg);
+		if (rc < 0)
+			return rc;
+		*l->opts = *p;
+		l->stats = !p->quiet;
+		return 0;
+	case CTL_STATS:
+		report_stats(l, reply);
+		return 0;
+	case CTL_REGS:
+		uuart_dump_regs(dev, reply);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
 static const char help_text[] =
 "%s: Userspace UART driver\n"
 "\n"
+"-a, --capture DEV=FILE\n"
+"\tCapture the Rx of DEV into FILE, alongside the other devices given with\n"
+"\tthis option, from a single poller thread. DEV is vuartN, uio:NAME,\n"
+"\tsim:PATH or a UART as --uart takes it\n"
+"\n"
+"-A, --fifo-auto\n"
+"\tRetune the Rx and host trigger levels from the burst sizes observed\n"
+"\n"
+"-b, --batch-barriers\n"
+"\tIssue one memory barrier per poll instead of one per register access\n"
+"\n"
+"-B, --sink-policy POLICY\n"
+"\tWhen output falls behind, block and throttle the host (block), discard\n"
+"\tthe oldest or newest data (drop-oldest, drop-newest), or append the\n"
+"\toverflow to FILE and replay it in order as output recovers (spill:FILE)\n"
+"\n"
+"-c, --cork BYTES\n"
+"\tHold Tx back until BYTES have collected, then write them back to back,\n"
+"\tso the host sees fewer, larger bursts\n"
+"\n"
+"-C, --cork-ns NS\n"
+"\tWrite a partial burst after NS nanoseconds (default 1000000)\n"
+"\n"
+"-d, --discover\n"
+"\tList the VUARTs the devicetree describes, enabled or not, refreshing\n"
+"\tthe discovery cache, then exit\n"
+"\n"
 "-D, --assume-dtr\n"
 "\tAssume MCR[DTR] and MCR[RTS] are set appropriately\n"
 "\n"
+"-e, --milestone NAME=TEXT\n"
+"\tTime the host's boot by the console printing TEXT, reporting each\n"
+"\tmilestone and the phase it ends as JSON lines. Give one per milestone\n"
+"\tin boot order, e.g. -e bios='BIOS v' -e kernel='Linux version'\n"
+"\t-e login=' login:'. The first one seen again starts a new boot\n"
+"\n"
 "-E, --assume-enabled\n"
 "\tAssume the UART is enabled and configured to not drain the Rx FIFO\n"
 "\n"
 "-F, --assume-fifos\n"
 "\tAssume the FIFOs are configured and do not need resetting\n"
 "\n"
+"-f, --flow-control\n"
+"\tThrottle the host with MCR[RTS|DTR] when stdout falls behind, and\n"
+"\thold Tx while the host deasserts MSR[CTS] or MSR[DSR]\n"
+"\n"
+"-g, --merge FILE\n"
+"\tWrite the captured devices to FILE as one time-ordered log, each line\n"
+"\tstarting with the device's name, instead of a file each. Captures are\n"
+"\tthen given as DEV or DEV=NAME\n"
+"\n"
+"-G, --merge-binary\n"
+"\tWrite the merged log as binary records tagged with a device index and a\n"
+"\ttimestamp, rather than as text\n"
+"\n"
 "-h, --help\n"
 "\tHelp!\n"
 "\n"
+"-H, --host-trigger N\n"
+"\tSet the host's Rx FIFO trigger level, GCRA[H_RFT], to 1, 4, 8 or 14\n"
+"\n"
+"-i, --tx-stdin\n"
+"\tTransmit data read from stdin through the Tx queue instead of 'y'\n"
+"\n"
+"-I, --index\n"
+"\tKeep a sparse index of each output file's times and offsets in FILE.idx,\n"
+"\tupdated as data is flushed, for uuart-query to seek with\n"
+"\n"
+"-j, --writers N\n"
+"\tWrite captures from N threads, each taking the device with the most\n"
+"\tdata pending (default 1)\n"
+"\n"
+"-J, --poller-cpu CPU\n"
+"\tPin the capture poller thread to CPU\n"
+"\n"
+"-k, --config FILE\n"
+"\tRead profiles for --profile from FILE (default " PROFILE_PATH ")\n"
+"\n"
+"-K, --scrollback SIZE\n"
+"\tKeep the last SIZE bytes of console output in memory, for the control\n"
+"\tsocket's tail, lines and since commands\n"
+"\n"
+"-l, --rx-trigger N\n"
+"\tSet the Rx FIFO trigger level, FCR[7:6], to 1, 4, 8 or 14\n"
+"\n"
+"-L, --merge-delay NS\n"
+"\tHold each burst up to NS nanoseconds for earlier ones from other devices\n"
+"\t(default 10000000)\n"
+"\n"
+"-m, --mux DIR\n"
+"\tMultiplex the console, telemetry and bulk channels over the VUART,\n"
+"\tserving each on an AF_UNIX socket of the same name in DIR\n"
+"\n"
+"-M, --monitor\n"
+"\tWatch the device read-only alongside its owner, reporting changes to the\n"
+"\tregisters that can be read without side effects every poll-max-ns\n"
+"\n"
+"-o, --boot-report FILE\n"
+"\tAppend the milestones and the summary at exit to FILE rather than\n"
+"\tstderr\n"
+"\n"
+"-O, --rx-timeout N\n"
+"\tSet the Rx timeout field, GCRA[S_TIMEOUT], to N (0 to 3)\n"
+"\n"
+"-p, --profile NAME\n"
+"\tApply the device profile NAME from the config file. Options after it\n"
+"\toverride the profile's settings\n"
+"\n"
+"-P, --sim-peer\n"
+"\tAttach to the second side of the simulated VUART\n"
+"\n"
+"-q, --quiet\n"
+"\tDon't count bytes or report stalls\n"
+"\n"
+"-r, --recv FILE\n"
+"\tReceive FILE with the windowed transfer protocol, then exit\n"
+"\n"
 "-R, --ignore-rx\n"
 "\tIgnore LSR[DR] and do not read RBR\n"
 "\n"
+"-s, --send FILE\n"
+"\tSend FILE with the windowed transfer protocol, then exit\n"
+"\n"
+"-S, --sim PATH\n"
+"\tUse the simulated VUART pair backed by PATH instead of hardware\n"
+"\n"
+"-t, --tun NAME\n"
+"\tBridge the TUN interface NAME over the VUART with SLIP framing\n"
+"\n"
 "-T, --ignore-tx\n"
-"\tIgnore LSR[THRE] and do not write THR\n";
+"\tIgnore LSR[THRE] and do not write THR\n"
+"\n"
+"-u, --uart BASE[,SHIFT[,WIDTH]]\n"
+"\tDrive the 8250-compatible UART at physical address BASE instead of the\n"
+"\tVUART, with registers 1 << SHIFT bytes apart (default 2) and accessed\n"
+"\tWIDTH bits at a time (default 8)\n"
+"\n"
+"-V, --vuart-index N\n"
+"\tDrive the Nth discovered VUART, in address order from 1, when no\n"
+"\tdevice is given otherwise (default 2)\n"
+"\n"
+"-w, --window N\n"
+"\tKeep up to N transfer packets in flight (default 16)\n"
+"\n"
+"-X, --control PATH\n"
+"\tAccept commands to change settings, and queries for statistics and\n"
+"\tregisters, on the AF_UNIX socket PATH while running\n"
+"\n"
+"-y, --tx-rate BYTES\n"
+"\tPace Tx to BYTES a second, whatever it carries, and report the rate\n"
+"\tachieved and how late paced writes went out\n"
+"\n"
+"-Y, --tx-burst BYTES\n"
+"\tLet up to BYTES of paced Tx out back to back (default the Tx FIFO's\n"
+"\troom)\n"
+"\n"
+"-z, --compress\n"
+"\tCompress the console output and captures on a background thread, into\n"
+"\tblocks that each decompress on their own and carry the time their data\n"
+"\tarrived\n";
 
 int main(int argc, char * const argv[])
 {
-	unsigned long txd = 0, rxd = 0;
-	struct uuart_config cfg = {0};
-	volatile void *regs;
-	uint8_t lsr, ier;
-	bool stall;
+	struct cli_loop loop = {0};
+	struct uuart_xfer_config xfer_cfg = {0};
+	struct profile opts = {
+		.vuart_index = 2,
+		.mmio = {
+			.reg_shift = 2,
+			.io_width = 8,
+			.vuart = true,
+		},
+	};
+	const char *config = PROFILE_PATH;
+	struct uuart_config *cfg = &opts.cfg;
+	struct uuart_xfer *xfer = NULL;
+	struct cli_io io = {0};
+	struct uuart_slip *slip = NULL;
+	struct tunlink *tun = NULL;
+	struct uuart_mux *mux = NULL;
+	struct muxsock *ms = NULL;
+	const char *xfer_path = NULL;
+	bool xfer_send = false;
+	bool discover = false;
+	struct cli_capture capture = {0};
+	struct uuart_hist hist;
+	struct timespec start;
+	bool fifo_report;
+	char why[256];
+	int out_fd;
 	int iters;
-	int fd;
+	int rc;
 	int o;
 
 	while (1) {
 		static struct option long_options [] = {
+			{ "capture",        required_argument, NULL, 'a' },
+			{ "fifo-auto",      no_argument, NULL, 'A' },
+			{ "batch-barriers", no_argument, NULL, 'b' },
+			{ "sink-policy",    required_argument, NULL, 'B' },
+			{ "cork",           required_argument, NULL, 'c' },
+			{ "cork-ns",        required_argument, NULL, 'C' },
+			{ "control",        required_argument, NULL, 'X' },
+			{ "discover",       no_argument, NULL, 'd' },
 			{ "assume-dtr",     no_argument, NULL, 'D' },
+			{ "milestone",      required_argument, NULL, 'e' },
 			{ "assume-enabled", no_argument, NULL, 'E' },
 			{ "assume-fifos",   no_argument, NULL, 'F' },
+			{ "flow-control",   no_argument, NULL, 'f' },
+			{ "merge",          required_argument, NULL, 'g' },
+			{ "merge-binary",   no_argument, NULL, 'G' },
 			{ "help",           no_argument, NULL, 'h' },
+			{ "host-trigger",   required_argument, NULL, 'H' },
+			{ "tx-stdin",       no_argument, NULL, 'i' },
+			{ "index",          no_argument, NULL, 'I' },
+			{ "writers",        required_argument, NULL, 'j' },
+			{ "poller-cpu",     required_argument, NULL, 'J' },
+			{ "config",         required_argument, NULL, 'k' },
+			{ "scrollback",     required_argument, NULL, 'K' },
+			{ "rx-trigger",     required_argument, NULL, 'l' },
+			{ "merge-delay",    required_argument, NULL, 'L' },
+			{ "mux",            required_argument, NULL, 'm' },
+			{ "monitor",        no_argument, NULL, 'M' },
+			{ "boot-report",    required_argument, NULL, 'o' },
+			{ "rx-timeout",     required_argument, NULL, 'O' },
+			{ "profile",        required_argument, NULL, 'p' },
+			{ "sim-peer",       no_argument, NULL, 'P' },
+			{ "quiet",          no_argument, NULL, 'q' },
+			{ "recv",           required_argument, NULL, 'r' },
 			{ "no-rx",          no_argument, NULL, 'R' },
+			{ "send",           required_argument, NULL, 's' },
+			{ "compress",       no_argument, NULL, 'z' },
+			{ "sim",            required_argument, NULL, 'S' },
+			{ "tun",            required_argument, NULL, 't' },
 			{ "no-tx",          no_argument, NULL, 'T' },
+			{ "uart",           required_argument, NULL, 'u' },
+			{ "vuart-index",    required_argument, NULL, 'V' },
+			{ "window",         required_argument, NULL, 'w' },
+			{ "tx-rate",        required_argument, NULL, 'y' },
+			{ "tx-burst",       required_argument, NULL, 'Y' },
 			{ NULL,             0,           NULL,  0  },
 		};
 		int oi = 0;
 
-		o = getopt_long(argc, argv, "DEFhRT", long_options, &oi);
+		o = getopt_long(argc, argv, "a:AbB:c:C:dDe:EFfg:GhH:iIj:J:k:K:l:L:m:Mo:O:p:Pqr:Rs:S:t:Tu:V:w:X:y:Y:z", long_options, &oi);
 		if (o == -1)
 			break;
 
-		if (o == 'D')
-			cfg.assume_dtr = true;
-		else if (o == 'E')
-			cfg.assume_enabled = true;
+		if (o == 'a') {
+			if (capture.n == UUART_CAPTURE_MAX)
+				errx(EXIT_FAILURE, "Too many capture devices");
+			capture.specs[capture.n++] = optarg;
+		} else if (o == 'A')
+			cfg->fifo_auto = true;
+		else if (o == 'b')
+			cfg->batch_barriers = true;
+		else if (o == 'B') {
+			if (uuart_sink_parse_policy(&opts.sink, optarg))
+				errx(EXIT_FAILURE, "Invalid sink policy: %s", optarg);
+		} else if (o == 'c')
+			cfg->cork_burst = strtoul(optarg, NULL, 0);
+		else if (o == 'C')
+			cfg->cork_max_ns = strtoul(optarg, NULL, 0);
+		else if (o == 'd')
+			discover = true;
+		else if (o == 'D')
+			cfg->assume_dtr = true;
+		else if (o == 'e') {
+			if (uuart_boot_parse_milestone(&opts.boot, optarg))
+				errx(EXIT_FAILURE, "Invalid milestone: %s", optarg);
+		} else if (o == 'E')
+			cfg->assume_enabled = true;
 		else if (o == 'F')
-			cfg.assume_fifos = true;
+			cfg->assume_fifos = true;
+		else if (o == 'f')
+			cfg->flow_control = true;
 		else if (o == 'h')
 			errx(EXIT_SUCCESS, help_text, argv[0]);
+		else if (o == 'g')
+			capture.merge = optarg;
+		else if (o == 'G')
+			capture.merge_cfg.format = UUART_MERGE_BINARY;
+		else if (o == 'H')
+			cfg->host_rx_trigger = strtoul(optarg, NULL, 0);
+		else if (o == 'i')
+			opts.tx_stdin = true;
+		else if (o == 'I')
+			opts.index = true;
+		else if (o == 'j')
+			capture.cfg.writers = strtoul(optarg, NULL, 0);
+		else if (o == 'J') {
+			capture.cfg.pin = true;
+			capture.cfg.cpu = strtoul(optarg, NULL, 0);
+		} else if (o == 'k')
+			config = optarg;
+		else if (o == 'K')
+			opts.scrollback = strtoul(optarg, NULL, 0);
+		else if (o == 'L')
+			capture.merge_cfg.delay_ns = strtoul(optarg, NULL, 0);
+		else if (o == 'l')
+			cfg->rx_trigger = strtoul(optarg, NULL, 0);
+		else if (o == 'm')
+			opts.mux = optarg;
+		else if (o == 'M')
+			opts.monitor = true;
+		else if (o == 'o')
+			opts.boot_report = optarg;
+		else if (o == 'O')
+			cfg->rx_timeout = strtoul(optarg, NULL, 0);
+		else if (o == 'p')
+			load_profile(&opts, config, optarg);
+		else if (o == 'P')
+			opts.sim_side = 1;
+		else if (o == 'q')
+			opts.quiet = true;
+		else if (o == 'r')
+			xfer_path = optarg;
 		else if (o == 'R')
-			cfg.no_rx = true;
+			cfg->no_rx = true;
+		else if (o == 's') {
+			xfer_path = optarg;
+			xfer_send = true;
+		} else if (o == 'S')
+			opts.sim = optarg;
+		else if (o == 't')
+			opts.tun = optarg;
 		else if (o == 'T')
-			cfg.no_tx = true;
+			cfg->no_tx = true;
+		else if (o == 'u') {
+			parse_uart(&opts.mmio, optarg);
+			opts.uio = NULL;
+		} else if (o == 'V') {
+			opts.vuart_index = strtoul(optarg, NULL, 0);
+			opts.mmio.base = 0;
+			opts.uio = NULL;
+		} else if (o == 'w')
+			xfer_cfg.window = strtoul(optarg, NULL, 0);
+		else if (o == 'X')
+			opts.control = optarg;
+		else if (o == 'y')
+			cfg->tx_rate = strtoul(optarg, NULL, 0);
+		else if (o == 'Y')
+			cfg->tx_burst = strtoul(optarg, NULL, 0);
+		else if (o == 'z')
+			opts.compress = true;
 		else
 			errx(EXIT_FAILURE, "Unexpected option: %c", o);
 	}
 
-	fd = open("/dev/mem", O_SYNC | O_RDWR);
-	if (fd == -1)
-		err(EXIT_FAILURE, "open");
+	if (capture.n) {
+		run_capture(&capture, &opts,
+			    optind < argc ? atoi(argv[optind]) : -1);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (discover || (!opts.sim && !opts.uio && !opts.mmio.base))
+		discover_vuart(&opts, discover);
+
+	if (profile_check(&opts, why, sizeof(why)) < 0)
+		errx(EXIT_FAILURE, "%s", why);
 
-	regs = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, D_VUART2);
-	if (!regs)
-		err(EXIT_FAILURE, "mmap");
+	dev = open_device(&opts);
+	claim_device(dev, opts.monitor);
 
 	fprintf(stderr, "Startup configuration\n");
-	dump_regs(regs, D_VUART2);
+	uuart_dump_regs(dev, stderr);
 
 	assert(optind <= argc);
 	if (optind == argc)
 		exit(EXIT_SUCCESS);
 
-	/* Enable the VUART */
-	if (!cfg.assume_enabled)
-		writeb(regs, R_GCRA, GCRA_VUART_EN | GCRA_H_TX_CORK);
-
-	/* Configure IER */
-	ier = readb(regs, R_IER);
-	if (!cfg.no_tx)
-		ier &= ~IER_ETBEI;
-	if (!cfg.no_rx)
-		ier &= ~IER_ERBFI;
-	if (!(ier & (IER_ETBEI | IER_ERBFI)))
-		ier = 0;
-	writeb(regs, R_IER, ier);
+	if (opts.monitor) {
+		install_handlers();
+		run_monitor(atoi(argv[optind]), cfg->poll_max_ns);
+		exit(EXIT_SUCCESS);
+	}
 
-	/* Reset and enable the FIFOs */
-	if (!cfg.assume_fifos)
-		writeb(regs, R_FCR, 0x07);
+	/* Restore the startup state on exit(), err() and terminating signals */
+	install_handlers();
 
-	/* Indicate we're ready */
-	if (!cfg.assume_dtr)
-		writeb(regs, R_MCR, 0x0b);
+	rc = uuart_init(dev, cfg);
+	if (rc < 0) {
+		errno = -rc;
+		err(EXIT_FAILURE, "uuart_init");
+	}
 
 	fprintf(stderr, "Initialised configuration\n");
-	dump_regs(regs, D_VUART2);
+	uuart_dump_regs(dev, stderr);
 
-	stall = false;
-	iters = atoi(argv[optind]);
-	fprintf(stderr, "Running for %d iterations\n", iters);
-	for (int i = 0; iters < 0 || i < iters; i += (iters > 0)) {
-		if (!cfg.no_rx)
-			writeb(regs, R_IER, (~IER_ERBFI & readb(regs, R_IER)));
+	if (!!opts.tx_stdin + !!opts.mux + !!xfer_path + !!opts.tun > 1)
+		errx(EXIT_FAILURE,
+		     "--tx-stdin, --mux, --send/--recv and --tun are mutually exclusive");
+
+	/* Milestones are matched in the console's Rx, which these take over */
+	if (opts.boot.n && (opts.mux || xfer_path || opts.tun))
+		errx(EXIT_FAILURE,
+		     "--milestone can't be used with --mux, --send/--recv or --tun");
 
-		lsr = readb(regs, R_LSR);
+	/* As is the scrollback, which would otherwise stay empty */
+	if (opts.scrollback && (opts.mux || xfer_path || opts.tun))
+		errx(EXIT_FAILURE,
+		     "--scrollback can't be used with --mux, --send/--recv or --tun");
 
-		if ((lsr & LSR_DR) || (lsr & LSR_THRE)) {
-			if (stall) {
-				struct timespec ts;
-				int rc;
+	if (opts.tun) {
+		rc = uuart_slip_new(&slip, TUN_MTU);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "uuart_slip_new");
+		}
+
+		rc = tunlink_open(&tun, slip, opts.tun, TUN_MTU);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "tunlink_open: %s", opts.tun);
+		}
 
-				rc = clock_gettime(CLOCK_BOOTTIME, &ts);
-				if (rc)
-					err(EXIT_FAILURE, "clock_gettime");
+		uuart_set_ops(dev, &slip_ops, slip);
+	} else if (xfer_path) {
+		if (xfer_send) {
+			xfer_fd = open(xfer_path, O_RDONLY | O_CLOEXEC);
+			if (xfer_fd < 0)
+				err(EXIT_FAILURE, "open: %s", xfer_path);
 
-				fprintf(stderr,
-					"[%7ld.%06ld] VUART resumed at %d, LSR: 0x%02x\n",
-					ts.tv_sec, ts.tv_nsec / 1000, i, lsr);
-			}
-			stall = false;
+			rc = uuart_xfer_new_sender(&xfer, &xfer_cfg, xfer_read,
+						   NULL);
 		} else {
-			if (!stall) {
-				struct timespec ts;
-				int rc;
+			xfer_fd = open(xfer_path,
+				       O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+				       0644);
+			if (xfer_fd < 0)
+				err(EXIT_FAILURE, "open: %s", xfer_path);
 
-				rc = clock_gettime(CLOCK_BOOTTIME, &ts);
-				if (rc)
-					err(EXIT_FAILURE, "clock_gettime");
+			rc = uuart_xfer_new_receiver(&xfer, &xfer_cfg,
+						     xfer_write, NULL);
+		}
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "uuart_xfer_new");
+		}
 
-				fprintf(stderr,
-					"[%7ld.%06ld] VUART stalled at %d, LSR: 0x%02x\n",
-					ts.tv_sec, ts.tv_nsec / 1000, i, lsr);
+		uuart_set_ops(dev, &xfer_ops, xfer);
+	} else if (opts.mux) {
+		rc = uuart_mux_new(&mux, mux_channels,
+				   sizeof(mux_channels) / sizeof(mux_channels[0]),
+				   MUX_WINDOW);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "uuart_mux_new");
+		}
+
+		rc = muxsock_open(&ms, mux, opts.mux);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "muxsock_open");
+		}
+
+		uuart_set_ops(dev, &mux_ops, mux);
+	} else {
+		out_fd = open_output(opts.output, opts.compress, opts.index);
+
+		rc = uuart_sink_new(&io.sink, out_fd, dev, &opts.sink);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "uuart_sink_new");
+		}
+
+		if (opts.boot.n) {
+			io.boot_out = stderr;
+			if (opts.boot_report) {
+				io.boot_out = fopen(opts.boot_report, "ae");
+				if (!io.boot_out)
+					err(EXIT_FAILURE, "open: %s",
+					    opts.boot_report);
+				setvbuf(io.boot_out, NULL, _IOLBF, 0);
+			}
+
+			rc = uuart_boot_new(&io.boot, &opts.boot, boot_event,
+					    io.boot_out);
+			if (rc < 0) {
+				errno = -rc;
+				err(EXIT_FAILURE, "uuart_boot_new");
 			}
-			stall = true;
 		}
 
-		if (!cfg.no_tx && (lsr & LSR_THRE)) {
-			writeb(regs, R_THR, 'y');
-			txd++;
+		if (opts.scrollback) {
+			rc = uuart_scrollback_new(&io.sb, opts.scrollback);
+			if (rc < 0) {
+				errno = -rc;
+				err(EXIT_FAILURE, "uuart_scrollback_new");
+			}
 		}
 
-		if (!cfg.no_rx && (lsr & LSR_DR)) {
-			putchar(readb(regs, R_RBR));
-			fflush(stdout);
-			rxd++;
+		if (opts.tx_stdin) {
+			rc = uuart_txq_new(&io.txq, TXQ_LIMIT);
+			if (rc < 0) {
+				errno = -rc;
+				err(EXIT_FAILURE, "uuart_txq_new");
+			}
+
+			start_stdin_producer(io.txq);
 		}
+
+		uuart_set_ops(dev, opts.tx_stdin ? &txq_ops : &cli_ops, &io);
 	}
 
+	iters = atoi(argv[optind]);
+	fprintf(stderr, "Running for %d iterations\n", iters);
+	loop.iters = iters;
+	loop.ms = ms;
+	loop.tun = tun;
+	loop.sink = io.sink;
+	loop.xfer = xfer;
+	loop.opts = &opts;
+	loop.stats = !opts.quiet;
+
+	if (opts.control) {
+		rc = ctlsock_open(&loop.ctl, opts.control, &opts, io.sb,
+				  ctl_request, &loop);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "ctlsock_open: %s", opts.control);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (!run_loops[iters >= 0][loop.stats](&loop))
+		;
+
+	if (loop.ctl)
+		ctlsock_close(loop.ctl);
+	if (io.sb)
+		uuart_scrollback_free(io.sb);
+
 	fprintf(stderr, "Terminating configuration\n");
-	dump_regs(regs, D_VUART2);
+	uuart_dump_regs(dev, stderr);
+
+	if (!cfg->no_tx && loop.stats)
+		fprintf(stderr, "Transmitted:\t%lu\n", loop.txd);
+
+	if (io.txq)
+		uuart_txq_for_each_producer(io.txq, report_producer, NULL);
+
+	/* The settings last in force, which the control socket may have changed */
+	fifo_report = cfg->fifo_auto || cfg->rx_trigger || cfg->host_rx_trigger ||
+		      cfg->rx_timeout;
+
+	if (cfg->flow_control)
+		report_flow(dev, stderr);
+
+	if (cfg->cork_burst)
+		report_cork(dev, stderr);
+
+	if (cfg->tx_rate)
+		report_pace(dev, cfg->tx_rate, stderr);
+
+	if (fifo_report)
+		report_fifo(dev, stderr);
+
+	if (io.sink) {
+		if (sink_pressed(io.sink))
+			report_sink(io.sink, opts.sink.policy, stderr);
+		if (loop.stats) {
+			uuart_sink_latency(io.sink, &hist);
+			report_latency(stderr, "Console", &hist);
+		}
+		uuart_sink_free(io.sink);
+		close_outputs();
+	}
+
+	if (io.boot) {
+		report_boot(io.boot, opts.boot.n, io.boot_out);
+		if (io.boot_out != stderr)
+			fclose(io.boot_out);
+		uuart_boot_free(io.boot);
+	}
+
+	if (xfer) {
+		report_xfer(xfer);
+		rc = uuart_xfer_error(xfer);
+		if (rc < 0) {
+			errno = -rc;
+			err(EXIT_FAILURE, "transfer failed");
+		}
+		close(xfer_fd);
+		uuart_xfer_free(xfer);
+	}
+
+	if (slip) {
+		report_slip(slip, elapsed_s(&start));
+		tunlink_close(tun);
+		uuart_slip_free(slip);
+	}
+
+	if (mux) {
+		report_mux(mux, elapsed_s(&start));
+		muxsock_close(ms);
+	}
 
-	if (!cfg.no_tx)
-		fprintf(stderr, "Transmitted:\t%lu\n", txd);
+	if (!cfg->no_rx && loop.stats)
+		fprintf(stderr, "Received:\t%lu\n", loop.rxd);
 
-	if (!cfg.no_rx)
-		fprintf(stderr, "Received:\t%lu\n", rxd);
+	uuart_restore(dev);
+	fprintf(stderr, "Restored configuration\n");
+	uuart_dump_regs(dev, stderr);
 
 	exit(EXIT_SUCCESS);
 }
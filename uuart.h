@@ -0,0 +1,317 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_H
+#define UUART_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "hist.h"
+
+#define UUART_D_VUART1		0x1e787000
+#define UUART_D_VUART2		0x1e788000
+
+#define UUART_FIFO_SIZE		16
+
+/* Readiness reported by uuart_poll() */
+#define UUART_POLL_RX		(1U << 0)
+#define UUART_POLL_TX		(1U << 1)
+
+struct uuart;
+
+struct uuart_config {
+	bool assume_dtr;
+	bool assume_enabled;
+	bool assume_fifos;
+	bool no_rx;
+	bool no_tx;
+	/*
+	 * Honour the host's RTS and DTR (seen as MSR[CTS] and MSR[DSR]) before
+	 * writing THR, and let uuart_throttle() drive our MCR[RTS|DTR].
+	 */
+	bool flow_control;
+	/*
+	 * Batch host-bound Tx: hold Tx back while up to cork_burst bytes
+	 * collect, then write them to THR back to back once the burst is
+	 * complete or cork_max_ns after it started. Zero cork_burst disables
+	 * corking, zero cork_max_ns selects the default.
+	 */
+	size_t cork_burst;
+	unsigned long cork_max_ns;
+	/*
+	 * Pace the Tx uuart_step() takes from uuart_ops.tx to tx_rate bytes a
+	 * second with a token bucket tx_burst bytes deep, so no more than
+	 * tx_burst go out back to back. Zero tx_rate disables pacing, zero
+	 * tx_burst selects the room in the Tx FIFO.
+	 */
+	unsigned long tx_rate;
+	size_t tx_burst;
+	/*
+	 * Rx FIFO trigger levels in bytes, one of 1, 4, 8 or 14, for our side
+	 * (FCR) and for the host's (GCRA[H_RFT]), and the raw GCRA[S_TIMEOUT]
+	 * field. Zero selects a trigger of one byte, as before. With fifo_auto
+	 * both levels are retuned from the burst sizes seen while running.
+	 */
+	unsigned int rx_trigger;
+	unsigned int host_rx_trigger;
+	unsigned int rx_timeout;
+	bool fifo_auto;
+	/*
+	 * Issue one memory barrier per uuart_step() instead of one per register
+	 * access. The device sees its accesses in order either way, and the
+	 * barrier still orders them against memory before the step returns.
+	 */
+	bool batch_barriers;
+	/*
+	 * Use the one uuart_step() that tests no_rx, no_tx and batch_barriers on
+	 * every call, rather than the variant specialised for them. Only of use
+	 * to measure what the specialisation saves.
+	 */
+	bool generic_step;
+	/* Bounds for the idle poll backoff, zero selects the defaults */
+	unsigned long poll_min_ns;
+	unsigned long poll_max_ns;
+};
+
+/*
+ * Map the VUART at physical address @base through /dev/mem. Returns zero on
+ * success or a negative errno.
+ */
+int uuart_open(struct uuart **ctxp, unsigned long base);
+
+/* An 8250-compatible UART's MMIO window */
+struct uuart_mmio {
+	unsigned long base;
+	/* Registers are 1 << reg_shift bytes apart, 0 or 2 */
+	unsigned int reg_shift;
+	/* Access width in bits, 8 or 32, where 32 needs reg_shift 2 */
+	unsigned int io_width;
+	/* An ASPEED VUART, with GCRA and the registers after it */
+	bool vuart;
+};
+
+/*
+ * Map the UART described by @mmio through /dev/mem. uuart_open() is this with
+ * the VUART's layout. Devices without GCRA can't set the host trigger and
+ * timeout, and uuart_init() fails with -EOPNOTSUPP if asked to.
+ */
+int uuart_open_mmio(struct uuart **ctxp, const struct uuart_mmio *mmio);
+
+/*
+ * Map map 0 of the UIO device @name, either its uioN node or the name its
+ * driver gave it, a UART laid out as @mmio describes. @mmio->base is ignored,
+ * and uuart_base() reports the address UIO gives.
+ */
+int uuart_open_uio(struct uuart **ctxp, const char *name,
+		   const struct uuart_mmio *mmio);
+
+/*
+ * Attach to side @side (0 or 1) of a simulated VUART pair backed by the file
+ * at @path, creating it if needed. Whatever one side writes to THR the other
+ * reads from RBR, and each side's MCR drives the other's MSR, so two
+ * processes can exercise the full data path without hardware. uuart_base()
+ * reports zero for simulated devices.
+ */
+int uuart_open_sim(struct uuart **ctxp, const char *path, int side);
+
+/* Restore the startup register state and unmap the device */
+void uuart_close(struct uuart *ctx);
+
+/*
+ * Claim the device through a lock file in /run/lock keyed by its physical
+ * base address, or next to a simulator's backing file, so two instances never
+ * race on RBR. Owners exclude each other. Monitors share the device with
+ * each other and with an owner, and can read only the registers that reading
+ * leaves unchanged, with uuart_init(), the data path and uuart_poll() failing
+ * with -EPERM. uuart_init() claims ownership itself if need be.
+ *
+ * Returns -EBUSY if another owner holds the device, with *@holder set to its
+ * pid where known, or another negative errno if the lock file can't be used.
+ */
+int uuart_claim(struct uuart *ctx, bool monitor, pid_t *holder);
+
+const char *uuart_lock_path(const struct uuart *ctx);
+
+/*
+ * Save the register state and run the init sequence selected by @cfg. Returns
+ * zero on success or a negative errno.
+ */
+int uuart_init(struct uuart *ctx, const struct uuart_config *cfg);
+
+/*
+ * Apply @cfg to an initialised device without rerunning the init sequence, so
+ * the FIFO contents survive. The assume_* flags only matter to uuart_init()
+ * and are ignored. Call it between steps, never concurrently with them.
+ * Returns zero, or a negative errno with the old settings still in force.
+ */
+int uuart_reconfigure(struct uuart *ctx, const struct uuart_config *cfg);
+
+/*
+ * Put back the register state recorded by uuart_init() without discarding the
+ * FIFO contents. Safe to call more than once, and from an atexit() handler.
+ */
+void uuart_restore(struct uuart *ctx);
+
+unsigned long uuart_base(const struct uuart *ctx);
+
+void uuart_dump_regs(const struct uuart *ctx, FILE *stream);
+
+#define UUART_MAX_REGS		16
+
+struct uuart_reg {
+	const char *name;
+	unsigned long addr;
+	uint8_t val;
+};
+
+/*
+ * Read the registers uuart_dump_regs() shows into @regs, up to @n of them, and
+ * return how many that was.
+ */
+size_t uuart_read_regs(const struct uuart *ctx, struct uuart_reg *regs,
+		       size_t n);
+
+/*
+ * Non-blocking data path: move as many bytes as the FIFO state allows, up to
+ * @n. Returns the number of bytes transferred, which is zero if the device is
+ * not ready.
+ */
+ssize_t uuart_read(struct uuart *ctx, void *buf, size_t n);
+ssize_t uuart_write(struct uuart *ctx, const void *buf, size_t n);
+
+/*
+ * Sample the device and return a mask of UUART_POLL_* events. If @deadline is
+ * not NULL it is set to the CLOCK_MONOTONIC time the caller should poll again:
+ * immediately while the device is busy, backing off towards poll_max_ns while
+ * it is idle.
+ */
+int uuart_poll(struct uuart *ctx, struct timespec *deadline);
+
+/*
+ * Data callbacks for uuart_step(). @rx is handed bytes drained from the Rx FIFO
+ * and returns how many it consumed; the rest are offered again on later steps
+ * while the Rx FIFO is left to fill. @tx fills @buf with up to @len bytes to
+ * send and returns the count, zero when it has nothing to send.
+ */
+struct uuart_ops {
+	size_t (*rx)(void *priv, const uint8_t *buf, size_t len);
+	size_t (*tx)(void *priv, uint8_t *buf, size_t len);
+};
+
+/* The outcome of a single uuart_step() */
+struct uuart_step {
+	/* LSR as sampled at the start of the step */
+	uint8_t lsr;
+	/* Neither LSR[DR] nor LSR[THRE] was set */
+	bool stalled;
+	/* stalled differs from the previous step */
+	bool stall_changed;
+	/* Bytes moved through the FIFOs */
+	size_t rxd;
+	size_t txd;
+	/* Bytes staged in the context awaiting the sink or the Tx FIFO */
+	size_t rx_pending;
+	size_t tx_pending;
+};
+
+void uuart_set_ops(struct uuart *ctx, const struct uuart_ops *ops, void *priv);
+
+/*
+ * Run one non-blocking iteration of the poll loop: maintain IER, sample LSR,
+ * track stalls, then move data between the FIFOs and the uuart_ops callbacks.
+ * Re-entrant with respect to other devices, so several contexts can be driven
+ * from one event loop. Returns the number of bytes moved or a negative errno,
+ * and if @next is not NULL sets it as uuart_poll() sets its deadline.
+ */
+int uuart_step(struct uuart *ctx, struct uuart_step *step,
+	       struct timespec *next);
+
+/*
+ * The CLOCK_MONOTONIC time the Rx data uuart_ops.rx is being offered was read
+ * from the FIFO, for the sink to time its delivery from. Data the sink turned
+ * away keeps its time when offered again.
+ */
+uint64_t uuart_rx_ns(const struct uuart *ctx);
+
+struct uuart_flow_stats {
+	/* Times we deasserted RTS/DTR, and for how long in total */
+	uint64_t throttles;
+	uint64_t throttled_ns;
+	/* Times the host held off our Tx, and for how long in total */
+	uint64_t tx_holds;
+	uint64_t tx_held_ns;
+};
+
+/*
+ * Ask the host to stop (or resume) sending by deasserting (or asserting)
+ * MCR[RTS] and MCR[DTR]. A no-op unless flow_control is configured, and
+ * only touches the register when the state changes.
+ */
+void uuart_throttle(struct uuart *ctx, bool throttle);
+
+void uuart_flow_stats(const struct uuart *ctx, struct uuart_flow_stats *stats);
+
+struct uuart_cork_stats {
+	/* Deliveries the host saw, and the bytes in them */
+	uint64_t bursts;
+	uint64_t bytes;
+	uint64_t max_burst;
+	/* Bursts released by cork_max_ns rather than by filling up */
+	uint64_t timeouts;
+	/* Time from corking to uncorking, which the first byte waited */
+	uint64_t latency_total_ns;
+	uint64_t latency_max_ns;
+};
+
+void uuart_cork_stats(const struct uuart *ctx, struct uuart_cork_stats *stats);
+
+struct uuart_pace_stats {
+	/* Bytes written under pacing */
+	uint64_t bytes;
+	/* Times Tx found the bucket empty and waited for it to refill */
+	uint64_t waits;
+	/*
+	 * Bytes written since the bucket first ran empty, and the time from
+	 * then to the last write. Their ratio is the rate achieved, without
+	 * the full bucket pacing starts with.
+	 */
+	uint64_t rate_bytes;
+	uint64_t rate_ns;
+	/*
+	 * How late each write ending a wait went out, in ns after the bucket
+	 * held a byte for it
+	 */
+	struct uuart_hist jitter;
+};
+
+/* Reset whenever uuart_reconfigure() changes tx_rate or tx_burst */
+void uuart_pace_stats(const struct uuart *ctx, struct uuart_pace_stats *stats);
+
+struct uuart_fifo_stats {
+	/*
+	 * Burst size histograms, indexed by byte count: what each Rx FIFO
+	 * service found, and what each delivery to the host carried.
+	 */
+	uint64_t rx_bursts[UUART_FIFO_SIZE + 1];
+	uint64_t tx_bursts[UUART_FIFO_SIZE + 1];
+	/* Trigger levels in force, and how often fifo_auto changed them */
+	unsigned int rx_trigger;
+	unsigned int host_rx_trigger;
+	uint64_t retunes;
+};
+
+void uuart_fifo_stats(const struct uuart *ctx, struct uuart_fifo_stats *stats);
+
+/*
+ * Interrupts per byte a receiver with trigger @level takes for the bursts in
+ * @hist, were each burst's bytes to arrive one after another: one interrupt
+ * per @level bytes, plus a timeout for any remainder.
+ */
+double uuart_fifo_irqs_per_byte(const uint64_t *hist, unsigned int level);
+
+#endif
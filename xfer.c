@@ -0,0 +1,444 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc32.h"
+#include "xfer.h"
+
+#define XFER_SYNC		0x5a
+#define XFER_HDR_LEN		7
+#define XFER_CRC_LEN		4
+#define XFER_FRAME_MAX		(XFER_HDR_LEN + UUART_XFER_MAX_PAYLOAD + XFER_CRC_LEN)
+
+#define XFER_DEFAULT_WINDOW	16
+#define XFER_DEFAULT_PAYLOAD	256
+#define XFER_DEFAULT_RTO_NS	200000000UL
+
+#define XFER_F_EOF		(1U << 0)
+
+enum { XFER_DATA, XFER_ACK };
+
+struct xfer_slot {
+	uint8_t *data;
+	size_t len;
+	bool eof;
+	/* Sender: acknowledged. Receiver: held for in-order delivery */
+	bool done;
+	/* Sender: last transmission, zero when due for retransmit */
+	uint64_t sent_ns;
+};
+
+struct uuart_xfer {
+	struct uuart_xfer_config cfg;
+	bool sender;
+	uuart_xfer_io io;
+	void *priv;
+	int error;
+
+	struct xfer_slot slots[UUART_XFER_MAX_WINDOW];
+
+	/* Sender: oldest unacknowledged and next unsent sequence numbers */
+	uint16_t base;
+	uint16_t next;
+	bool eof_read;
+	bool eof_acked;
+
+	/* Receiver: next sequence number to deliver */
+	uint16_t expected;
+	bool eof_delivered;
+	bool need_ack;
+	uint64_t last_rx_ns;
+
+	uint8_t txf[XFER_FRAME_MAX];
+	size_t txf_off;
+	size_t txf_len;
+
+	uint8_t rxf[XFER_FRAME_MAX];
+	size_t rxf_len;
+
+	uint64_t start_ns;
+	uint64_t end_ns;
+	struct uuart_xfer_stats stats;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int xfer_new(struct uuart_xfer **xp, const struct uuart_xfer_config *cfg,
+		    bool sender, uuart_xfer_io io, void *priv)
+{
+	struct uuart_xfer *x;
+
+	x = calloc(1, sizeof(*x));
+	if (!x)
+		return -errno;
+
+	x->cfg = *cfg;
+	if (!x->cfg.window)
+		x->cfg.window = XFER_DEFAULT_WINDOW;
+	if (!x->cfg.payload)
+		x->cfg.payload = XFER_DEFAULT_PAYLOAD;
+	if (!x->cfg.rto_ns)
+		x->cfg.rto_ns = XFER_DEFAULT_RTO_NS;
+
+	/* Slots are indexed modulo the window across sequence wrap */
+	if (x->cfg.window > UUART_XFER_MAX_WINDOW ||
+	    (x->cfg.window & (x->cfg.window - 1)) ||
+	    x->cfg.payload > UUART_XFER_MAX_PAYLOAD) {
+		free(x);
+		return -EINVAL;
+	}
+
+	for (unsigned int i = 0; i < x->cfg.window; i++) {
+		x->slots[i].data = malloc(x->cfg.payload);
+		if (!x->slots[i].data) {
+			uuart_xfer_free(x);
+			return -ENOMEM;
+		}
+	}
+
+	x->sender = sender;
+	x->io = io;
+	x->priv = priv;
+
+	*xp = x;
+
+	return 0;
+}
+
+int uuart_xfer_new_sender(struct uuart_xfer **xp,
+			  const struct uuart_xfer_config *cfg,
+			  uuart_xfer_io source, void *priv)
+{
+	return xfer_new(xp, cfg, true, source, priv);
+}
+
+int uuart_xfer_new_receiver(struct uuart_xfer **xp,
+			    const struct uuart_xfer_config *cfg,
+			    uuart_xfer_io sink, void *priv)
+{
+	return xfer_new(xp, cfg, false, sink, priv);
+}
+
+void uuart_xfer_free(struct uuart_xfer *x)
+{
+	for (unsigned int i = 0; i < UUART_XFER_MAX_WINDOW; i++)
+		free(x->slots[i].data);
+
+	free(x);
+}
+
+static struct xfer_slot *slot(struct uuart_xfer *x, uint16_t seq)
+{
+	return &x->slots[seq % x->cfg.window];
+}
+
+static void frame_seal(struct uuart_xfer *x, uint8_t type, uint8_t flags,
+		       uint16_t seq, const uint8_t *payload, size_t len)
+{
+	uint32_t crc;
+
+	x->txf[0] = XFER_SYNC;
+	x->txf[1] = type;
+	x->txf[2] = flags;
+	x->txf[3] = seq >> 8;
+	x->txf[4] = seq & 0xff;
+	x->txf[5] = len >> 8;
+	x->txf[6] = len & 0xff;
+	memcpy(&x->txf[XFER_HDR_LEN], payload, len);
+
+	crc = uuart_crc32(0, &x->txf[1], XFER_HDR_LEN - 1 + len);
+	for (int i = 0; i < XFER_CRC_LEN; i++)
+		x->txf[XFER_HDR_LEN + len + i] = crc >> (8 * i);
+
+	x->txf_off = 0;
+	x->txf_len = XFER_HDR_LEN + len + XFER_CRC_LEN;
+	x->stats.packets++;
+}
+
+static void send_data(struct uuart_xfer *x, uint16_t seq, uint64_t now)
+{
+	struct xfer_slot *s = slot(x, seq);
+
+	frame_seal(x, XFER_DATA, s->eof ? XFER_F_EOF : 0, seq, s->data, s->len);
+	s->sent_ns = now;
+}
+
+static bool schedule_sender(struct uuart_xfer *x)
+{
+	uint64_t now = now_ns();
+	struct xfer_slot *s;
+	ssize_t len;
+
+	if (!x->start_ns)
+		x->start_ns = now;
+
+	/* Selective retransmit of anything due */
+	for (uint16_t seq = x->base; seq != x->next; seq++) {
+		s = slot(x, seq);
+		if (s->done || now - s->sent_ns < x->cfg.rto_ns)
+			continue;
+
+		if (s->sent_ns)
+			x->stats.retransmits++;
+		send_data(x, seq, now);
+		return true;
+	}
+
+	if (x->eof_read || (uint16_t)(x->next - x->base) >= x->cfg.window)
+		return false;
+
+	s = slot(x, x->next);
+	len = x->io(x->priv, s->data, x->cfg.payload);
+	if (len < 0) {
+		x->error = len;
+		return false;
+	}
+
+	s->len = len;
+	s->eof = !len;
+	s->done = false;
+	x->eof_read = s->eof;
+
+	send_data(x, x->next++, now);
+
+	return true;
+}
+
+static bool schedule_receiver(struct uuart_xfer *x)
+{
+	uint8_t bitmap[4] = { 0 };
+
+	if (!x->need_ack)
+		return false;
+
+	for (unsigned int i = 0; i + 1 < x->cfg.window; i++) {
+		if (slot(x, x->expected + 1 + i)->done)
+			bitmap[i / 8] |= 1U << (i % 8);
+	}
+
+	frame_seal(x, XFER_ACK, 0, x->expected, bitmap, sizeof(bitmap));
+	x->need_ack = false;
+
+	return true;
+}
+
+size_t uuart_xfer_link_tx(void *priv, uint8_t *buf, size_t len)
+{
+	struct uuart_xfer *x = priv;
+	size_t filled = 0;
+	size_t n;
+
+	while (filled < len && !x->error) {
+		if (x->txf_off == x->txf_len &&
+		    !(x->sender ? schedule_sender(x) : schedule_receiver(x)))
+			break;
+
+		n = x->txf_len - x->txf_off;
+		if (n > len - filled)
+			n = len - filled;
+
+		memcpy(&buf[filled], &x->txf[x->txf_off], n);
+		x->txf_off += n;
+		filled += n;
+	}
+
+	return filled;
+}
+
+static void handle_ack(struct uuart_xfer *x, uint16_t cum,
+		       const uint8_t *bitmap)
+{
+	uint64_t now = now_ns();
+	uint16_t highest;
+
+	/* Ignore stale or bogus cumulative acknowledgements */
+	if ((uint16_t)(cum - x->base) > (uint16_t)(x->next - x->base))
+		return;
+
+	while (x->base != cum) {
+		struct xfer_slot *s = slot(x, x->base);
+
+		if (!s->done)
+			x->stats.bytes += s->len;
+		if (s->eof)
+			x->eof_acked = true;
+		s->done = true;
+		x->base++;
+	}
+
+	highest = x->base;
+	for (unsigned int i = 0; i + 1 < x->cfg.window; i++) {
+		uint16_t seq = x->base + 1 + i;
+		struct xfer_slot *s;
+
+		if ((uint16_t)(seq - x->base) >= (uint16_t)(x->next - x->base))
+			break;
+
+		if (!(bitmap[i / 8] & (1U << (i % 8))))
+			continue;
+
+		s = slot(x, seq);
+		if (!s->done)
+			x->stats.bytes += s->len;
+		s->done = true;
+		highest = seq;
+	}
+
+	/* Holes below a selectively acknowledged packet are presumed lost */
+	for (uint16_t seq = x->base; seq != highest; seq++) {
+		struct xfer_slot *s = slot(x, seq);
+
+		if (!s->done && now - s->sent_ns >= x->cfg.rto_ns / 4)
+			s->sent_ns = 0;
+	}
+
+	if (x->eof_acked && !x->end_ns)
+		x->end_ns = now;
+}
+
+static void handle_data(struct uuart_xfer *x, uint8_t flags, uint16_t seq,
+			const uint8_t *payload, size_t len)
+{
+	uint16_t offset = seq - x->expected;
+	struct xfer_slot *s;
+	ssize_t rc;
+
+	x->need_ack = true;
+	x->last_rx_ns = now_ns();
+	if (!x->start_ns)
+		x->start_ns = x->last_rx_ns;
+
+	if (offset >= x->cfg.window || len > x->cfg.payload ||
+	    slot(x, seq)->done) {
+		x->stats.duplicates++;
+		return;
+	}
+
+	s = slot(x, seq);
+	memcpy(s->data, payload, len);
+	s->len = len;
+	s->eof = flags & XFER_F_EOF;
+	s->done = true;
+
+	for (s = slot(x, x->expected); s->done && !x->eof_delivered;
+	     s = slot(x, x->expected)) {
+		for (size_t off = 0; off < s->len; off += rc) {
+			rc = x->io(x->priv, s->data + off, s->len - off);
+			if (rc <= 0) {
+				x->error = rc ? rc : -EIO;
+				return;
+			}
+		}
+
+		x->stats.bytes += s->len;
+		x->eof_delivered = s->eof;
+		s->done = false;
+		x->expected++;
+	}
+
+	if (x->eof_delivered && !x->end_ns)
+		x->end_ns = x->last_rx_ns;
+}
+
+static void deliver(struct uuart_xfer *x, size_t len)
+{
+	uint8_t type = x->rxf[1];
+	uint8_t flags = x->rxf[2];
+	uint16_t seq = (x->rxf[3] << 8) | x->rxf[4];
+	const uint8_t *payload = &x->rxf[XFER_HDR_LEN];
+
+	if (x->sender && type == XFER_ACK && len == 4)
+		handle_ack(x, seq, payload);
+	else if (!x->sender && type == XFER_DATA)
+		handle_data(x, flags, seq, payload, len);
+}
+
+/* Drop @skip bytes, then anything up to the next SYNC */
+static void hunt(struct uuart_xfer *x, size_t skip)
+{
+	size_t i;
+
+	for (i = skip; i < x->rxf_len && x->rxf[i] != XFER_SYNC; i++)
+		;
+
+	memmove(x->rxf, &x->rxf[i], x->rxf_len - i);
+	x->rxf_len -= i;
+}
+
+size_t uuart_xfer_link_rx(void *priv, const uint8_t *buf, size_t len)
+{
+	struct uuart_xfer *x = priv;
+
+	for (size_t i = 0; i < len; i++) {
+		if (!x->rxf_len && buf[i] != XFER_SYNC)
+			continue;
+
+		x->rxf[x->rxf_len++] = buf[i];
+
+		while (x->rxf_len >= XFER_HDR_LEN) {
+			size_t plen = (x->rxf[5] << 8) | x->rxf[6];
+			size_t want = XFER_HDR_LEN + plen + XFER_CRC_LEN;
+			uint32_t crc = 0;
+
+			if (plen > UUART_XFER_MAX_PAYLOAD) {
+				x->stats.crc_errors++;
+				hunt(x, 1);
+				continue;
+			}
+
+			if (x->rxf_len < want)
+				break;
+
+			for (int j = 0; j < XFER_CRC_LEN; j++)
+				crc |= (uint32_t)x->rxf[want - XFER_CRC_LEN + j] << (8 * j);
+
+			if (crc != uuart_crc32(0, &x->rxf[1], want - 1 - XFER_CRC_LEN)) {
+				x->stats.crc_errors++;
+				hunt(x, 1);
+				continue;
+			}
+
+			deliver(x, plen);
+			hunt(x, want);
+		}
+	}
+
+	return len;
+}
+
+bool uuart_xfer_done(struct uuart_xfer *x)
+{
+	if (x->error)
+		return true;
+
+	if (x->sender)
+		return x->eof_acked;
+
+	return x->eof_delivered && !x->need_ack &&
+	       now_ns() - x->last_rx_ns >= 2 * x->cfg.rto_ns;
+}
+
+int uuart_xfer_error(const struct uuart_xfer *x)
+{
+	return x->error;
+}
+
+void uuart_xfer_stats(const struct uuart_xfer *x,
+		      struct uuart_xfer_stats *stats)
+{
+	*stats = x->stats;
+	stats->elapsed_ns = x->end_ns > x->start_ns ? x->end_ns - x->start_ns : 0;
+}
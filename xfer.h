@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_XFER_H
+#define UUART_XFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Reliable bulk transfer over a VUART with selective repeat. Each packet is
+ *
+ *	SYNC TYPE FLAGS SEQ[2] LEN[2] PAYLOAD[LEN] CRC32[4]
+ *
+ * with big-endian fields and a little-endian CRC-32 over TYPE through
+ * PAYLOAD. The sender keeps up to a window of DATA packets in flight, and the
+ * receiver answers each one with an ACK carrying the next sequence number it
+ * expects plus a bitmap of the packets it holds beyond that. Packets missing
+ * from the bitmap are retransmitted early; anything else unacknowledged is
+ * retransmitted after the timeout. An empty DATA packet flagged EOF ends the
+ * transfer.
+ */
+
+#define UUART_XFER_MAX_WINDOW	32
+#define UUART_XFER_MAX_PAYLOAD	1024
+
+struct uuart_xfer;
+
+struct uuart_xfer_config {
+	/* Packets in flight, a power of two up to UUART_XFER_MAX_WINDOW */
+	unsigned int window;
+	/* DATA payload size, at most UUART_XFER_MAX_PAYLOAD */
+	size_t payload;
+	/* Retransmit timeout */
+	unsigned long rto_ns;
+};
+
+struct uuart_xfer_stats {
+	uint64_t bytes;
+	uint64_t packets;
+	uint64_t retransmits;
+	uint64_t crc_errors;
+	uint64_t duplicates;
+	/* From the first packet to completion */
+	uint64_t elapsed_ns;
+};
+
+/*
+ * @io reads the data to send, returning zero at end of file, or writes the
+ * data received, returning the bytes consumed. Negative returns are errnos
+ * that abort the transfer. Zero fields in @cfg select the defaults.
+ */
+typedef ssize_t (*uuart_xfer_io)(void *priv, void *buf, size_t len);
+
+int uuart_xfer_new_sender(struct uuart_xfer **xp,
+			  const struct uuart_xfer_config *cfg,
+			  uuart_xfer_io source, void *priv);
+int uuart_xfer_new_receiver(struct uuart_xfer **xp,
+			    const struct uuart_xfer_config *cfg,
+			    uuart_xfer_io sink, void *priv);
+void uuart_xfer_free(struct uuart_xfer *x);
+
+/* Link side, matching uuart_ops.tx and uuart_ops.rx for uuart_step() */
+size_t uuart_xfer_link_tx(void *x, uint8_t *buf, size_t len);
+size_t uuart_xfer_link_rx(void *x, const uint8_t *buf, size_t len);
+
+/*
+ * True once the sender has its EOF acknowledged, or once the receiver has
+ * delivered EOF and the sender has gone quiet for two timeouts, so a lost
+ * final ACK can still be repeated.
+ */
+bool uuart_xfer_done(struct uuart_xfer *x);
+
+/* Zero, or the negative errno that aborted the transfer */
+int uuart_xfer_error(const struct uuart_xfer *x);
+
+void uuart_xfer_stats(const struct uuart_xfer *x,
+		      struct uuart_xfer_stats *stats);
+
+#endif
@@ -0,0 +1,314 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "lz.h"
+#include "zlog.h"
+
+#define ZLOG_BLOCK_SIZE		65536
+#define ZLOG_FLUSH_NS		1000000000UL
+/* Room in the pipe for bursts that arrive while a block is compressing */
+#define ZLOG_PIPE_SIZE		(1 << 20)
+
+struct uuart_zlog {
+	int fd;
+	int in[2];
+	struct uuart_zlog_config cfg;
+	pthread_t thread;
+
+	/* The block being filled, and its compressed form */
+	uint8_t *raw;
+	size_t len;
+	uint8_t *comp;
+	uint64_t raw_off;
+	/* File position the block goes at, for the index */
+	uint64_t pos;
+	uint64_t first_ns;
+	uint64_t last_ns;
+	/* CLOCK_MONOTONIC time the block is due to be cut */
+	uint64_t due;
+
+	_Atomic uint64_t blocks;
+	_Atomic uint64_t raw_bytes;
+	_Atomic uint64_t file_bytes;
+	_Atomic uint64_t cpu_ns;
+	_Atomic uint64_t write_errors;
+};
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define load(p)		atomic_load_explicit(p, memory_order_relaxed)
+#define add(p, v)	atomic_store_explicit(p, load(p) + (v), \
+					      memory_order_relaxed)
+
+static void put_le(uint8_t *p, uint64_t val, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; i++)
+		p[i] = val >> (8 * i);
+}
+
+static uint64_t get_le(const uint8_t *p, size_t bytes)
+{
+	uint64_t val = 0;
+
+	for (size_t i = bytes; i; i--)
+		val = val << 8 | p[i - 1];
+
+	return val;
+}
+
+static void write_all(struct uuart_zlog *z, const uint8_t *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(z->fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			add(&z->write_errors, 1);
+			return;
+		}
+
+		add(&z->file_bytes, n);
+		z->pos += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Compress and write out the block being filled, then index it */
+static void cut_block(struct uuart_zlog *z)
+{
+	uint8_t hdr[UUART_ZLOG_HDR_LEN];
+	const uint8_t *payload = z->comp;
+	uint64_t pos = z->pos;
+	uint32_t flags = 0;
+	uint64_t cpu;
+	size_t len;
+
+	if (!z->len)
+		return;
+
+	if (z->cfg.raw) {
+		write_all(z, z->raw, z->len);
+		goto done;
+	}
+
+	cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	len = uuart_lz_compress(z->raw, z->len, z->comp, z->len - 1);
+	add(&z->cpu_ns, clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu);
+
+	/* Data that doesn't shrink is stored as is */
+	if (!len) {
+		payload = z->raw;
+		len = z->len;
+		flags = UUART_ZLOG_STORED;
+	}
+
+	memcpy(hdr, UUART_ZLOG_MAGIC, 4);
+	put_le(&hdr[4], z->len, 4);
+	put_le(&hdr[8], len, 4);
+	put_le(&hdr[12], flags, 4);
+	put_le(&hdr[16], z->raw_off, 8);
+	put_le(&hdr[24], z->first_ns, 8);
+	put_le(&hdr[32], z->last_ns, 8);
+	put_le(&hdr[40], uuart_crc32(0, z->raw, z->len), 4);
+
+	write_all(z, hdr, sizeof(hdr));
+	write_all(z, payload, len);
+
+done:
+	/* A failed index write costs the reader a longer scan, nothing more */
+	if (z->cfg.index)
+		uuart_index_add(z->cfg.index, z->first_ns, z->raw_off, pos);
+
+	add(&z->blocks, 1);
+	add(&z->raw_bytes, z->len);
+	z->raw_off += z->len;
+	z->len = 0;
+}
+
+static void *zlog_thread(void *arg)
+{
+	struct uuart_zlog *z = arg;
+	struct pollfd pfd = { .fd = z->in[0], .events = POLLIN };
+	uint64_t now;
+	int timeout;
+	ssize_t n;
+
+	while (1) {
+		timeout = -1;
+		if (z->len) {
+			now = clock_ns(CLOCK_MONOTONIC);
+			timeout = z->due > now ?
+				  (z->due - now + 999999) / 1000000 : 0;
+		}
+
+		if (poll(&pfd, 1, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (!pfd.revents) {
+			cut_block(z);
+			continue;
+		}
+
+		n = read(z->in[0], z->raw + z->len, z->cfg.block_size - z->len);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0)
+			break;
+
+		z->last_ns = clock_ns(CLOCK_REALTIME);
+		if (!z->len) {
+			z->first_ns = z->last_ns;
+			z->due = clock_ns(CLOCK_MONOTONIC) + z->cfg.flush_ns;
+		}
+
+		z->len += n;
+		if (z->len == z->cfg.block_size ||
+		    clock_ns(CLOCK_MONOTONIC) >= z->due)
+			cut_block(z);
+	}
+
+	cut_block(z);
+
+	return NULL;
+}
+
+int uuart_zlog_open(struct uuart_zlog **zp, int fd,
+		    const struct uuart_zlog_config *cfg, int *input)
+{
+	struct uuart_zlog *z;
+	int rc;
+
+	if (cfg->block_size > UUART_ZLOG_BLOCK_MAX)
+		return -EINVAL;
+
+	z = calloc(1, sizeof(*z));
+	if (!z)
+		return -errno;
+
+	z->fd = fd;
+	z->cfg = *cfg;
+	if (!z->cfg.block_size)
+		z->cfg.block_size = ZLOG_BLOCK_SIZE;
+	if (!z->cfg.flush_ns)
+		z->cfg.flush_ns = ZLOG_FLUSH_NS;
+	if (z->cfg.index) {
+		z->raw_off = uuart_index_raw_end(z->cfg.index);
+		z->pos = uuart_index_pos(z->cfg.index);
+	}
+
+	z->raw = malloc(z->cfg.block_size);
+	z->comp = malloc(z->cfg.block_size);
+	if (!z->raw || !z->comp) {
+		rc = -ENOMEM;
+		goto cleanup;
+	}
+
+	if (pipe2(z->in, O_CLOEXEC)) {
+		rc = -errno;
+		goto cleanup;
+	}
+
+	/* Best effort: a smaller pipe only pushes back on the writer sooner */
+	fcntl(z->in[1], F_SETPIPE_SZ, ZLOG_PIPE_SIZE);
+
+	rc = pthread_create(&z->thread, NULL, zlog_thread, z);
+	if (rc) {
+		close(z->in[0]);
+		close(z->in[1]);
+		rc = -rc;
+		goto cleanup;
+	}
+
+	*input = z->in[1];
+	*zp = z;
+
+	return 0;
+
+cleanup:
+	free(z->comp);
+	free(z->raw);
+	free(z);
+
+	return rc;
+}
+
+void uuart_zlog_close(struct uuart_zlog *z, struct uuart_zlog_stats *stats)
+{
+	close(z->in[1]);
+	pthread_join(z->thread, NULL);
+	close(z->in[0]);
+
+	if (stats) {
+		stats->blocks = load(&z->blocks);
+		stats->raw_bytes = load(&z->raw_bytes);
+		stats->file_bytes = load(&z->file_bytes);
+		stats->cpu_ns = load(&z->cpu_ns);
+		stats->write_errors = load(&z->write_errors);
+	}
+
+	free(z->comp);
+	free(z->raw);
+	free(z);
+}
+
+int uuart_zlog_parse(const uint8_t *hdr, struct uuart_zlog_block *blk)
+{
+	if (memcmp(hdr, UUART_ZLOG_MAGIC, 4))
+		return -EINVAL;
+
+	blk->raw_len = get_le(&hdr[4], 4);
+	blk->len = get_le(&hdr[8], 4);
+	blk->flags = get_le(&hdr[12], 4);
+	blk->raw_off = get_le(&hdr[16], 8);
+	blk->first_ns = get_le(&hdr[24], 8);
+	blk->last_ns = get_le(&hdr[32], 8);
+	blk->crc = get_le(&hdr[40], 4);
+
+	if (blk->raw_len > UUART_ZLOG_BLOCK_MAX || blk->len > blk->raw_len)
+		return -EINVAL;
+
+	return 0;
+}
+
+int uuart_zlog_decode(const struct uuart_zlog_block *blk,
+		      const uint8_t *payload, uint8_t *raw)
+{
+	if (blk->flags & UUART_ZLOG_STORED) {
+		if (blk->len != blk->raw_len)
+			return -EINVAL;
+		memcpy(raw, payload, blk->len);
+	} else if (uuart_lz_decompress(payload, blk->len, raw, blk->raw_len) !=
+		   blk->raw_len) {
+		return -EINVAL;
+	}
+
+	return uuart_crc32(0, raw, blk->raw_len) == blk->crc ? 0 : -EINVAL;
+}
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (C) 2021 IBM Corp. */
+
+#ifndef UUART_ZLOG_H
+#define UUART_ZLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "index.h"
+
+/*
+ * Compressed capture files. Data written to the zlog's input is cut into
+ * blocks on a thread of its own, compressed with uuart_lz_compress() and
+ * appended to the output fd, so compression never holds up the writer. Every
+ * block decompresses on its own and its header says where it sits in the
+ * uncompressed stream and when its first and last bytes arrived, so a reader
+ * can hop from header to header to the time it wants.
+ *
+ * A block is a header of UUART_ZLOG_HDR_LEN bytes, little-endian:
+ *
+ *	0	"UUZ1"
+ *	4	u32 raw length
+ *	8	u32 payload length
+ *	12	u32 flags, UUART_ZLOG_STORED if the payload is uncompressed
+ *	16	u64 offset of the block's first byte in the uncompressed stream
+ *	24	u64 CLOCK_REALTIME ns its first byte arrived
+ *	32	u64 CLOCK_REALTIME ns its last byte arrived
+ *	40	u32 CRC-32 of the raw data
+ *
+ * then the payload.
+ *
+ * A raw zlog writes its chunks out as they are, without headers, for a plain
+ * capture file that still wants the zlog's thread to maintain its index.
+ */
+
+#define UUART_ZLOG_MAGIC	"UUZ1"
+#define UUART_ZLOG_HDR_LEN	44
+#define UUART_ZLOG_STORED	(1U << 0)
+#define UUART_ZLOG_BLOCK_MAX	(1U << 20)
+
+struct uuart_zlog;
+
+struct uuart_zlog_config {
+	/* Raw bytes per block, up to UUART_ZLOG_BLOCK_MAX, zero for 64 KiB */
+	size_t block_size;
+	/* Cut a partial block once its first byte is this old, zero for 1 s */
+	unsigned long flush_ns;
+	/* Write chunks uncompressed and without headers */
+	bool raw;
+	/*
+	 * Add a record to @index per block, carrying on from where it says the
+	 * stream ends. Left open for the caller to close after the zlog.
+	 */
+	struct uuart_index *index;
+};
+
+struct uuart_zlog_stats {
+	uint64_t blocks;
+	uint64_t raw_bytes;
+	/* Bytes written, headers included */
+	uint64_t file_bytes;
+	/* CPU time the thread spent compressing */
+	uint64_t cpu_ns;
+	uint64_t write_errors;
+};
+
+struct uuart_zlog_block {
+	uint32_t raw_len;
+	uint32_t len;
+	uint32_t flags;
+	uint64_t raw_off;
+	uint64_t first_ns;
+	uint64_t last_ns;
+	uint32_t crc;
+};
+
+/*
+ * Start compressing into @fd, which is written from the zlog's thread only.
+ * *@input is set to the fd to write raw data into, a pipe the zlog owns.
+ */
+int uuart_zlog_open(struct uuart_zlog **zp, int fd,
+		    const struct uuart_zlog_config *cfg, int *input);
+
+/*
+ * Close the input, write out what is left and stop the thread, then fill in
+ * @stats if not NULL. @fd is left open.
+ */
+void uuart_zlog_close(struct uuart_zlog *z, struct uuart_zlog_stats *stats);
+
+/* Parse the block header at @hdr, returning -EINVAL if it isn't one */
+int uuart_zlog_parse(const uint8_t *hdr, struct uuart_zlog_block *blk);
+
+/*
+ * Recover @blk's raw data from its @payload into @raw, which has room for
+ * blk->raw_len bytes. Returns zero, or -EINVAL if it is corrupt.
+ */
+int uuart_zlog_decode(const struct uuart_zlog_block *blk,
+		      const uint8_t *payload, uint8_t *raw);
+
+#endif